@@ -0,0 +1,173 @@
+#define _GNU_SOURCE // MSG_CMSG_CLOEXEC
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
+#include "handoff.h"
+
+// Nothing but the socketpair and stdio may reach the new server: a client socket it held by
+// accident would never see its close from the old one
+static void close_inherited(void)
+{
+#ifdef SYS_close_range
+    if (syscall(SYS_close_range, HANDOFF_FD + 1, ~0U, 0) == 0) return;
+#endif
+    struct rlimit rl;
+    long max = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) max = (long)rl.rlim_cur;
+    for (long fd = HANDOFF_FD + 1; fd < max; fd++) close((int)fd);
+}
+
+pid_t handoff_spawn(char **argv, int *sock)
+{
+    int argc = 0;
+    while (argv[argc] != NULL) argc++;
+
+    // Built before fork, the child may only make system calls
+    char **nargv = calloc((size_t)argc + 3, sizeof(char *));
+    char fdbuf[16];
+    if (nargv == NULL) return -1;
+    snprintf(fdbuf, sizeof(fdbuf), "%d", HANDOFF_FD);
+    int n = 0;
+    nargv[n++] = argv[0];
+    nargv[n++] = "-u";
+    nargv[n++] = fdbuf;
+    for (int i = 1; i < argc; i++) {
+        // A server that came from an upgrade itself passes its own -u on only once
+        if (strcmp(argv[i], "-u") == 0) {
+            i++;
+            continue;
+        }
+        if (strncmp(argv[i], "-u", 2) == 0) continue;
+        nargv[n++] = argv[i];
+    }
+    nargv[n] = NULL;
+
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sv) < 0) {
+        perror("socketpair");
+        free(nargv);
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (sv[1] != HANDOFF_FD) {
+            if (dup2(sv[1], HANDOFF_FD) < 0) _exit(127);
+            close(sv[1]);
+        }
+        close(sv[0]);
+        close_inherited();
+        execvp(nargv[0], nargv);
+        perror(nargv[0]);
+        _exit(127);
+    }
+
+    free(nargv);
+    close(sv[1]);
+    if (pid < 0) {
+        perror("fork");
+        close(sv[0]);
+        return -1;
+    }
+    *sock = sv[0];
+    return pid;
+}
+
+int handoff_send(int sock, int type, const void *body, size_t len, const int *fds, int nfds)
+{
+    HandoffHeader h = { HANDOFF_MAGIC, HANDOFF_VERSION, (uint32_t)type, (uint32_t)len };
+    struct iovec iov[2] = { { &h, sizeof(h) }, { (void *)body, len } };
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = len > 0 ? 2 : 1;
+
+    if (nfds > HANDOFF_MAX_FDS) return 1;
+    if (nfds > 0) {
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * nfds);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int) * nfds);
+        memcpy(CMSG_DATA(cm), fds, sizeof(int) * nfds);
+    }
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(sock, &msg, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    if (sent != (ssize_t)(sizeof(h) + len)) {
+        if (sent < 0) perror("handoff send");
+        return 1;
+    }
+    return 0;
+}
+
+int handoff_recv(int sock, int timeout_ms, void *buf, size_t cap, size_t *len, int *fds, int *nfds)
+{
+    *len = 0;
+    *nfds = 0;
+
+    struct pollfd pfd = { sock, POLLIN, 0 };
+    int ready;
+    do {
+        ready = poll(&pfd, 1, timeout_ms);
+    } while (ready < 0 && errno == EINTR);
+    if (ready <= 0) {
+        if (ready == 0) fprintf(stderr, "handoff: no message in %d ms\n", timeout_ms);
+        else perror("handoff poll");
+        return -1;
+    }
+
+    HandoffHeader h;
+    struct iovec iov[2] = { { &h, sizeof(h) }, { buf, cap } };
+    char control[CMSG_SPACE(sizeof(int) * HANDOFF_MAX_FDS)];
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = 2;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t got;
+    do {
+        got = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+    } while (got < 0 && errno == EINTR);
+    if (got < 0) {
+        // msg_controllen was never written back, control holds nothing
+        perror("handoff recv");
+        return -1;
+    }
+
+    for (struct cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+        if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS) continue;
+        int n = (int)((cm->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+        int *in = (int *)CMSG_DATA(cm);
+        for (int i = 0; i < n; i++) {
+            // fds holds HANDOFF_MAX_FDS, anything past that is closed rather than leaked
+            if (*nfds < HANDOFF_MAX_FDS) fds[(*nfds)++] = in[i];
+            else close(in[i]);
+        }
+    }
+
+    int bad = got < (ssize_t)sizeof(h) || (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) ||
+              h.magic != HANDOFF_MAGIC || h.version != HANDOFF_VERSION || h.len != (size_t)got - sizeof(h);
+    if (bad) {
+        if (got > 0) fprintf(stderr, "handoff: malformed message\n");
+        for (int i = 0; i < *nfds; i++) close(fds[i]);
+        *nfds = 0;
+        return -1;
+    }
+    *len = h.len;
+    return (int)h.type;
+}
@@ -0,0 +1,52 @@
+#ifndef NIMD_HANDOFF_H
+#define NIMD_HANDOFF_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Hot upgrade: a running server execs a new binary and hands it its listeners and the games
+// in play, sockets included, so nobody is disconnected
+// The two processes talk over a SOCK_SEQPACKET socketpair. Every message is one packet, a
+// HandoffHeader and its body, with any sockets riding along as SCM_RIGHTS
+
+#define HANDOFF_MAGIC      0x4e494d55u // "NIMU"
+#define HANDOFF_VERSION    1
+#define HANDOFF_FD         3     // Where the new server finds its end of the socketpair
+#define HANDOFF_MAX_FDS    64    // Sockets one message can carry
+#define HANDOFF_TIMEOUT_MS 10000 // Longest either side waits for the other's next message
+
+enum {
+    HANDOFF_HELLO = 1, // old -> new: HandoffHello
+    HANDOFF_READY, // new -> old: HandoffHello of the new binary, it can take over
+    HANDOFF_LISTENERS, // old -> new: no body, the listening sockets
+    HANDOFF_GAME, // old -> new: one game and its players' sockets, layout is the server's
+    HANDOFF_DONE, // old -> new: nothing more follows
+    HANDOFF_ACK, // new -> old: everything arrived, the new server owns it all now
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t type;
+    uint32_t len; // Body bytes after the header
+} HandoffHeader;
+
+typedef struct {
+    uint32_t game_size; // sizeof the server's game record, binaries must agree on it
+    int32_t engine; // Engine of the sender
+    int32_t piles; // Board size of the sender, games in play need the same
+} HandoffHello;
+
+// Old server: exec argv[0] as a new server holding the other end of a fresh socketpair at
+// HANDOFF_FD, with "-u" added to its arguments. Returns the child's pid and sets *sock
+pid_t handoff_spawn(char **argv, int *sock);
+
+// Returns 0 once the whole message is sent
+int handoff_send(int sock, int type, const void *body, size_t len, const int *fds, int nfds);
+
+// Waits up to timeout_ms for the next message and returns its type, -1 on error, EOF or
+// timeout. The body goes to buf (*len bytes); received sockets to fds (*nfds of them)
+int handoff_recv(int sock, int timeout_ms, void *buf, size_t cap, size_t *len, int *fds, int *nfds);
+
+#endif
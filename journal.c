@@ -0,0 +1,341 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "journal.h"
+#include "metrics.h"
+
+#define JOURNAL_RING_SIZE 512     // Records per thread, must be a power of two
+#define JOURNAL_OUT_SIZE  65536   // Writer batches this much per write()
+#define JOURNAL_IDLE_NS   1000000 // Writer naps 1ms when every ring is empty
+
+// Single producer (the owning thread), single consumer (the writer)
+typedef struct JournalRing {
+    JournalRecord recs[JOURNAL_RING_SIZE];
+    unsigned head; // Next slot to fill, only stored by the owner
+    unsigned tail; // Next slot to write out, only stored by the writer
+    unsigned dropped; // Records lost to a full ring, only stored by the owner
+    unsigned dropped_seen; // Writer's copy of dropped at the last report
+    int dead; // Owner has exited, the writer frees the ring once drained
+    struct JournalRing *next;
+} JournalRing;
+
+int journal_on = 0;
+
+static __thread JournalRing *my_ring;
+static pthread_key_t ring_key; // Only used for its destructor on thread exit
+static JournalRing *rings; // Every live ring, guarded by rings_lock
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int journal_fd = -1;
+static pthread_t writer;
+static int stopping = 0;
+static uint64_t run_id; // Start time in seconds, or one past the last run's; the high half of every game id
+static unsigned game_counter = 0;
+static int journal_piles = 5; // Board size of this run
+
+static void ring_release(void *arg)
+{
+    JournalRing *r = arg;
+    __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+static JournalRing *ring_get(void)
+{
+    if (my_ring) return my_ring;
+
+    JournalRing *r = calloc(1, sizeof(JournalRing));
+    if (r == NULL) return NULL;
+
+    pthread_mutex_lock(&rings_lock);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    return r;
+}
+
+static uint64_t wall_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Room for n records in this thread's ring, NULL without memory or room
+// Callers hold a game's lock, so a full ring loses the n records rather than waiting for the writer
+static JournalRing *ring_reserve(unsigned n)
+{
+    JournalRing *r = ring_get();
+    if (r == NULL) return NULL;
+
+    if (r->head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) + n > JOURNAL_RING_SIZE) {
+        __atomic_store_n(&r->dropped, r->dropped + n, __ATOMIC_RELAXED);
+        for (unsigned i = 0; i < n; i++) metric_inc(MET_JOURNAL_DROPPED);
+        return NULL;
+    }
+    return r;
+}
+
+static JournalRecord *ring_slot(JournalRing *r, unsigned i)
+{
+    JournalRecord *rec = &r->recs[(r->head + i) & (JOURNAL_RING_SIZE - 1)];
+    memset(rec, 0, sizeof(*rec));
+    return rec;
+}
+
+// Records published together are drained together, so they stay next to each other in the file
+static void ring_publish(JournalRing *r, unsigned n)
+{
+    __atomic_store_n(&r->head, r->head + n, __ATOMIC_RELEASE);
+}
+
+static void fill(JournalRecord *rec, uint64_t game, unsigned *seq, uint64_t ts, int type, int player, int a, int b)
+{
+    rec->game = game;
+    rec->ts_ns = ts;
+    rec->seq = (uint16_t)(*seq)++;
+    rec->type = (uint8_t)type;
+    rec->player = (uint8_t)player;
+    rec->a = (uint8_t)a;
+    rec->b = (uint8_t)b;
+}
+
+static void fill_board(JournalRecord *rec, const int *board)
+{
+    for (int i = 0; i < journal_piles; i++) rec->data[i] = (uint8_t)board[i];
+}
+
+uint64_t journal_game_id(void)
+{
+    return run_id << 32 | __atomic_add_fetch(&game_counter, 1, __ATOMIC_RELAXED);
+}
+
+void journal_start(uint64_t game, unsigned *seq, const char *p1_name, const char *p2_name)
+{
+    const char *names[2] = { p1_name, p2_name };
+    int lens[2];
+    unsigned n = 1;
+    for (int p = 0; p < 2; p++) {
+        lens[p] = (int)strnlen(names[p], 72);
+        n += (unsigned)(lens[p] + JOURNAL_NAME_CHUNK - 1) / JOURNAL_NAME_CHUNK;
+    }
+
+    JournalRing *r = ring_reserve(n);
+    if (r == NULL) return;
+    uint64_t ts = wall_ns();
+
+    unsigned i = 0;
+    fill(ring_slot(r, i++), game, seq, ts, JOURNAL_START, 0, lens[0], lens[1]);
+    for (int p = 0; p < 2; p++) {
+        for (int off = 0; off < lens[p]; off += JOURNAL_NAME_CHUNK) {
+            int len = lens[p] - off < JOURNAL_NAME_CHUNK ? lens[p] - off : JOURNAL_NAME_CHUNK;
+            JournalRecord *rec = ring_slot(r, i++);
+            fill(rec, game, seq, ts, JOURNAL_NAME, p + 1, off, len);
+            memcpy(rec->data, names[p] + off, (size_t)len);
+        }
+    }
+    ring_publish(r, n);
+}
+
+void journal_move(uint64_t game, unsigned *seq, int player, int pile, int qty, const int *board)
+{
+    JournalRing *r = ring_reserve(1);
+    if (r == NULL) return;
+    JournalRecord *rec = ring_slot(r, 0);
+    fill(rec, game, seq, wall_ns(), JOURNAL_MOVE, player, pile, qty);
+    fill_board(rec, board);
+    ring_publish(r, 1);
+}
+
+void journal_over(uint64_t game, unsigned *seq, int winner, int forfeit, const int *board)
+{
+    JournalRing *r = ring_reserve(1);
+    if (r == NULL) return;
+    JournalRecord *rec = ring_slot(r, 0);
+    fill(rec, game, seq, wall_ns(), JOURNAL_OVER, winner, forfeit, 0);
+    fill_board(rec, board);
+    ring_publish(r, 1);
+}
+
+static int write_all(const void *buf, size_t n)
+{
+    const char *p = buf;
+    while (n > 0) {
+        ssize_t w = write(journal_fd, p, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return -1;
+        p += w;
+        n -= (size_t)w;
+    }
+    return 0;
+}
+
+static size_t drain_ring(JournalRing *r, char *out, size_t pos)
+{
+    unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    unsigned tail = r->tail;
+
+    for (; tail != head; tail++) {
+        if (pos + sizeof(JournalRecord) > JOURNAL_OUT_SIZE) {
+            if (write_all(out, pos)) perror("journal write");
+            pos = 0;
+        }
+        memcpy(out + pos, &r->recs[tail & (JOURNAL_RING_SIZE - 1)], sizeof(JournalRecord));
+        pos += sizeof(JournalRecord);
+    }
+    // The slots may be reused now; they are in out or already written
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+    unsigned dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    if (dropped != r->dropped_seen) {
+        fprintf(stderr, "journal: dropped %u record(s), ring full\n", dropped - r->dropped_seen);
+        r->dropped_seen = dropped;
+    }
+    return pos;
+}
+
+static void *writer_thread(void *arg)
+{
+    (void)arg;
+    char *out = malloc(JOURNAL_OUT_SIZE);
+    if (out == NULL) return NULL;
+
+    while (1) {
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        size_t pos = 0;
+        int wrote = 0;
+
+        pthread_mutex_lock(&rings_lock);
+        JournalRing **pp = &rings;
+        while (*pp) {
+            JournalRing *r = *pp;
+            int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+            if (r->tail != __atomic_load_n(&r->head, __ATOMIC_ACQUIRE)) wrote = 1;
+            pos = drain_ring(r, out, pos);
+
+            // The owner is gone and appended everything before it left
+            if (dead) {
+                *pp = r->next;
+                free(r);
+            } else {
+                pp = &r->next;
+            }
+        }
+        pthread_mutex_unlock(&rings_lock);
+
+        if (pos > 0 && write_all(out, pos)) perror("journal write");
+
+        if (wrote) {
+            // One sync covers every record this pass collected, from every thread
+            if (fdatasync(journal_fd) < 0) perror("journal fdatasync");
+        } else if (stop) {
+            break;
+        } else {
+            struct timespec nap = { 0, JOURNAL_IDLE_NS };
+            nanosleep(&nap, NULL);
+        }
+    }
+
+    free(out);
+    return NULL;
+}
+
+// Id of the newest run in an existing file that ends at end, 0 for none
+// Games restored or handed over keep their old ids, so only the last RUN record tells
+static uint64_t last_run_id(off_t end)
+{
+    JournalRecord recs[256];
+    off_t first = (off_t)sizeof(JournalHeader);
+    while (end > first) {
+        off_t from = end - (off_t)sizeof(recs) > first ? end - (off_t)sizeof(recs) : first;
+        ssize_t got = pread(journal_fd, recs, (size_t)(end - from), from);
+        if (got != (ssize_t)(end - from)) return 0;
+        for (size_t i = (size_t)got / sizeof(JournalRecord); i-- > 0;) {
+            if (recs[i].type == JOURNAL_RUN) return recs[i].game >> 32;
+        }
+        end = from;
+    }
+    return 0;
+}
+
+int journal_open(const char *path, int piles, const int *board)
+{
+    journal_piles = piles;
+    journal_fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (journal_fd < 0) {
+        perror(path);
+        return 1;
+    }
+
+    // A new file starts with a header; records are appended to an old one as they are
+    JournalHeader h;
+    off_t size = lseek(journal_fd, 0, SEEK_END);
+    uint64_t last_run = 0;
+    if (size == 0) {
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, JOURNAL_MAGIC, sizeof(h.magic));
+        h.version = JOURNAL_VERSION;
+        h.record_size = sizeof(JournalRecord);
+        if (write_all(&h, sizeof(h))) goto fail;
+    } else {
+        if (pread(journal_fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) || memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) != 0 ||
+            h.record_size != sizeof(JournalRecord)) {
+            fprintf(stderr, "%s: not a nimd journal\n", path);
+            close(journal_fd);
+            journal_fd = -1;
+            return 1;
+        }
+        // A crash can leave half a record behind, drop it so the rest stays aligned
+        off_t torn = (size - (off_t)sizeof(h)) % (off_t)sizeof(JournalRecord);
+        if (torn != 0) {
+            fprintf(stderr, "%s: dropping %ld bytes of a torn record\n", path, (long)torn);
+            if (ftruncate(journal_fd, size - torn) < 0) goto fail;
+        }
+        last_run = last_run_id(size - torn);
+    }
+
+    // Two runs started in the same second must not hand out the same game ids
+    uint64_t now = wall_ns();
+    run_id = now / 1000000000ULL;
+    if (run_id <= last_run) run_id = last_run + 1;
+
+    JournalRecord run;
+    memset(&run, 0, sizeof(run));
+    run.game = run_id << 32;
+    run.ts_ns = now;
+    run.type = JOURNAL_RUN;
+    run.player = JOURNAL_VERSION;
+    run.a = (uint8_t)piles;
+    fill_board(&run, board);
+    if (write_all(&run, sizeof(run)) || fdatasync(journal_fd) < 0) goto fail;
+
+    if (pthread_key_create(&ring_key, ring_release) != 0) goto fail;
+    if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) goto fail;
+    journal_on = 1;
+    return 0;
+
+fail:
+    perror(path);
+    close(journal_fd);
+    journal_fd = -1;
+    return 1;
+}
+
+void journal_close(void)
+{
+    if (!journal_on) return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    journal_on = 0;
+    close(journal_fd);
+    journal_fd = -1;
+}
@@ -0,0 +1,62 @@
+#ifndef NIMD_JOURNAL_H
+#define NIMD_JOURNAL_H
+
+#include <stdint.h>
+
+// Append-only binary journal of game events
+// Threads append fixed-size records to their own lock-free ring, no system call on the game
+// path; one background thread drains every ring into large write()s and makes each pass
+// durable with a single fdatasync (group commit). nimjournal dumps the file
+
+#define JOURNAL_MAGIC   "NIMJRNL1" // First 8 bytes of a journal file
+#define JOURNAL_VERSION 1
+
+enum {
+    JOURNAL_RUN = 1, // A server started appending: game = its run id << 32; player = JOURNAL_VERSION; a = piles, data = starting board
+    JOURNAL_START, // player 0; a = length of P1's name, b = length of P2's; NAMEs follow
+    JOURNAL_NAME, // player whose name; a = offset of this chunk, b = its length; data = the bytes
+    JOURNAL_MOVE, // player moved; a = pile (1 up to the RUN's piles), b = quantity; data = board after the move
+    JOURNAL_OVER, // player won (0 = nobody, the game was aborted); a = 1 for a forfeit; data = board
+};
+
+#define JOURNAL_NAME_CHUNK 10
+#define JOURNAL_PILES      10 // Most piles a board in data can have, a byte each
+
+// Native byte order, the journal is read on the machine (or kind of machine) that wrote it
+typedef struct {
+    uint64_t game; // Journal id: the run id (start time in seconds, past the previous run's) in the high 32 bits, a counter below
+    uint64_t ts_ns; // Wall clock, ns since the epoch
+    uint16_t seq; // Event number within the game; one game's records can come from two threads
+    uint8_t type;
+    uint8_t player;
+    uint8_t a;
+    uint8_t b;
+    uint8_t data[JOURNAL_NAME_CHUNK];
+} JournalRecord;
+
+typedef char journal_record_is_32_bytes[sizeof(JournalRecord) == 32 ? 1 : -1];
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} JournalHeader;
+
+extern int journal_on;
+
+// Open (or create) path for appending and start the writer; returns 0 on success
+// Every game of this run is played on piles piles starting at board
+int journal_open(const char *path, int piles, const int *board);
+
+// Drain everything appended so far, sync it and stop the writer
+void journal_close(void);
+
+// Id for a game that is starting, unique across runs of the server
+uint64_t journal_game_id(void);
+
+// Every call takes the game's next event number(s) from *seq, so call them under the game's lock
+void journal_start(uint64_t game, unsigned *seq, const char *p1_name, const char *p2_name);
+void journal_move(uint64_t game, unsigned *seq, int player, int pile, int qty, const int *board);
+void journal_over(uint64_t game, unsigned *seq, int winner, int forfeit, const int *board);
+
+#endif
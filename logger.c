@@ -0,0 +1,223 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "logger.h"
+
+#define LOG_RING_SIZE   64     // Records per thread, must be a power of two
+#define LOG_RECORD_TEXT 200    // Longer lines are truncated
+#define LOG_OUT_SIZE    65536  // Writer batches this much per write()
+#define LOG_IDLE_NS     2000000 // Writer naps 2ms when every ring is empty
+
+typedef struct {
+    struct timespec ts;
+    int level;
+    int len;
+    char text[LOG_RECORD_TEXT];
+} LogRecord;
+
+// Single producer (the owning thread), single consumer (the writer)
+typedef struct LogRing {
+    LogRecord recs[LOG_RING_SIZE];
+    unsigned head; // Next slot to fill, only stored by the owner
+    unsigned tail; // Next slot to write out, only stored by the writer
+    unsigned dropped; // Lines lost to a full ring, only stored by the owner
+    unsigned dropped_seen; // Writer's copy of dropped at the last report
+    int dead; // Owner has exited, the writer frees the ring once drained
+    struct LogRing *next;
+} LogRing;
+
+int log_level = LOG_LEVEL_INFO;
+
+static __thread LogRing *my_ring;
+static pthread_key_t ring_key; // Only used for its destructor on thread exit
+static LogRing *rings; // Every live ring, guarded by rings_lock
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t writer;
+static int writer_running = 0;
+static int stopping = 0;
+
+int log_parse_level(const char *s)
+{
+    if (strcmp(s, "off") == 0) return LOG_LEVEL_OFF;
+    if (strcmp(s, "error") == 0) return LOG_LEVEL_ERROR;
+    if (strcmp(s, "info") == 0) return LOG_LEVEL_INFO;
+    if (strcmp(s, "debug") == 0) return LOG_LEVEL_DEBUG;
+    return -1;
+}
+
+static void ring_release(void *arg)
+{
+    LogRing *r = arg;
+    __atomic_store_n(&r->dead, 1, __ATOMIC_RELEASE);
+}
+
+// First log line from a thread gives it a ring
+static LogRing *ring_get(void)
+{
+    if (my_ring) return my_ring;
+
+    LogRing *r = calloc(1, sizeof(LogRing));
+    if (r == NULL) return NULL;
+
+    pthread_mutex_lock(&rings_lock);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&rings_lock);
+
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    return r;
+}
+
+void log_write(int level, const char *fmt, ...)
+{
+    LogRing *r = ring_get();
+    if (r == NULL) return;
+
+    unsigned head = r->head;
+    unsigned tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    if (head - tail == LOG_RING_SIZE) {
+        // Never block a game on the log, just count what we lost
+        __atomic_store_n(&r->dropped, r->dropped + 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    LogRecord *rec = &r->recs[head & (LOG_RING_SIZE - 1)];
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    rec->level = level;
+
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(rec->text, sizeof(rec->text), fmt, ap);
+    va_end(ap);
+    if (len < 0) len = 0;
+    if (len >= (int)sizeof(rec->text)) len = sizeof(rec->text) - 1;
+    rec->len = len;
+
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static void write_all(const char *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = write(STDOUT_FILENO, buf, n);
+        if (w <= 0) return;
+        buf += w;
+        n -= (size_t)w;
+    }
+}
+
+// Room for the longest formatted line
+#define LOG_LINE_MAX (LOG_RECORD_TEXT + 64)
+
+static const char *level_name(int level)
+{
+    if (level == LOG_LEVEL_ERROR) return "ERROR";
+    return level == LOG_LEVEL_DEBUG ? "DEBUG" : "INFO";
+}
+
+static size_t drain_ring(LogRing *r, char *out, size_t pos)
+{
+    static time_t last_sec = -1;
+    static char stamp[16];
+
+    unsigned head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+    unsigned tail = r->tail;
+
+    for (; tail != head; tail++) {
+        LogRecord *rec = &r->recs[tail & (LOG_RING_SIZE - 1)];
+
+        if (pos + LOG_LINE_MAX > LOG_OUT_SIZE) {
+            write_all(out, pos);
+            pos = 0;
+        }
+
+        // localtime_r once per second, not once per line
+        if (rec->ts.tv_sec != last_sec) {
+            struct tm tm;
+            localtime_r(&rec->ts.tv_sec, &tm);
+            strftime(stamp, sizeof(stamp), "%H:%M:%S", &tm);
+            last_sec = rec->ts.tv_sec;
+        }
+
+        pos += (size_t)snprintf(out + pos, LOG_LINE_MAX, "%s.%06ld %-5s %.*s\n", stamp, rec->ts.tv_nsec / 1000, level_name(rec->level), rec->len, rec->text);
+    }
+    __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+
+    unsigned dropped = __atomic_load_n(&r->dropped, __ATOMIC_RELAXED);
+    if (dropped != r->dropped_seen) {
+        if (pos + LOG_LINE_MAX > LOG_OUT_SIZE) {
+            write_all(out, pos);
+            pos = 0;
+        }
+        pos += (size_t)snprintf(out + pos, LOG_LINE_MAX, "[LOG] dropped %u line(s), ring full\n", dropped - r->dropped_seen);
+        r->dropped_seen = dropped;
+    }
+    return pos;
+}
+
+static void *writer_thread(void *arg)
+{
+    char *out = malloc(LOG_OUT_SIZE);
+    if (out == NULL) return NULL;
+
+    while (1) {
+        int stop = __atomic_load_n(&stopping, __ATOMIC_ACQUIRE);
+        size_t pos = 0;
+
+        pthread_mutex_lock(&rings_lock);
+        LogRing **pp = &rings;
+        while (*pp) {
+            LogRing *r = *pp;
+            int dead = __atomic_load_n(&r->dead, __ATOMIC_ACQUIRE);
+            pos = drain_ring(r, out, pos);
+
+            // The owner is gone and wrote everything before it left
+            if (dead) {
+                *pp = r->next;
+                free(r);
+            } else {
+                pp = &r->next;
+            }
+        }
+        pthread_mutex_unlock(&rings_lock);
+
+        if (pos > 0) {
+            write_all(out, pos);
+        } else if (stop) {
+            break;
+        } else {
+            struct timespec nap = { 0, LOG_IDLE_NS };
+            nanosleep(&nap, NULL);
+        }
+    }
+
+    free(out);
+    return NULL;
+}
+
+int log_start(int level)
+{
+    log_level = level;
+    if (level == LOG_LEVEL_OFF) return 0;
+
+    if (pthread_key_create(&ring_key, ring_release) != 0) return 1;
+    if (pthread_create(&writer, NULL, writer_thread, NULL) != 0) return 1;
+    writer_running = 1;
+    return 0;
+}
+
+void log_stop(void)
+{
+    if (!writer_running) return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(writer, NULL);
+    writer_running = 0;
+}
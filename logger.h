@@ -0,0 +1,32 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+
+// Asynchronous leveled logging for nimd
+// Threads format a line into their own lock-free ring; a single background
+// thread stamps, batches and writes them to stdout
+
+#define LOG_LEVEL_OFF   0
+#define LOG_LEVEL_ERROR 1  // Things that should never happen
+#define LOG_LEVEL_INFO  2  // Startup, shutdown, game start and end
+#define LOG_LEVEL_DEBUG 3  // Every frame, field and state change
+
+extern int log_level;
+
+// The level is checked before any argument is evaluated, so a suppressed line costs one compare
+#define LOG_ERROR(...) do { if (log_level >= LOG_LEVEL_ERROR) log_write(LOG_LEVEL_ERROR, __VA_ARGS__); } while (0)
+#define LOG_INFO(...)  do { if (log_level >= LOG_LEVEL_INFO)  log_write(LOG_LEVEL_INFO, __VA_ARGS__); } while (0)
+#define LOG_DEBUG(...) do { if (log_level >= LOG_LEVEL_DEBUG) log_write(LOG_LEVEL_DEBUG, __VA_ARGS__); } while (0)
+
+// "off", "error", "info" or "debug"; returns -1 for anything else
+int log_parse_level(const char *s);
+
+// Sets the level and starts the writer thread (none for LOG_LEVEL_OFF); returns 0 on success
+int log_start(int level);
+
+// Queue one line (no trailing newline needed); drops it if this thread's ring is full
+void log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+// Flush everything queued so far and stop the writer thread
+void log_stop(void);
+
+#endif
@@ -0,0 +1,379 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include "metrics.h"
+#include "logger.h"
+
+#define METRICS_CACHE_LINE 64
+#define METRICS_OUT_SIZE   16384 // Room for a whole exposition
+#define METRICS_POLL_MS    100   // How quickly a SIGUSR1 dump or a stop is noticed
+#define METRICS_REQ_MS     100   // How long an admin client gets to send its request
+#define HIST_STRIPES       8     // Shared histogram sets for threads without their own
+
+static const char *phase_names[PHASE_COUNT] = {
+    [PHASE_ACCEPT] = "accept",
+    [PHASE_OPEN_WAIT] = "open_wait",
+    [PHASE_START] = "start",
+    [PHASE_MOVE] = "move_play",
+    [PHASE_LOCK_WAIT] = "lock_wait",
+};
+
+static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+
+__thread MetricsBlock *metrics_mine;
+__thread HistBlock *metrics_hist;
+
+static pthread_key_t block_key; // Only used for its destructor on thread exit
+static MetricsBlock *blocks; // Every live thread's block, guarded by blocks_lock
+static MetricsBlock retired; // Totals of threads that exited, guarded by blocks_lock
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+static HistBlock *hists; // Event loops' own histograms, guarded by blocks_lock
+static HistBlock stripes[HIST_STRIPES];
+static unsigned stripe_next;
+
+static MetricsGaugeFn gauge_fn;
+static int admin_fd = -1;
+static pthread_t metrics_thread_id;
+static int metrics_running = 0;
+static int stopping = 0;
+static volatile sig_atomic_t dump_requested = 0;
+
+static const struct {
+    const char *name;
+    const char *label; // Extra label, NULL for none
+    const char *help;
+} counter_info[MET_COUNT] = {
+    [MET_CONN_ACCEPTED] = { "nimd_connections_accepted_total", NULL, "Sockets seated in a game" },
+    [MET_CONN_CLOSED] = { "nimd_connections_closed_total", NULL, "Connections cleaned up" },
+    [MET_OPEN] = { "nimd_opens_total", NULL, "Successful OPENs" },
+    [MET_MOVE] = { "nimd_moves_total", NULL, "MOVE frames received" },
+    [MET_FAIL_10] = { "nimd_fails_total", "code=\"10\"", "FAIL frames sent, by code" },
+    [MET_FAIL_21] = { "nimd_fails_total", "code=\"21\"", NULL },
+    [MET_FAIL_22] = { "nimd_fails_total", "code=\"22\"", NULL },
+    [MET_FAIL_23] = { "nimd_fails_total", "code=\"23\"", NULL },
+    [MET_FAIL_24] = { "nimd_fails_total", "code=\"24\"", NULL },
+    [MET_FAIL_31] = { "nimd_fails_total", "code=\"31\"", NULL },
+    [MET_FAIL_32] = { "nimd_fails_total", "code=\"32\"", NULL },
+    [MET_FAIL_33] = { "nimd_fails_total", "code=\"33\"", NULL },
+    [MET_GAMES_STARTED] = { "nimd_games_started_total", NULL, "Games that sent NAME and PLAY" },
+    [MET_WINS_NORMAL] = { "nimd_wins_total", "reason=\"normal\"", "Finished games, by how they ended" },
+    [MET_WINS_FORFEIT] = { "nimd_wins_total", "reason=\"forfeit\"", NULL },
+    [MET_POOL_GROWS] = { "nimd_registry_resizes_total", NULL, "Slabs added to a game pool" },
+    [MET_TIMEOUTS_OPEN] = { "nimd_timeouts_total", "kind=\"open\"", "Connections dropped at a deadline, by kind" },
+    [MET_TIMEOUTS_IDLE] = { "nimd_timeouts_total", "kind=\"idle\"", NULL },
+    [MET_SHED_CONNS] = { "nimd_shed_total", "limit=\"connections\"", "Connections refused at accept, by limit" },
+    [MET_SHED_GAMES] = { "nimd_shed_total", "limit=\"games\"", NULL },
+    [MET_SHED_PENDING] = { "nimd_shed_total", "limit=\"pending\"", NULL },
+    [MET_JOURNAL_DROPPED] = { "nimd_journal_dropped_total", NULL, "Journal records lost to a full ring" },
+    [MET_REATTACHED] = { "nimd_reattached_total", NULL, "Players seated back in a game restored from the snapshot" },
+    [MET_RESUMED] = { "nimd_games_resumed_total", NULL, "Restored games back in play" },
+    [MET_SPECTATORS] = { "nimd_spectators_total", NULL, "Connections that started watching a game" },
+    [MET_SPECTATORS_CUT] = { "nimd_spectators_dropped_total", NULL, "Spectators hung up for not keeping up with their game" },
+    [MET_BOT_GAMES] = { "nimd_bot_games_total", NULL, "Games started against the bot" },
+};
+
+// Add src into dst; src may still be counting, so every field is loaded once
+static void block_add(MetricsBlock *dst, MetricsBlock *src)
+{
+    for (int i = 0; i < MET_COUNT; i++) dst->c[i] += __atomic_load_n(&src->c[i], __ATOMIC_RELAXED);
+}
+
+static void hist_add(Histogram *dst, HistBlock *src)
+{
+    for (int p = 0; p < PHASE_COUNT; p++) {
+        Histogram *d = &dst[p], *s = &src->h[p];
+        for (int i = 0; i < HIST_BUCKETS; i++) d->b[i] += __atomic_load_n(&s->b[i], __ATOMIC_RELAXED);
+        d->sum += __atomic_load_n(&s->sum, __ATOMIC_RELAXED);
+        unsigned long long max = __atomic_load_n(&s->max, __ATOMIC_RELAXED);
+        if (max > d->max) d->max = max;
+    }
+}
+
+// A thread's counts outlive it in retired
+static void block_release(void *arg)
+{
+    MetricsBlock *b = arg;
+    pthread_mutex_lock(&blocks_lock);
+    block_add(&retired, b);
+    MetricsBlock **pp = &blocks;
+    while (*pp != b) pp = &(*pp)->next;
+    *pp = b->next;
+    pthread_mutex_unlock(&blocks_lock);
+    free(b);
+}
+
+static pthread_once_t key_once = PTHREAD_ONCE_INIT;
+
+static void key_init(void)
+{
+    pthread_key_create(&block_key, block_release);
+}
+
+MetricsBlock *metrics_block(void)
+{
+    void *mem;
+    if (posix_memalign(&mem, METRICS_CACHE_LINE, sizeof(MetricsBlock)) != 0) return NULL;
+    MetricsBlock *b = mem;
+    memset(b, 0, sizeof(*b));
+
+    pthread_once(&key_once, key_init);
+    pthread_mutex_lock(&blocks_lock);
+    b->next = blocks;
+    blocks = b;
+    pthread_mutex_unlock(&blocks_lock);
+
+    pthread_setspecific(block_key, b);
+    metrics_mine = b;
+    return b;
+}
+
+void metrics_hist_own(void)
+{
+    void *mem;
+    if (posix_memalign(&mem, METRICS_CACHE_LINE, sizeof(HistBlock)) != 0) return; // Stays on a stripe
+    HistBlock *b = mem;
+    memset(b, 0, sizeof(*b));
+    b->own = 1;
+
+    pthread_mutex_lock(&blocks_lock);
+    b->next = hists;
+    hists = b;
+    pthread_mutex_unlock(&blocks_lock);
+    metrics_hist = b;
+}
+
+HistBlock *metrics_hist_stripe(void)
+{
+    HistBlock *b = &stripes[__atomic_fetch_add(&stripe_next, 1, __ATOMIC_RELAXED) % HIST_STRIPES];
+    metrics_hist = b;
+    return b;
+}
+
+void metric_fail(int code)
+{
+    int id;
+    switch (code) {
+        case 10: id = MET_FAIL_10; break;
+        case 21: id = MET_FAIL_21; break;
+        case 22: id = MET_FAIL_22; break;
+        case 23: id = MET_FAIL_23; break;
+        case 24: id = MET_FAIL_24; break;
+        case 31: id = MET_FAIL_31; break;
+        case 32: id = MET_FAIL_32; break;
+        case 33: id = MET_FAIL_33; break;
+        default: return;
+    }
+    metric_inc(id);
+}
+
+// Merge every thread's block and every histogram set; a thread may be mid increment, so this is a snapshot
+static void metrics_sum(MetricsBlock *out, Histogram *hist)
+{
+    memset(out, 0, sizeof(*out));
+    memset(hist, 0, sizeof(Histogram) * PHASE_COUNT);
+    pthread_mutex_lock(&blocks_lock);
+    block_add(out, &retired);
+    for (MetricsBlock *b = blocks; b != NULL; b = b->next) block_add(out, b);
+    for (HistBlock *h = hists; h != NULL; h = h->next) hist_add(hist, h);
+    pthread_mutex_unlock(&blocks_lock);
+    for (int i = 0; i < HIST_STRIPES; i++) hist_add(hist, &stripes[i]);
+}
+
+// Highest value that lands in bucket i, what HDR histograms report for it
+static unsigned long long bucket_high(int i)
+{
+    if (i < HIST_SUB) return (unsigned long long)i;
+    int log2 = i / HIST_SUB + HIST_SUB_BITS - 1;
+    unsigned long long width = 1ULL << (log2 - HIST_SUB_BITS);
+    return (unsigned long long)(HIST_SUB + i % HIST_SUB) * width + width - 1;
+}
+
+static unsigned long long hist_quantile(const Histogram *h, unsigned long count, double q)
+{
+    unsigned long want = (unsigned long)(q * count + 0.5);
+    if (want == 0) want = 1;
+    unsigned long seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->b[i];
+        // The bucket bound can overshoot the largest sample, which is known exactly
+        if (seen >= want) return bucket_high(i) < h->max ? bucket_high(i) : h->max;
+    }
+    return h->max;
+}
+
+// One summary per phase, in seconds: quantiles, then max, sum and count
+static int format_phases(const Histogram *hist, char *buf, int cap)
+{
+    int pos = snprintf(buf, cap, "# HELP nimd_phase_seconds Latency of each game phase\n# TYPE nimd_phase_seconds summary\n");
+    for (int p = 0; p < PHASE_COUNT && pos < cap; p++) {
+        const Histogram *h = &hist[p];
+        unsigned long count = 0;
+        for (int i = 0; i < HIST_BUCKETS; i++) count += h->b[i];
+
+        for (size_t k = 0; k < sizeof(quantiles) / sizeof(quantiles[0]) && pos < cap; k++) {
+            unsigned long long ns = count ? hist_quantile(h, count, quantiles[k]) : 0;
+            pos += snprintf(buf + pos, cap - pos, "nimd_phase_seconds{phase=\"%s\",quantile=\"%g\"} %.9f\n", phase_names[p], quantiles[k], ns / 1e9);
+        }
+        if (pos < cap) {
+            pos += snprintf(buf + pos, cap - pos, "nimd_phase_seconds_max{phase=\"%s\"} %.9f\nnimd_phase_seconds_sum{phase=\"%s\"} %.9f\nnimd_phase_seconds_count{phase=\"%s\"} %lu\n",
+                            phase_names[p], h->max / 1e9, phase_names[p], h->sum / 1e9, phase_names[p], count);
+        }
+    }
+    return pos < cap ? pos : cap - 1;
+}
+
+// Prometheus style text: "# TYPE" once per name, then one sample per line
+static int metrics_format(char *buf, int cap)
+{
+    // Too big for the metrics thread's stack with every histogram in it
+    static Histogram hist[PHASE_COUNT];
+    MetricsBlock total;
+    metrics_sum(&total, hist);
+    unsigned long *sum = total.c;
+
+    int pos = 0;
+    for (int i = 0; i < MET_COUNT && pos < cap; i++) {
+        if (counter_info[i].help != NULL) {
+            pos += snprintf(buf + pos, cap - pos, "# HELP %s %s\n# TYPE %s counter\n", counter_info[i].name, counter_info[i].help, counter_info[i].name);
+            if (pos >= cap) break;
+        }
+        if (counter_info[i].label != NULL) {
+            pos += snprintf(buf + pos, cap - pos, "%s{%s} %lu\n", counter_info[i].name, counter_info[i].label, sum[i]);
+        } else {
+            pos += snprintf(buf + pos, cap - pos, "%s %lu\n", counter_info[i].name, sum[i]);
+        }
+    }
+    if (pos < cap) {
+        pos += snprintf(buf + pos, cap - pos, "# HELP nimd_connections Connections seated and not yet cleaned up\n# TYPE nimd_connections gauge\nnimd_connections %lu\n", sum[MET_CONN_ACCEPTED] - sum[MET_CONN_CLOSED]);
+    }
+    if (pos < cap) pos += format_phases(hist, buf + pos, cap - pos);
+    if (pos < cap && gauge_fn != NULL) pos += gauge_fn(buf + pos, cap - pos);
+    return pos < cap ? pos : cap - 1;
+}
+
+static void write_all(int fd, const char *buf, size_t n)
+{
+    while (n > 0) {
+        ssize_t w = write(fd, buf, n);
+        if (w <= 0) return;
+        buf += w;
+        n -= (size_t)w;
+    }
+}
+
+// One scrape: an HTTP GET gets a response header, anything else just the text
+static void serve_admin(int fd, char *out)
+{
+    char req[512];
+    int n = 0;
+    struct pollfd p = { fd, POLLIN, 0 };
+    if (poll(&p, 1, METRICS_REQ_MS) > 0) {
+        n = (int)read(fd, req, sizeof(req) - 1);
+        if (n < 0) n = 0;
+    }
+
+    int len = metrics_format(out, METRICS_OUT_SIZE);
+    if (n >= 4 && memcmp(req, "GET ", 4) == 0) {
+        char hdr[128];
+        int hlen = snprintf(hdr, sizeof(hdr), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %d\r\n\r\n", len);
+        write_all(fd, hdr, (size_t)hlen);
+    }
+    write_all(fd, out, (size_t)len);
+    close(fd);
+}
+
+static void *metrics_thread(void *arg)
+{
+    char *out = malloc(METRICS_OUT_SIZE);
+    if (out == NULL) return NULL;
+
+    while (!__atomic_load_n(&stopping, __ATOMIC_ACQUIRE)) {
+        struct pollfd p = { admin_fd, POLLIN, 0 };
+        int n = poll(&p, admin_fd >= 0 ? 1 : 0, METRICS_POLL_MS);
+
+        if (dump_requested) {
+            dump_requested = 0;
+            int len = metrics_format(out, METRICS_OUT_SIZE);
+            write_all(STDERR_FILENO, out, (size_t)len);
+        }
+
+        if (n > 0 && (p.revents & POLLIN)) {
+            int fd = accept(admin_fd, NULL, NULL);
+            if (fd >= 0) serve_admin(fd, out);
+        }
+    }
+
+    free(out);
+    return NULL;
+}
+
+// Loopback only: the numbers are for the operator, not for players
+static int open_admin(const char *port)
+{
+    struct addrinfo hints, *info;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int error = getaddrinfo("127.0.0.1", port, &hints, &info);
+    if (error) {
+        fprintf(stderr, "%s\n", gai_strerror(error));
+        return -1;
+    }
+
+    int fd = socket(info->ai_family, info->ai_socktype, info->ai_protocol);
+    if (fd >= 0) {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, info->ai_addr, info->ai_addrlen) != 0 || listen(fd, 16) != 0) {
+            perror("admin port");
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(info);
+    return fd;
+}
+
+int metrics_start(const char *admin_port, MetricsGaugeFn gauges)
+{
+    gauge_fn = gauges;
+    // A server whose upgrade failed starts them again after metrics_stop
+    __atomic_store_n(&stopping, 0, __ATOMIC_RELEASE);
+    if (admin_port != NULL) {
+        admin_fd = open_admin(admin_port);
+        if (admin_fd < 0) return 1;
+        LOG_INFO("[METRICS] Admin port 127.0.0.1:%s", admin_port);
+    }
+
+    if (pthread_create(&metrics_thread_id, NULL, metrics_thread, NULL) != 0) {
+        if (admin_fd >= 0) close(admin_fd);
+        admin_fd = -1;
+        return 1;
+    }
+    metrics_running = 1;
+    return 0;
+}
+
+void metrics_request_dump(void)
+{
+    dump_requested = 1;
+}
+
+void metrics_stop(void)
+{
+    if (!metrics_running) return;
+
+    __atomic_store_n(&stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(metrics_thread_id, NULL);
+    metrics_running = 0;
+    if (admin_fd >= 0) close(admin_fd);
+    admin_fd = -1;
+}
@@ -0,0 +1,148 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <time.h>
+
+// Counters, latency histograms and gauges for nimd
+// Every thread counts into its own cache line aligned block with plain stores, so the
+// hot path never shares a line with another thread; a reader sums all the blocks.
+// Histograms are too big for one set per thread: each event loop owns a set, every
+// other thread records into one of a few shared stripes with atomic adds.
+// Gauges are asked from the server whenever an exposition is built. The text is served
+// on a local admin port and dumped to stderr on SIGUSR1
+
+enum {
+    MET_CONN_ACCEPTED, // Sockets that got a seat in a game
+    MET_CONN_CLOSED, // Connections that finished their cleanup
+    MET_OPEN, // Successful OPENs
+    MET_MOVE, // MOVE frames received, valid or not
+    MET_FAIL_10,
+    MET_FAIL_21,
+    MET_FAIL_22,
+    MET_FAIL_23,
+    MET_FAIL_24,
+    MET_FAIL_31,
+    MET_FAIL_32,
+    MET_FAIL_33,
+    MET_GAMES_STARTED,
+    MET_WINS_NORMAL,
+    MET_WINS_FORFEIT,
+    MET_POOL_GROWS, // Registry resizes (one slab each)
+    MET_TIMEOUTS_OPEN, // Connections dropped for not OPENing in time
+    MET_TIMEOUTS_IDLE, // Connections dropped for going quiet mid game
+    MET_SHED_CONNS, // Refused at accept, by the limit they hit
+    MET_SHED_GAMES,
+    MET_SHED_PENDING,
+    MET_JOURNAL_DROPPED, // Journal records lost to a full ring
+    MET_REATTACHED, // Players seated back in a game restored from the snapshot
+    MET_RESUMED, // Restored games back in play
+    MET_SPECTATORS, // Connections that started watching a game
+    MET_SPECTATORS_CUT, // Spectators hung up for not keeping up with their game
+    MET_BOT_GAMES, // Games started against the bot
+    MET_COUNT
+};
+
+// Phases of a game's life that get a latency histogram
+enum {
+    PHASE_ACCEPT, // accept() returned -> the connection's thread or loop starts on it
+    PHASE_OPEN_WAIT, // OPEN frame -> WAIT written
+    PHASE_START, // Second OPEN frame -> NAME and PLAY written
+    PHASE_MOVE, // MOVE frame -> PLAY (or OVER) written to both players
+    PHASE_LOCK_WAIT, // Waiting for a Game's lock
+    PHASE_COUNT
+};
+
+// HDR style log buckets: values below 2^HIST_SUB_BITS ns get a bucket each, above that
+// every power of two is split into 2^HIST_SUB_BITS buckets (about 6% wide) up to 2^36 ns
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_MAX_LOG2 36
+#define HIST_BUCKETS  ((HIST_MAX_LOG2 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    unsigned long b[HIST_BUCKETS];
+    unsigned long long sum; // ns
+    unsigned long long max; // ns
+} Histogram;
+
+typedef struct MetricsBlock {
+    unsigned long c[MET_COUNT]; // Only stored by the owning thread
+    struct MetricsBlock *next;
+} MetricsBlock;
+
+typedef struct HistBlock {
+    Histogram h[PHASE_COUNT];
+    int own; // Stored by one event loop only; 0 for a stripe, updated with atomic adds
+    struct HistBlock *next;
+} HistBlock;
+
+extern __thread MetricsBlock *metrics_mine;
+extern __thread HistBlock *metrics_hist;
+
+// This thread's block, created on first use; NULL when out of memory
+MetricsBlock *metrics_block(void);
+
+// Give the calling thread histograms of its own; for event loops, which live as long as the server
+void metrics_hist_own(void);
+
+// The shared stripe this thread records into, picked round robin on first use
+HistBlock *metrics_hist_stripe(void);
+
+static inline void metric_inc(int id)
+{
+    MetricsBlock *b = metrics_mine ? metrics_mine : metrics_block();
+    if (b == NULL) return;
+    __atomic_store_n(&b->c[id], b->c[id] + 1, __ATOMIC_RELAXED);
+}
+
+static inline unsigned long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + (unsigned long long)ts.tv_nsec;
+}
+
+static inline int hist_bucket(unsigned long long ns)
+{
+    if (ns < HIST_SUB) return (int)ns;
+    int log2 = 63 - __builtin_clzll(ns);
+    if (log2 >= HIST_MAX_LOG2) return HIST_BUCKETS - 1;
+    int sub = (int)(ns >> (log2 - HIST_SUB_BITS)) & (HIST_SUB - 1);
+    return (log2 - HIST_SUB_BITS + 1) * HIST_SUB + sub;
+}
+
+// Record one latency sample of a phase, in ns
+static inline void metric_time(int phase, unsigned long long ns)
+{
+    HistBlock *b = metrics_hist ? metrics_hist : metrics_hist_stripe();
+    Histogram *h = &b->h[phase];
+    int i = hist_bucket(ns);
+    if (b->own) {
+        __atomic_store_n(&h->b[i], h->b[i] + 1, __ATOMIC_RELAXED);
+        __atomic_store_n(&h->sum, h->sum + ns, __ATOMIC_RELAXED);
+        if (ns > h->max) __atomic_store_n(&h->max, ns, __ATOMIC_RELAXED);
+        return;
+    }
+    __atomic_add_fetch(&h->b[i], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&h->sum, ns, __ATOMIC_RELAXED);
+    unsigned long long max = __atomic_load_n(&h->max, __ATOMIC_RELAXED);
+    while (ns > max && !__atomic_compare_exchange_n(&h->max, &max, ns, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+// Count one FAIL frame by its code (10, 21, 22, 23, 24, 31, 32 or 33)
+void metric_fail(int code);
+
+// Appends the server's gauge lines to an exposition; returns the bytes written
+typedef int (*MetricsGaugeFn)(char *buf, int cap);
+
+// Start serving on 127.0.0.1:admin_port (NULL for SIGUSR1 dumps only); returns 0 on success
+int metrics_start(const char *admin_port, MetricsGaugeFn gauges);
+
+// Ask for a dump to stderr, safe to call from a signal handler
+void metrics_request_dump(void);
+
+// Stop the metrics thread and close the admin port
+void metrics_stop(void);
+
+#endif
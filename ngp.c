@@ -0,0 +1,248 @@
+#define _POSIX_C_SOURCE 200809L // strtok_r
+#include <string.h>
+#include <ctype.h>
+#include "ngp.h"
+
+// Checks whether the bytes at buf hold a whole NGP frame "id|LL|payload"
+// Returns the frame length, 0 when more bytes are required, or NGP_BADFRAME
+int ngp_frame_status(const char *buf, size_t have, size_t bufsize)
+{
+    size_t i = 0;
+
+    // 1) "id|"  (we don't care what id is right now)
+    while (i < have && buf[i] != '|') i++;
+    if (i == have) {
+        if (have + 1 >= bufsize) return NGP_BADFRAME; // header too long for buffer
+        return 0;
+    }
+    i++;
+
+    // 2) "<len>|", must be exactly two digits
+    size_t len_start = i;
+    while (i < have && buf[i] != '|') {
+        if (!isdigit((unsigned char)buf[i])) return NGP_BADFRAME; // length field must be digits
+        i++;
+    }
+    if (i == have) {
+        if (have + 1 >= bufsize || i - len_start > 2) return NGP_BADFRAME;
+        return 0;
+    }
+    if (i - len_start != 2) return NGP_BADFRAME;
+    i++;
+
+    int msg_len = (buf[len_start] - '0') * 10 + (buf[len_start + 1] - '0');
+    if (msg_len <= 0 || (size_t)msg_len + i >= bufsize) {
+        // not enough room in buffer for payload + '\0'
+        return NGP_BADFRAME;
+    }
+
+    // 3) payload
+    size_t total = i + (size_t)msg_len;
+    if (have < total) return 0;
+
+    // 4) Spec requires payload end with '|' terminator
+    if (buf[total - 1] != '|') return NGP_BADFRAME;
+
+    // Success: total = header + payload bytes
+    return (int)total;
+}
+
+// Extract payload from "id|len|payload|" into a modifiable buffer
+int extract_payload(char *buf, char **payload_out, int *payload_len_out) {
+    char *id_str = buf;
+    char *bar1 = strchr(id_str, '|');
+    if (!bar1) return -1;
+    *bar1 = '\0';
+
+    char *len_str = bar1 + 1;
+    char *bar2 = strchr(len_str, '|');
+    if (!bar2) return -1;
+    *bar2 = '\0';
+
+    // Require protocol id "0"
+    if (strcmp(id_str, "0") != 0) return -1;
+
+    // Enforce EXACTLY two digits for length
+    if (strlen(len_str) != 2 || !isdigit((unsigned char)len_str[0]) || !isdigit((unsigned char)len_str[1]))
+        return -1;
+
+    int expected = (len_str[0] - '0') * 10 + (len_str[1] - '0');
+    if (expected < 5 || expected > NGP_FRAME_MAX) return -1; // sanity
+
+    char *payload = bar2 + 1;
+
+    // Ensure buffer actually contains expected bytes
+    if ((int)strlen(payload) < expected) return -1;
+
+    // Payload must end with '|'
+    if (payload[expected - 1] != '|') return -1;
+
+    // Null-terminate right after payload so tokenizers are safe
+    payload[expected] = '\0';
+
+    *payload_out = payload;
+    *payload_len_out = expected;
+    return 0;
+}
+
+int parse_client_message(char *buf, ParsedMsg *out) {
+    char *payload;
+    int plen;
+
+    if (extract_payload(buf, &payload, &plen) != 0) return -1;
+
+    // payload includes trailing '|', length plen
+    int bars = 0;
+    for (int i = 0; i < plen; i++) if (payload[i] == '|') bars++;
+
+    // Type must be 4 chars then '|'
+    if (plen < 5) return -1;
+    if (payload[4] != '|') return -1;
+
+    // Split type (safe because we own buffer)
+    payload[4] = '\0';
+    out->type = payload;
+
+    // Enforce allowed types early
+    int expected_bars = -1;
+    if (strcmp(out->type, "OPEN") == 0) {
+        out->kind = NGP_OPEN;
+        expected_bars = (bars == 3) ? 3 : 2; // OPEN|name|BOT| asks for the bot
+    } else if (strcmp(out->type, "MOVE") == 0) {
+        out->kind = NGP_MOVE;
+        expected_bars = 3;
+    } else if (strcmp(out->type, "VIEW") == 0) {
+        out->kind = NGP_VIEW;
+        expected_bars = 2;
+    } else {
+        return -1;
+    }
+    out->numeric = 0;
+
+    if (bars != expected_bars) return -1;
+
+    // Now tokenize fields (no need to preserve empties because bar-count already enforced)
+    char *saveptr = NULL;
+    char *tok = strtok_r(payload + 5, "|", &saveptr); // after "TYPE\0"
+    int idx = 0;
+
+    while (tok != NULL) {
+        if (idx >= 2) return -1; // too many fields for client messages
+        out->fields[idx++] = tok;
+        tok = strtok_r(NULL, "|", &saveptr);
+    }
+    out->field_count = idx;
+
+    if (out->kind == NGP_OPEN && out->field_count != bars - 1) return -1;
+    if (out->kind == NGP_OPEN && out->field_count == 2 && strcmp(out->fields[1], "BOT") != 0) return -1;
+    if (out->kind == NGP_VIEW && out->field_count != 1) return -1;
+    if (out->kind == NGP_MOVE && out->field_count != 2) return -1;
+
+    return 0;
+}
+
+int ngp_bin_parse(char *buf, int len, ParsedMsg *out)
+{
+    if (len < NGP_BIN_HEADER || buf[0] != NGP_BIN || len != ngp_bin_size((unsigned char)buf[1])) return -1;
+    unsigned char a = (unsigned char)buf[2], b = (unsigned char)buf[3];
+
+    if (buf[1] == NGP_BIN_MOVE) {
+        out->kind = NGP_MOVE;
+        out->type = "MOVE";
+        out->field_count = 0;
+        out->numeric = 1;
+        out->pile = a;
+        out->qty = b;
+        return 0;
+    }
+    if (buf[1] != NGP_BIN_OPEN || (a != 0 && a != NGP_BIN_BOT) || b == 0 || b > NGP_BIN_NAME_LEN) return -1;
+
+    // The name goes into the text NAME of an opponent who speaks text, so it may only hold what
+    // a text OPEN's name can
+    char *name = buf + NGP_BIN_HEADER;
+    for (int i = 0; i < b; i++) {
+        if (name[i] == '|' || name[i] == '\0') return -1;
+    }
+    name[b] = '\0';
+
+    out->kind = NGP_OPEN;
+    out->type = "OPEN";
+    out->fields[0] = name;
+    out->fields[1] = "BOT";
+    out->field_count = a == NGP_BIN_BOT ? 2 : 1;
+    out->numeric = 0;
+    return 0;
+}
+
+// Every FAIL the server can send, encoded at compile time
+typedef struct {
+    int code;
+    const char *frame;
+    int len;
+    char bin[NGP_BIN_HEADER]; // The binary frame
+} StaticFrame;
+
+#define STATIC_FRAME(code, lit) { code, lit, (int)sizeof(lit) - 1, { NGP_BIN, NGP_BIN_FAIL, code, 0 } }
+
+static const StaticFrame fail_frames[] = {
+    STATIC_FRAME(10, "0|16|FAIL|10 Invalid|"),
+    STATIC_FRAME(21, "0|18|FAIL|21 Long Name|"),
+    STATIC_FRAME(22, "0|24|FAIL|22 Already Playing|"),
+    STATIC_FRAME(23, "0|21|FAIL|23 Already Open|"),
+    STATIC_FRAME(24, "0|20|FAIL|24 Not Playing|"),
+    STATIC_FRAME(31, "0|18|FAIL|31 Impatient|"),
+    STATIC_FRAME(32, "0|19|FAIL|32 Pile Index|"),
+    STATIC_FRAME(33, "0|17|FAIL|33 Quantity|"),
+};
+
+static const StaticFrame wait_frame = { 0, "0|05|WAIT|", 10, { NGP_BIN, NGP_BIN_WAIT, 0, 0 } };
+
+typedef char ngp_bin_fits[NGP_BIN_MAX <= NGP_FRAME_MAX ? 1 : -1];
+
+static const StaticFrame *fail_frame(int code) {
+    for (size_t i = 0; i < sizeof(fail_frames) / sizeof(fail_frames[0]); i++) {
+        if (fail_frames[i].code == code) return &fail_frames[i];
+    }
+    return &fail_frames[0];
+}
+
+// FAIL|code msg|, unknown codes fall back to 10 Invalid
+const char *formatFail(int code, int *len) {
+    const StaticFrame *f = fail_frame(code);
+    *len = f->len;
+    return f->frame;
+}
+
+const char *formatWait(int *len) {
+    *len = wait_frame.len;
+    return wait_frame.frame;
+}
+
+const char *ngp_bin_fail(int code, int *len) {
+    *len = NGP_BIN_HEADER;
+    return fail_frame(code)->bin;
+}
+
+const char *ngp_bin_wait(int *len) {
+    *len = NGP_BIN_HEADER;
+    return wait_frame.bin;
+}
+
+// NAME|player_num|opponent|
+int formatName(char *buf, int player_num, const char *opponent) {
+    char *p = put_str(buf + MSG_HEADER_LEN, "NAME|");
+    p = put_uint(p, (unsigned)player_num);
+    *p++ = '|';
+    p = put_str(p, opponent);
+    *p++ = '|';
+    return finish_frame(buf, p);
+}
+
+int ngp_bin_name(char *buf, int player_num, const char *opponent) {
+    size_t n = strlen(opponent);
+    if (n > NGP_BIN_NAME_LEN) n = NGP_BIN_NAME_LEN;
+    int len = ngp_bin_header(buf, NGP_BIN_NAME, player_num, (int)n);
+    memcpy(buf + NGP_BIN_HEADER, opponent, n);
+    memset(buf + NGP_BIN_HEADER + n, 0, NGP_BIN_NAME_LEN - n);
+    return len;
+}
@@ -0,0 +1,214 @@
+#ifndef NIMD_NGP_H
+#define NIMD_NGP_H
+
+#include <stddef.h>
+
+// NGP frames without any I/O: framing, parsing the client's frames and encoding the server's,
+// in text "0|LL|payload" and in the binary variant below. The server runs every frame through
+// here, nimmicro times each step
+// Encoders write the frame in one pass into a buffer of NGP_FRAME_MAX + 1 bytes, text frames
+// NUL terminated for logging, and return its length. Board encoders take the pile count and
+// are inline, so a caller passing a constant gets a copy of its own with the loops unrolled
+
+#define MAX_MESSAGE_LEN 104 // Longest frame: "0|99|" and 99 payload bytes
+#define MSG_HEADER_LEN  5   // "0|LL|"
+#define NGP_FRAME_MAX   MAX_MESSAGE_LEN
+#define NGP_BADFRAME    (-2) // ngp_frame_status: malformed framing
+
+// Protocol ids, the first byte of every frame. A connection speaks the one its first frame
+// has, both ways, until it closes
+#define NGP_TEXT '0'
+#define NGP_BIN  '1'
+
+enum { NGP_OPEN = 1, NGP_MOVE, NGP_VIEW }; // ParsedMsg kinds
+
+typedef struct {
+    int kind;         // NGP_OPEN, NGP_MOVE or NGP_VIEW
+    char *type;       // "OPEN", "MOVE" or "VIEW"
+    char *fields[3];  // up to 3 fields (we only need up to 2)
+    int field_count;
+    int numeric;      // Binary MOVE: pile and qty are set and it has no fields
+    long pile;
+    long qty;
+} ParsedMsg;
+
+// Whether the have bytes at buf start with a whole frame, in a buffer of bufsize bytes
+// Returns the frame length, 0 when more bytes are required, or NGP_BADFRAME
+int ngp_frame_status(const char *buf, size_t have, size_t bufsize);
+
+// Split the payload out of a NUL terminated frame, in place. Returns 0 on success
+int extract_payload(char *buf, char **payload_out, int *payload_len_out);
+
+// Check a NUL terminated client frame and split it into out, in place. Returns 0 if it is a
+// valid OPEN, MOVE or VIEW
+int parse_client_message(char *buf, ParsedMsg *out);
+
+// Binary NGP: fixed-size frames, no text to split and no numbers to convert. Every frame is
+// the protocol id NGP_BIN, a type byte and two argument bytes a and b, then a body whose
+// size the type fixes; names are zero padded to NGP_BIN_NAME_LEN bytes, boards to NGP_BIN_PILES
+//   OPEN  a = NGP_BIN_BOT to play the bot or 0, b = name length 1..72; body: the name
+//   MOVE  a = pile, b = quantity; no body
+//   WAIT  no body
+//   NAME  a = player number, b = opponent's name length; body: the opponent's name
+//   PLAY  a = whose turn, b = pile count; body: a byte per pile, then 0, 0
+//   OVER  a = winner, b = pile count; body: a byte per pile, then 1 for a forfeit or 0, 0
+//   FAIL  a = code; no body
+// Spectators (VIEW) stay on text
+#define NGP_BIN_HEADER    4  // Id, type, a, b
+#define NGP_BIN_NAME_LEN  72 // Name body
+#define NGP_BIN_PILES     10 // Board body, without its flag and pad bytes
+#define NGP_BIN_BOARD_LEN (NGP_BIN_PILES + 2)
+#define NGP_BIN_MAX       (NGP_BIN_HEADER + NGP_BIN_NAME_LEN) // Longest frame
+#define NGP_BIN_BOT       1
+
+enum {
+    NGP_BIN_OPEN = 1,
+    NGP_BIN_MOVE,
+    NGP_BIN_WAIT,
+    NGP_BIN_NAME,
+    NGP_BIN_PLAY,
+    NGP_BIN_OVER,
+    NGP_BIN_FAIL,
+};
+
+// Size of a binary frame of type, 0 for no such type
+static inline int ngp_bin_size(unsigned char type)
+{
+    switch (type) {
+        case NGP_BIN_OPEN:
+        case NGP_BIN_NAME: return NGP_BIN_HEADER + NGP_BIN_NAME_LEN;
+        case NGP_BIN_PLAY:
+        case NGP_BIN_OVER: return NGP_BIN_HEADER + NGP_BIN_BOARD_LEN;
+        case NGP_BIN_MOVE:
+        case NGP_BIN_WAIT:
+        case NGP_BIN_FAIL: return NGP_BIN_HEADER;
+        default: return 0;
+    }
+}
+
+// ngp_frame_status for binary frames: the frame length, 0 when more bytes are required, or
+// NGP_BADFRAME for a wrong id or an unknown type
+static inline int ngp_bin_frame_status(const char *buf, size_t have)
+{
+    if (have < 2) return have == 1 && buf[0] != NGP_BIN ? NGP_BADFRAME : 0;
+    int size = ngp_bin_size((unsigned char)buf[1]);
+    if (buf[0] != NGP_BIN || size == 0) return NGP_BADFRAME;
+    return have < (size_t)size ? 0 : size;
+}
+
+// Check a whole binary client frame of len bytes and fill out, in place: an OPEN's name is
+// NUL terminated in buf, which must have room for len + 1 bytes. Returns 0 if it is a valid
+// OPEN or MOVE
+int ngp_bin_parse(char *buf, int len, ParsedMsg *out);
+
+// Header of a binary frame, returns the length of the frame of that type
+static inline int ngp_bin_header(char *buf, int type, int a, int b)
+{
+    buf[0] = NGP_BIN;
+    buf[1] = (char)type;
+    buf[2] = (char)a;
+    buf[3] = (char)b;
+    return ngp_bin_size((unsigned char)type);
+}
+
+// Board body: piles bytes, zeros up to NGP_BIN_PILES, then the flag and pad bytes
+static inline int ngp_bin_board_n(char *buf, int type, int a, int flag, const int *board, int piles)
+{
+    int len = ngp_bin_header(buf, type, a, piles);
+    char *p = buf + NGP_BIN_HEADER;
+    for (int i = 0; i < piles; i++) p[i] = (char)board[i];
+    for (int i = piles; i < NGP_BIN_PILES; i++) p[i] = 0;
+    p[NGP_BIN_PILES] = (char)flag;
+    p[NGP_BIN_PILES + 1] = 0;
+    return len;
+}
+
+static inline int ngp_bin_play_n(char *buf, int whose_turn, const int *board, int piles)
+{
+    return ngp_bin_board_n(buf, NGP_BIN_PLAY, whose_turn, 0, board, piles);
+}
+
+static inline int ngp_bin_over_n(char *buf, int forfeit, int winner, const int *board, int piles)
+{
+    return ngp_bin_board_n(buf, NGP_BIN_OVER, winner, forfeit != 0, board, piles);
+}
+
+// Binary NAME, name zero padded; names are at most NGP_BIN_NAME_LEN bytes
+int ngp_bin_name(char *buf, int player_num, const char *opponent);
+
+// Binary FAIL and WAIT, constants like their text frames
+const char *ngp_bin_fail(int code, int *len);
+const char *ngp_bin_wait(int *len);
+
+// FAIL|code msg|, unknown codes fall back to 10 Invalid; the frames are constants
+const char *formatFail(int code, int *len);
+const char *formatWait(int *len);
+
+// NAME|player_num|opponent|
+int formatName(char *buf, int player_num, const char *opponent);
+
+// Decimal digits of a non-negative number, returns the new end
+static inline char *put_uint(char *p, unsigned v)
+{
+    char tmp[10];
+    int n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    while (n) *p++ = tmp[--n];
+    return p;
+}
+
+static inline char *put_str(char *p, const char *s)
+{
+    while (*s) *p++ = *s++;
+    return p;
+}
+
+// "p1 p2 ... pn"
+static inline char *put_board_n(char *p, const int *board, int piles)
+{
+    for (int i = 0; i < piles; i++) {
+        if (i) *p++ = ' ';
+        p = put_uint(p, (unsigned)board[i]);
+    }
+    return p;
+}
+
+// Payload was written from buf + MSG_HEADER_LEN up to end, now fill in "0|LL|" in front of it
+static inline int finish_frame(char *buf, char *end)
+{
+    int payload_len = (int)(end - (buf + MSG_HEADER_LEN));
+    buf[0] = '0';
+    buf[1] = '|';
+    buf[2] = (char)('0' + payload_len / 10);
+    buf[3] = (char)('0' + payload_len % 10);
+    buf[4] = '|';
+    *end = '\0';
+    return (int)(end - buf);
+}
+
+// PLAY|whose_turn|p1 ... pn|
+static inline int ngp_play_n(char *buf, int whose_turn, const int *board, int piles)
+{
+    char *p = put_str(buf + MSG_HEADER_LEN, "PLAY|");
+    p = put_uint(p, (unsigned)whose_turn);
+    *p++ = '|';
+    p = put_board_n(p, board, piles);
+    *p++ = '|';
+    return finish_frame(buf, p);
+}
+
+// OVER|winner|p1 ... pn|Forfeit| or OVER|winner|p1 ... pn||
+static inline int ngp_over_n(char *buf, int forfeit, int winner, const int *board, int piles)
+{
+    char *p = put_str(buf + MSG_HEADER_LEN, "OVER|");
+    p = put_uint(p, (unsigned)winner);
+    *p++ = '|';
+    p = put_board_n(p, board, piles);
+    p = put_str(p, forfeit ? "|Forfeit|" : "||");
+    return finish_frame(buf, p);
+}
+
+#endif
@@ -0,0 +1,223 @@
+#ifndef NGP_CLIENT_H
+#define NGP_CLIENT_H
+
+// Client side NGP helpers shared by spectester and nimbench
+// Blocking sockets, one frame at a time. Binary frames are laid out by ngp.h
+
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "ngp.h"
+
+#define MAX_RAW   256
+#define MAX_FIELDS 8
+
+typedef struct {
+    char raw[MAX_RAW];      // full frame "0|DD|....|"
+    int  raw_len;
+
+    int  len;               // payload length (DD)
+    char type[5];           // 4 chars + '\0'
+
+    char work[MAX_RAW];     // mutable payload copy
+    char *fields[MAX_FIELDS];
+    int field_count;
+} NgpMsg;
+
+// A binary server frame, see ngp.h
+typedef struct {
+    int type;               // NGP_BIN_WAIT, NGP_BIN_NAME, ...
+    int a;
+    int b;
+    unsigned char body[NGP_BIN_NAME_LEN];
+} NgpBinMsg;
+
+static inline ssize_t read_exact(int fd, void *buf, size_t n) {
+    size_t got = 0;
+    while (got < n) {
+        ssize_t r = read(fd, (char*)buf + got, n - got);
+        if (r == 0) return 0;            // EOF
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        got += (size_t)r;
+    }
+    return (ssize_t)got;
+}
+
+static inline ssize_t write_all(int fd, const void *buf, size_t n) {
+    size_t sent = 0;
+    while (sent < n) {
+        ssize_t w = write(fd, (const char*)buf + sent, n - sent);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        sent += (size_t)w;
+    }
+    return (ssize_t)sent;
+}
+
+static inline int connect_tcp(const char *host, const char *port) {
+    struct addrinfo hints, *res = NULL, *p = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    int err = getaddrinfo(host, port, &hints, &res);
+    if (err != 0) {
+        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
+        return -1;
+    }
+
+    int fd = -1;
+    for (p = res; p; p = p->ai_next) {
+        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
+        close(fd);
+        fd = -1;
+    }
+
+    freeaddrinfo(res);
+    return fd;
+}
+
+// Strict recv of server frame: requires header "0|DD|" (two digits!)
+static inline int ngp_recv(int fd, NgpMsg *m) {
+    memset(m, 0, sizeof(*m));
+
+    char hdr[5];
+    ssize_t r = read_exact(fd, hdr, sizeof(hdr));
+    if (r == 0) return 0;     // EOF
+    if (r < 0) return -1;
+
+    if (!(hdr[0] == '0' && hdr[1] == '|' && isdigit((unsigned char)hdr[2]) &&
+          isdigit((unsigned char)hdr[3]) && hdr[4] == '|')) {
+        return -2; // bad frame header
+    }
+
+    int len = (hdr[2] - '0') * 10 + (hdr[3] - '0');
+    if (len <= 0 || len >= (MAX_RAW - 6)) return -2;
+
+    char payload[MAX_RAW];
+    r = read_exact(fd, payload, (size_t)len);
+    if (r == 0) return 0;
+    if (r < 0) return -1;
+
+    if (payload[len - 1] != '|') return -2;
+
+    // Save raw frame (bar counting happens on THIS, not on the tokenized work buffer)
+    memcpy(m->raw, hdr, 5);
+    memcpy(m->raw + 5, payload, (size_t)len);
+    m->raw_len = 5 + len;
+    m->raw[m->raw_len] = '\0';
+
+    m->len = len;
+
+    // Copy payload into mutable work buffer and parse fields INCLUDING empty ones
+    memcpy(m->work, payload, (size_t)len);
+    m->work[len] = '\0';
+
+    // type must be 4 chars then '|'
+    if ((int)strlen(m->work) < 5) return -2;
+    if (m->work[4] != '|') return -2;
+    memcpy(m->type, m->work, 4);
+    m->type[4] = '\0';
+    m->work[4] = '\0';
+
+    // Fields start after "TYPE|"
+    char *start = m->work + 5;
+    int nf = 0;
+
+    // Scan until we hit the '\0' we placed at end. Every '|' becomes '\0' and emits a field.
+    for (char *p = start; *p; p++) {
+        if (*p == '|') {
+            if (nf >= MAX_FIELDS) return -2;
+            *p = '\0';
+            m->fields[nf++] = start;
+            start = p + 1;
+        }
+    }
+
+    // Special case: payload could be "OVER|...||" where the last field is empty.
+    // That empty field is represented by a final '|' which is inside the string before our '\0'.
+    // The loop above *will* capture it because the second-to-last character is '|'.
+    m->field_count = nf;
+
+    return 1;
+}
+
+// Recv of one binary server frame, returns like ngp_recv
+static inline int ngp_recv_bin(int fd, NgpBinMsg *m) {
+    unsigned char hdr[NGP_BIN_HEADER];
+    ssize_t r = read_exact(fd, hdr, sizeof(hdr));
+    if (r == 0) return 0;
+    if (r < 0) return -1;
+
+    int size = ngp_bin_size(hdr[1]);
+    if (hdr[0] != NGP_BIN || size == 0) return -2;
+    m->type = hdr[1];
+    m->a = hdr[2];
+    m->b = hdr[3];
+    if (size > NGP_BIN_HEADER) {
+        r = read_exact(fd, m->body, (size_t)(size - NGP_BIN_HEADER));
+        if (r == 0) return 0;
+        if (r < 0) return -1;
+    }
+    return 1;
+}
+
+static inline void send_raw(int fd, const char *s) {
+    (void)write_all(fd, s, strlen(s));
+}
+
+static inline void send_payload(int fd, const char *payload) {
+    size_t len = strlen(payload);
+    char frame[MAX_RAW + 8]; // header + payload
+    snprintf(frame, sizeof(frame), "0|%02zu|%s", len, payload);
+    send_raw(fd, frame);
+}
+
+static inline void send_open(int fd, const char *name) {
+    char payload[MAX_RAW];
+    snprintf(payload, sizeof(payload), "OPEN|%s|", name);
+    send_payload(fd, payload);
+}
+
+static inline void send_view(int fd, const char *target) {
+    char payload[MAX_RAW];
+    snprintf(payload, sizeof(payload), "VIEW|%s|", target);
+    send_payload(fd, payload);
+}
+
+static inline void send_move(int fd, int pile, int qty) {
+    char payload[MAX_RAW];
+    snprintf(payload, sizeof(payload), "MOVE|%d|%d|", pile, qty);
+    send_payload(fd, payload);
+}
+
+// Binary OPEN, with bot set it asks for the server's bot
+static inline void send_bin_open(int fd, const char *name, int bot) {
+    char frame[NGP_BIN_MAX];
+    size_t n = strlen(name);
+    if (n > NGP_BIN_NAME_LEN) n = NGP_BIN_NAME_LEN;
+    int len = ngp_bin_header(frame, NGP_BIN_OPEN, bot ? NGP_BIN_BOT : 0, (int)n);
+    memset(frame + NGP_BIN_HEADER, 0, NGP_BIN_NAME_LEN);
+    memcpy(frame + NGP_BIN_HEADER, name, n);
+    (void)write_all(fd, frame, (size_t)len);
+}
+
+static inline void send_bin_move(int fd, int pile, int qty) {
+    char frame[NGP_BIN_HEADER];
+    int len = ngp_bin_header(frame, NGP_BIN_MOVE, pile, qty);
+    (void)write_all(fd, frame, (size_t)len);
+}
+
+#endif
@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <string.h>
+#include "nim_rules.h"
+
+int nim_board_parse(const char *s, int *board)
+{
+    int piles = 0;
+    while (*s) {
+        char *end;
+        long size = strtol(s, &end, 10);
+        if (end == s || size < 1 || size > NIM_MAX_PILE_SIZE || piles == NIM_MAX_PILES) return 0;
+        board[piles++] = (int)size;
+        s = end;
+        if (*s == ',') s++;
+        else if (*s != '\0') return 0;
+    }
+    return piles;
+}
+
+void nim_bot_move(const int *board, int piles, int skill, uint32_t *rng, long *pile, long *qty)
+{
+    int sum = nim_sum_n(board, piles);
+    if (sum != 0 && (int)(nim_rand(rng) % 100) < skill) {
+        // A pile whose size has the nim-sum's top bit set shrinks to size ^ sum
+        for (int i = 0; i < piles; i++) {
+            int to = board[i] ^ sum;
+            if (to < board[i]) {
+                *pile = i + 1;
+                *qty = board[i] - to;
+                return;
+            }
+        }
+    }
+
+    int left = 0;
+    for (int i = 0; i < piles; i++) left += board[i] != 0;
+    int k = (int)(nim_rand(rng) % (uint32_t)left);
+    for (int i = 0; i < piles; i++) {
+        if (board[i] == 0 || k-- > 0) continue;
+        *pile = i + 1;
+        *qty = 1 + (long)(nim_rand(rng) % (uint32_t)board[i]);
+        return;
+    }
+}
+
+void nim_batch_reset(NimGame *games, int n, const int *board, int piles, uint32_t seed)
+{
+    for (int i = 0; i < n; i++) {
+        NimGame *g = &games[i];
+        memcpy(g->board, board, (size_t)piles * sizeof(int));
+        g->turn = 1;
+        g->winner = 0;
+        g->moves = 0;
+        g->rng = (seed + (uint32_t)i) * 2654435761u;
+        if (g->rng == 0) g->rng = 1;
+    }
+}
+
+int nim_batch_step(NimGame *games, int n, int piles, const int skill[2])
+{
+    int live = 0;
+    for (int i = 0; i < n; i++) {
+        NimGame *g = &games[i];
+        if (g->turn == 0) continue;
+
+        long pile = 0, qty = 0;
+        nim_bot_move(g->board, piles, skill[g->turn - 1], &g->rng, &pile, &qty);
+        int r = nim_play_n(g->board, piles, g->turn, g->turn, pile, qty);
+        g->moves++;
+        if (r == NIM_WON) {
+            g->winner = g->turn;
+            g->turn = 0;
+        } else {
+            g->turn = nim_other(g->turn);
+            live++;
+        }
+    }
+    return live;
+}
@@ -0,0 +1,106 @@
+#ifndef NIMD_NIM_RULES_H
+#define NIMD_NIM_RULES_H
+
+#include <stdint.h>
+
+// The rules of Nim with nothing around them: no sockets, locks or logging. The server plays
+// every move through nim_play_n and its bot through nim_bot_move; nimsim runs whole batches
+// of games through the same code, so the two cannot disagree about a rule
+// Board functions take the pile count as an argument and are inline, so a caller passing a
+// constant gets a copy of its own with the loops unrolled
+
+#define NIM_MAX_PILES     10  // Most piles a board can have
+#define NIM_MAX_PILE_SIZE 255 // Largest starting pile
+
+// nim_play_n results; a refused move returns its NGP FAIL code and changes nothing
+enum {
+    NIM_OK = 0, // Applied, the other player moves next
+    NIM_WON = 1, // Applied, it took the last stone
+    NIM_TURN = 31, // Not this player's turn (Impatient)
+    NIM_PILE = 32, // No such pile (Pile Index)
+    NIM_QTY = 33, // Fewer than one or more stones than the pile has (Quantity)
+};
+
+static inline int nim_other(int player)
+{
+    return 3 - player;
+}
+
+// 1-based pile number names a pile of the board
+static inline int nim_has_pile_n(long pile, int piles)
+{
+    return pile >= 1 && pile <= piles;
+}
+
+// Every pile is down to zero
+static inline int nim_empty_n(const int *board, int piles)
+{
+    int left = 0;
+    for (int i = 0; i < piles; i++) left |= board[i];
+    return left == 0;
+}
+
+// XOR of the piles: the player to move can win exactly when it is not zero
+static inline int nim_sum_n(const int *board, int piles)
+{
+    int sum = 0;
+    for (int i = 0; i < piles; i++) sum ^= board[i];
+    return sum;
+}
+
+// Whether player may take qty stones from pile while turn is to move: NIM_OK or a FAIL code
+static inline int nim_check_n(const int *board, int piles, int turn, int player, long pile, long qty)
+{
+    if (player != turn) return NIM_TURN;
+    if (!nim_has_pile_n(pile, piles)) return NIM_PILE;
+    if (qty < 1 || qty > board[pile - 1]) return NIM_QTY;
+    return NIM_OK;
+}
+
+// player takes qty stones from pile while turn is to move
+static inline int nim_play_n(int *board, int piles, int turn, int player, long pile, long qty)
+{
+    int check = nim_check_n(board, piles, turn, player, pile, qty);
+    if (check != NIM_OK) return check;
+
+    board[pile - 1] -= (int)qty;
+    return nim_empty_n(board, piles) ? NIM_WON : NIM_OK;
+}
+
+// xorshift32, *state must not be 0
+static inline uint32_t nim_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Parse "1,3,5,7,9" into board: 1 to NIM_MAX_PILES piles of 1 to NIM_MAX_PILE_SIZE stones
+// Returns the pile count, 0 if s is no such board
+int nim_board_parse(const char *s, int *board);
+
+// A move for the player to move on a board that is not empty. skill percent of the time it is
+// the one that leaves a nim-sum of zero; otherwise, or when there is none, a random number of
+// stones from a random pile
+void nim_bot_move(const int *board, int piles, int skill, uint32_t *rng, long *pile, long *qty);
+
+// Batch simulation: many games advanced together without any I/O
+typedef struct {
+    int board[NIM_MAX_PILES];
+    int turn; // 1 or 2, 0 once the game is over
+    int winner;
+    int moves;
+    uint32_t rng; // The players' random numbers
+} NimGame;
+
+// Start n games on board, each with its own random numbers from seed
+void nim_batch_reset(NimGame *games, int n, const int *board, int piles, uint32_t seed);
+
+// One move in every game still in play, by a bot of skill[turn - 1] for whoever is to move
+// Returns the number of games still in play afterwards
+int nim_batch_step(NimGame *games, int n, int piles, const int skill[2]);
+
+#endif
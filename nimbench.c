@@ -0,0 +1,384 @@
+#define _POSIX_C_SOURCE 200809L
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ngp_client.h"
+
+// nimbench: plays many complete games against nimd and reports throughput and latency
+// Every bot is one thread with one blocking socket, so bots are paired by the
+// server's matchmaking exactly like real players. With -v, spectator threads keep
+// VIEWing games in play by one of their players' names and follow them to the end
+// With -B the bots speak binary NGP; spectators always speak text
+
+#define BOT_STACK      (128 * 1024)
+#define RECV_TIMEOUT_S 10
+
+typedef struct {
+    int id;
+    double *rtt;        // MOVE -> PLAY round trips (us)
+    int rtt_count;
+    int rtt_cap;
+    double *setup;      // connect -> WAIT (us)
+    int setup_count;
+    int setup_cap;
+    long moves;         // MOVEs this bot sent
+    long wins;          // OVERs naming this bot, one per finished game (every OVER with -s)
+    long errors;        // Connections that ended without an OVER
+    pthread_mutex_t lock;
+    char playing[32];   // Name while its game is in play, for spectators to pick
+} Bot;
+
+typedef struct {
+    unsigned seed;
+    long followed;      // Games watched up to their OVER
+    long refused;       // VIEWs that came too late, the game was over
+    long frames;        // PLAY and OVER frames received
+    long errors;        // Connections that ended without an OVER or a FAIL
+} Viewer;
+
+static const char *g_host;
+static const char *g_port;
+static int g_tickets;   // Connections left to make across all bots
+static Bot *g_bots;
+static int g_nbots;
+static int g_done;      // Every bot is finished, spectators stop
+static int g_solo;      // -s: every game is one bot against the server's own
+static int g_bin;       // -B: bots speak binary NGP
+
+// A server frame in either protocol, what a bot looks at of it
+typedef struct {
+    int type;           // NGP_BIN_WAIT, NGP_BIN_NAME, ... for text frames too
+    int num;            // NAME: our player number, PLAY: whose turn, OVER: winner
+    int board[16];
+    int piles;
+} BenchFrame;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void push_sample(double **arr, int *count, int *cap, double v) {
+    if (*count == *cap) {
+        int new_cap = *cap ? *cap * 2 : 256;
+        double *tmp = realloc(*arr, new_cap * sizeof(double));
+        if (tmp == NULL) return;
+        *arr = tmp;
+        *cap = new_cap;
+    }
+    (*arr)[(*count)++] = v;
+}
+
+// Parse "1 3 5 7 9" into board, returns the pile count
+static int parse_board(const char *s, int *board, int max) {
+    int n = 0;
+    char *end;
+    while (*s && n < max) {
+        long v = strtol(s, &end, 10);
+        if (end == s) break;
+        board[n++] = (int)v;
+        s = end;
+    }
+    return n;
+}
+
+// Next frame for a bot, returns like ngp_recv
+static int bench_recv(int fd, BenchFrame *f) {
+    f->piles = 0;
+    if (g_bin) {
+        NgpBinMsg m;
+        int r = ngp_recv_bin(fd, &m);
+        if (r != 1) return r;
+        f->type = m.type;
+        f->num = m.a;
+        if (m.type == NGP_BIN_PLAY || m.type == NGP_BIN_OVER) {
+            f->piles = m.b < NGP_BIN_PILES ? m.b : NGP_BIN_PILES;
+            for (int i = 0; i < f->piles; i++) f->board[i] = m.body[i];
+        }
+        return 1;
+    }
+
+    NgpMsg m;
+    int r = ngp_recv(fd, &m);
+    if (r != 1) return r;
+    f->num = m.field_count >= 1 ? atoi(m.fields[0]) : 0;
+    if (strcmp(m.type, "WAIT") == 0) f->type = NGP_BIN_WAIT;
+    else if (strcmp(m.type, "NAME") == 0 && m.field_count >= 1) f->type = NGP_BIN_NAME;
+    else if (strcmp(m.type, "PLAY") == 0 && m.field_count >= 2) {
+        f->type = NGP_BIN_PLAY;
+        f->piles = parse_board(m.fields[1], f->board, 16);
+    } else if (strcmp(m.type, "OVER") == 0) f->type = NGP_BIN_OVER;
+    else f->type = NGP_BIN_FAIL; // FAIL or anything unexpected
+    return 1;
+}
+
+// One connection, one game: OPEN, then answer every PLAY that is our turn
+static void play_one(Bot *b, int round) {
+    double t0 = now_us();
+    int fd = connect_tcp(g_host, g_port);
+    if (fd < 0) {
+        b->errors++;
+        return;
+    }
+
+    // A bot left without an opponent at the very end should not hang the run
+    struct timeval tv = { RECV_TIMEOUT_S, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char name[32];
+    snprintf(name, sizeof(name), "bench%d_%d", b->id, round);
+    if (g_bin) {
+        send_bin_open(fd, name, g_solo);
+    } else if (g_solo) {
+        char payload[64];
+        snprintf(payload, sizeof(payload), "OPEN|%s|BOT|", name);
+        send_payload(fd, payload);
+    } else {
+        send_open(fd, name);
+    }
+
+    BenchFrame f;
+    int me = 0;
+    double sent_at = 0;
+    int finished = 0;
+
+    while (bench_recv(fd, &f) == 1) {
+        if (f.type == NGP_BIN_WAIT) {
+            push_sample(&b->setup, &b->setup_count, &b->setup_cap, now_us() - t0);
+        } else if (f.type == NGP_BIN_NAME) {
+            me = f.num;
+            pthread_mutex_lock(&b->lock);
+            memcpy(b->playing, name, sizeof(b->playing));
+            pthread_mutex_unlock(&b->lock);
+        } else if (f.type == NGP_BIN_PLAY) {
+            if (sent_at > 0) {
+                push_sample(&b->rtt, &b->rtt_count, &b->rtt_cap, now_us() - sent_at);
+                sent_at = 0;
+            }
+            if (f.num != me) continue;
+
+            // Take one stone from the first non-empty pile, the longest possible game
+            for (int i = 0; i < f.piles; i++) {
+                if (f.board[i] > 0) {
+                    sent_at = now_us();
+                    if (g_bin) send_bin_move(fd, i + 1, 1);
+                    else send_move(fd, i + 1, 1);
+                    b->moves++;
+                    break;
+                }
+            }
+        } else if (f.type == NGP_BIN_OVER) {
+            if (g_solo || f.num == me) b->wins++;
+            finished = 1;
+            break;
+        } else {
+            // FAIL or anything unexpected
+            break;
+        }
+    }
+
+    pthread_mutex_lock(&b->lock);
+    b->playing[0] = '\0';
+    pthread_mutex_unlock(&b->lock);
+    if (!finished) b->errors++;
+    close(fd);
+}
+
+// Watch random games in play until the bots are done
+static void *viewer_thread(void *arg) {
+    Viewer *v = arg;
+    struct timespec nap = { 0, 1000000 };
+    while (!__atomic_load_n(&g_done, __ATOMIC_ACQUIRE)) {
+        Bot *b = &g_bots[rand_r(&v->seed) % g_nbots];
+        char name[32];
+        pthread_mutex_lock(&b->lock);
+        memcpy(name, b->playing, sizeof(name));
+        pthread_mutex_unlock(&b->lock);
+        if (name[0] == '\0') {
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        int fd = connect_tcp(g_host, g_port);
+        if (fd < 0) {
+            v->errors++;
+            continue;
+        }
+        struct timeval tv = { RECV_TIMEOUT_S, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        send_view(fd, name);
+
+        NgpMsg m;
+        int outcome = 0; // 1 OVER, 2 FAIL
+        while (outcome == 0 && ngp_recv(fd, &m) == 1) {
+            if (strcmp(m.type, "PLAY") == 0) v->frames++;
+            else if (strcmp(m.type, "OVER") == 0) v->frames++, outcome = 1;
+            else if (strcmp(m.type, "FAIL") == 0) outcome = 2;
+        }
+        if (outcome == 1) v->followed++;
+        else if (outcome == 2) v->refused++;
+        else v->errors++;
+        close(fd);
+    }
+    return NULL;
+}
+
+static void *bot_thread(void *arg) {
+    Bot *b = arg;
+    int round = 0;
+    while (__atomic_sub_fetch(&g_tickets, 1, __ATOMIC_RELAXED) >= 0) {
+        play_one(b, round++);
+    }
+    return NULL;
+}
+
+static int cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double pct(const double *sorted, int n, double p) {
+    if (n == 0) return 0;
+    int i = (int)(p * (n - 1) + 0.5);
+    return sorted[i];
+}
+
+static void report(const char *what, double *all, int n) {
+    qsort(all, n, sizeof(double), cmp_double);
+    double sum = 0;
+    for (int i = 0; i < n; i++) sum += all[i];
+    printf("%-18s n=%-8d avg=%9.1f p50=%9.1f p99=%9.1f p999=%9.1f max=%9.1f us\n", what, n, n ? sum / n : 0, pct(all, n, 0.50), pct(all, n, 0.99), pct(all, n, 0.999), n ? all[n - 1] : 0);
+}
+
+int main(int argc, char **argv) {
+    int games = 1000;
+    int concurrent = 100;
+    int viewers = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:c:v:sB")) != -1) {
+        switch (opt) {
+            case 'g': games = atoi(optarg); break;
+            case 'c': concurrent = atoi(optarg); break;
+            case 'v': viewers = atoi(optarg); break;
+            case 's': g_solo = 1; break;
+            case 'B': g_bin = 1; break;
+            default:
+                fprintf(stderr, "Usage: %s [-g games] [-c concurrent_games] [-v spectators] [-s] [-B] <host> <port>\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc - 2 || games <= 0 || concurrent <= 0 || viewers < 0) {
+        fprintf(stderr, "Usage: %s [-g games] [-c concurrent_games] [-v spectators] [-s] [-B] <host> <port>\n", argv[0]);
+        return 2;
+    }
+    g_host = argv[optind];
+    g_port = argv[optind + 1];
+
+    // Two connections per game, one against the server's bot
+    g_tickets = g_solo ? games : games * 2;
+    int nbots = g_solo ? concurrent : concurrent * 2;
+    if (nbots > g_tickets) nbots = g_tickets;
+
+    printf("NimBench -> host=%s port=%s games=%d concurrent=%d spectators=%d%s%s\n", g_host, g_port, games, concurrent, viewers, g_solo ? " against the server's bot" : "", g_bin ? " binary NGP" : "");
+
+    Bot *bots = calloc(nbots, sizeof(Bot));
+    pthread_t *threads = calloc(nbots, sizeof(pthread_t));
+    Viewer *views = calloc(viewers + 1, sizeof(Viewer));
+    pthread_t *view_threads = calloc(viewers + 1, sizeof(pthread_t));
+    if (bots == NULL || threads == NULL || views == NULL || view_threads == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BOT_STACK);
+
+    for (int i = 0; i < nbots; i++) pthread_mutex_init(&bots[i].lock, NULL);
+    g_bots = bots;
+    g_nbots = nbots;
+
+    double start = now_us();
+    int started = 0;
+    int watching = 0;
+    for (int i = 0; i < viewers; i++) {
+        views[i].seed = (unsigned)i * 2654435761u + 1;
+        if (pthread_create(&view_threads[i], &attr, viewer_thread, &views[i]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        watching++;
+    }
+    for (int i = 0; i < nbots; i++) {
+        bots[i].id = i;
+        if (pthread_create(&threads[i], &attr, bot_thread, &bots[i]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double secs = (now_us() - start) / 1e6;
+    __atomic_store_n(&g_done, 1, __ATOMIC_RELEASE);
+    for (int i = 0; i < watching; i++) {
+        pthread_join(view_threads[i], NULL);
+    }
+
+    long moves = 0, finished = 0, errors = 0;
+    int nrtt = 0, nsetup = 0;
+    for (int i = 0; i < started; i++) {
+        moves += bots[i].moves;
+        finished += bots[i].wins;
+        errors += bots[i].errors;
+        nrtt += bots[i].rtt_count;
+        nsetup += bots[i].setup_count;
+    }
+
+    double *rtt = malloc((nrtt + 1) * sizeof(double));
+    double *setup = malloc((nsetup + 1) * sizeof(double));
+    int r = 0, s = 0;
+    for (int i = 0; i < started; i++) {
+        memcpy(rtt + r, bots[i].rtt, bots[i].rtt_count * sizeof(double));
+        r += bots[i].rtt_count;
+        memcpy(setup + s, bots[i].setup, bots[i].setup_count * sizeof(double));
+        s += bots[i].setup_count;
+        free(bots[i].rtt);
+        free(bots[i].setup);
+    }
+
+    printf("\n");
+    printf("elapsed            %.3f s\n", secs);
+    printf("games finished     %ld (connection errors %ld)\n", finished, errors);
+    printf("games/sec          %.1f\n", finished / secs);
+    printf("moves/sec          %.1f\n", moves / secs);
+    report("setup (conn->WAIT)", setup, nsetup);
+    report("MOVE->PLAY rtt", rtt, nrtt);
+    if (watching > 0) {
+        long followed = 0, refused = 0, frames = 0, verrors = 0;
+        for (int i = 0; i < watching; i++) {
+            followed += views[i].followed;
+            refused += views[i].refused;
+            frames += views[i].frames;
+            verrors += views[i].errors;
+        }
+        printf("spectators         %ld games followed, %ld too late, %ld frames (errors %ld)\n", followed, refused, frames, verrors);
+    }
+
+    free(rtt);
+    free(setup);
+    free(bots);
+    free(threads);
+    free(views);
+    free(view_threads);
+    return errors == 0 ? 0 : 1;
+}
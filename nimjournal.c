@@ -0,0 +1,227 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "journal.h"
+
+// Dumps a nimd game journal as text, one event per line
+// Records are in the order the server's writer collected them; -s sorts them by game and
+// event number instead, which puts every game's events together and in order
+
+static int sorted = 0;
+static uint64_t only_game = 0; // 0 = every game
+
+// START is printed once the NAME records after it have delivered both names
+static struct {
+    int active;
+    JournalRecord rec;
+    char names[2][73];
+    int want[2];
+    int got[2];
+} start;
+
+// Board size of every run seen so far, from its RUN record. A game id starts with its run's
+// id, which the RUN record carries in its own game id
+typedef struct {
+    uint32_t run;
+    int piles;
+} RunBoard;
+
+static RunBoard *runs;
+static size_t num_runs;
+
+static void run_add(const JournalRecord *r)
+{
+    RunBoard *grown = realloc(runs, (num_runs + 1) * sizeof(*runs));
+    if (grown == NULL) return;
+    runs = grown;
+    runs[num_runs].run = (uint32_t)(r->game >> 32);
+    runs[num_runs].piles = r->a <= JOURNAL_PILES ? r->a : 0;
+    num_runs++;
+}
+
+// 0 when the game's RUN record is missing
+static int run_piles(uint64_t game)
+{
+    for (size_t i = num_runs; i-- > 0;) {
+        if (runs[i].run == (uint32_t)(game >> 32)) return runs[i].piles;
+    }
+    return 0;
+}
+
+static void print_prefix(const JournalRecord *r)
+{
+    time_t sec = (time_t)(r->ts_ns / 1000000000ULL);
+    struct tm tm;
+    char stamp[32];
+    localtime_r(&sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+    printf("%s.%06u ", stamp, (unsigned)(r->ts_ns % 1000000000ULL / 1000));
+    if (r->type != JOURNAL_RUN) printf("game %u:%u #%u ", (unsigned)(r->game >> 32), (unsigned)r->game, r->seq);
+}
+
+static void print_board(const JournalRecord *r, int piles)
+{
+    if (piles == 0) printf("(board size unknown)");
+    for (int i = 0; i < piles; i++) printf(i ? " %u" : "%u", r->data[i]);
+}
+
+static void flush_start(void)
+{
+    if (!start.active) return;
+    print_prefix(&start.rec);
+    printf("START '%s' vs '%s'%s\n", start.names[0], start.names[1],
+           start.got[0] < start.want[0] || start.got[1] < start.want[1] ? " (names incomplete)" : "");
+    start.active = 0;
+}
+
+static void print_record(const JournalRecord *r)
+{
+    if (only_game != 0 && r->game != only_game) {
+        // The game's board still needs its run's size
+        if (r->type == JOURNAL_RUN) run_add(r);
+        return;
+    }
+
+    if (r->type == JOURNAL_NAME && start.active && r->game == start.rec.game && r->player >= 1 && r->player <= 2) {
+        int p = r->player - 1;
+        if (r->a + r->b <= 72) {
+            memcpy(start.names[p] + r->a, r->data, r->b);
+            start.got[p] += r->b;
+        }
+        if (start.got[0] >= start.want[0] && start.got[1] >= start.want[1]) flush_start();
+        return;
+    }
+    flush_start();
+
+    switch (r->type) {
+        case JOURNAL_RUN:
+            print_prefix(r);
+            run_add(r);
+            printf("RUN %u server started, journal version %u", (unsigned)(r->game >> 32), r->player);
+            if (r->a >= 1 && r->a <= JOURNAL_PILES) {
+                printf(", board ");
+                print_board(r, r->a);
+            }
+            printf("\n");
+            break;
+        case JOURNAL_START:
+            memset(&start, 0, sizeof(start));
+            start.active = 1;
+            start.rec = *r;
+            start.want[0] = r->a;
+            start.want[1] = r->b;
+            if (r->a == 0 && r->b == 0) flush_start();
+            break;
+        case JOURNAL_NAME:
+            print_prefix(r);
+            printf("NAME P%u '%.*s' (stray)\n", r->player, r->b <= JOURNAL_NAME_CHUNK ? r->b : JOURNAL_NAME_CHUNK, (const char *)r->data);
+            break;
+        case JOURNAL_MOVE:
+            print_prefix(r);
+            printf("MOVE P%u pile %u qty %u -> ", r->player, r->a, r->b);
+            print_board(r, run_piles(r->game));
+            printf("\n");
+            break;
+        case JOURNAL_OVER:
+            print_prefix(r);
+            if (r->player == 0) printf("OVER aborted, no winner -> ");
+            else printf("OVER P%u wins%s -> ", r->player, r->a ? " by forfeit" : "");
+            print_board(r, run_piles(r->game));
+            printf("\n");
+            break;
+        default:
+            print_prefix(r);
+            printf("unknown record type %u\n", r->type);
+            break;
+    }
+}
+
+static int by_game_seq(const void *a, const void *b)
+{
+    const JournalRecord *x = a, *y = b;
+    if (x->game != y->game) return x->game < y->game ? -1 : 1;
+    if (x->seq != y->seq) return x->seq < y->seq ? -1 : 1;
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: ./nimjournal [-s] [-g high:low] <journal>\n");
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "sg:")) != -1) {
+        switch (opt) {
+            case 's':
+                sorted = 1;
+                break;
+            case 'g': {
+                unsigned hi, lo;
+                if (sscanf(optarg, "%u:%u", &hi, &lo) != 2) {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                only_game = (uint64_t)hi << 32 | lo;
+                break;
+            }
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    FILE *f = fopen(argv[optind], "rb");
+    if (f == NULL) {
+        perror(argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    JournalHeader h;
+    if (fread(&h, sizeof(h), 1, f) != 1 || memcmp(h.magic, JOURNAL_MAGIC, sizeof(h.magic)) != 0) {
+        fprintf(stderr, "%s: not a nimd journal\n", argv[optind]);
+        return EXIT_FAILURE;
+    }
+    if (h.version != JOURNAL_VERSION || h.record_size != sizeof(JournalRecord)) {
+        fprintf(stderr, "%s: journal version %u with %u byte records, this reader knows version %d\n", argv[optind], h.version, h.record_size, JOURNAL_VERSION);
+        return EXIT_FAILURE;
+    }
+
+    JournalRecord *recs = NULL;
+    size_t n = 0, cap = 0;
+    JournalRecord r;
+    while (fread(&r, sizeof(r), 1, f) == 1) {
+        if (!sorted) {
+            print_record(&r);
+            continue;
+        }
+        if (n == cap) {
+            cap = cap ? cap * 2 : 4096;
+            JournalRecord *grown = realloc(recs, cap * sizeof(*recs));
+            if (grown == NULL) {
+                fprintf(stderr, "out of memory after %zu records\n", n);
+                return EXIT_FAILURE;
+            }
+            recs = grown;
+        }
+        recs[n++] = r;
+    }
+    fclose(f);
+
+    if (sorted) {
+        // Stable enough: a game's events never share a number
+        qsort(recs, n, sizeof(*recs), by_game_seq);
+        for (size_t i = 0; i < n; i++) print_record(&recs[i]);
+        free(recs);
+    }
+    flush_start();
+    return EXIT_SUCCESS;
+}
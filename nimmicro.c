@@ -0,0 +1,280 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "ngp.h"
+#include "nim_rules.h"
+
+// Microbenchmarks of the server's per-frame path, one step at a time and without sockets:
+// framing, parsing, move validation, applying the move and encoding the answer, all with the
+// code the server runs (ngp.h, nim_rules.h). The frames are recorded first from bot games
+// played by the rules core, so every step sees the mix of inputs a real game produces
+// Framing, parsing and encoding are timed for text and for binary NGP
+
+#define FRAME_BUF (MAX_MESSAGE_LEN + 1)
+
+// One recorded client frame and the game as it stood when it arrived
+typedef struct {
+    char frame[FRAME_BUF];
+    int len;
+    char bin[NGP_BIN_MAX]; // The same frame in binary NGP
+    int bin_len; // 0 for VIEW, which has none
+    int board[NIM_MAX_PILES]; // Before the move
+    int turn;
+    long pile; // 0 unless a MOVE
+    long qty;
+} Recorded;
+
+static Recorded *rec;
+static int nrec;
+static int piles = 5;
+static int start[NIM_MAX_PILES] = { 1, 3, 5, 7, 9 };
+static volatile long sink; // Keeps every result alive
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static Recorded *rec_add(const char *payload)
+{
+    Recorded *r = &rec[nrec++];
+    memset(r, 0, sizeof(*r));
+    r->len = snprintf(r->frame, sizeof(r->frame), "0|%02d|%s", (int)strlen(payload), payload);
+    return r;
+}
+
+// Every game opens with its two OPENs, a spectator VIEWs it now and then, then the moves
+static void record(int games)
+{
+    // A game has at most one move per stone
+    int stones = 0;
+    for (int i = 0; i < piles; i++) stones += start[i];
+    rec = calloc((size_t)games * (size_t)(3 + stones), sizeof(Recorded));
+    if (rec == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+
+    uint32_t rng = 12345;
+    char payload[FRAME_BUF];
+    for (int g = 0; g < games; g++) {
+        for (int p = 0; p < 2; p++) {
+            char name[32];
+            snprintf(name, sizeof(name), "player%d_%c", g, 'a' + p);
+            snprintf(payload, sizeof(payload), "OPEN|%s|", name);
+            Recorded *r = rec_add(payload);
+            r->bin_len = ngp_bin_header(r->bin, NGP_BIN_OPEN, 0, (int)strlen(name));
+            memcpy(r->bin + NGP_BIN_HEADER, name, strlen(name));
+        }
+        if (g % 8 == 0) {
+            snprintf(payload, sizeof(payload), "VIEW|player%d_a|", g);
+            rec_add(payload);
+        }
+
+        int board[NIM_MAX_PILES];
+        memcpy(board, start, sizeof(board));
+        int turn = 1;
+        for (;;) {
+            long pile, qty;
+            // Half skilled bots: games neither short nor all alike
+            nim_bot_move(board, piles, 50, &rng, &pile, &qty);
+            snprintf(payload, sizeof(payload), "MOVE|%ld|%ld|", pile, qty);
+            Recorded *r = rec_add(payload);
+            memcpy(r->board, board, sizeof(board));
+            r->turn = turn;
+            r->pile = pile;
+            r->qty = qty;
+            r->bin_len = ngp_bin_header(r->bin, NGP_BIN_MOVE, (int)pile, (int)qty);
+            if (nim_play_n(board, piles, turn, turn, pile, qty) == NIM_WON) break;
+            turn = nim_other(turn);
+        }
+    }
+}
+
+static void report(const char *what, double ns, long ops)
+{
+    printf("%-28s %8.1f ns/op  (%ld ops)\n", what, ns / (double)ops, ops);
+}
+
+int main(int argc, char **argv)
+{
+    int games = 1000;
+    int passes = 200;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:n:b:")) != -1) {
+        switch (opt) {
+            case 'g': games = atoi(optarg); break;
+            case 'n': passes = atoi(optarg); break;
+            case 'b':
+                piles = nim_board_parse(optarg, start);
+                if (piles == 0) {
+                    fprintf(stderr, "-b takes 1 to %d pile sizes from 1 to %d, like 1,3,5,7,9\n", NIM_MAX_PILES, NIM_MAX_PILE_SIZE);
+                    return 2;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-g recorded_games] [-n passes] [-b pile,pile,...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc || games <= 0 || passes <= 0) {
+        fprintf(stderr, "Usage: %s [-g recorded_games] [-n passes] [-b pile,pile,...]\n", argv[0]);
+        return 2;
+    }
+
+    record(games);
+    int nmoves = 0, nbin = 0;
+    for (int i = 0; i < nrec; i++) {
+        nmoves += rec[i].pile != 0;
+        nbin += rec[i].bin_len != 0;
+    }
+    printf("NimMicro -> %d recorded frames (%d MOVE) from %d games, %d passes, %d piles\n\n", nrec, nmoves, games, passes, piles);
+
+    char buf[FRAME_BUF];
+    ParsedMsg msg;
+    long acc = 0;
+    double t;
+
+    // Framing: find where the frame ends in the receive buffer
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) acc += ngp_frame_status(rec[i].frame, (size_t)rec[i].len, sizeof(buf));
+    report("frame (ngp_frame_status)", now_ns() - t, (long)passes * nrec);
+
+    // The parser splits in place, so each frame is copied into the buffer first as the server does
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            memcpy(buf, rec[i].frame, (size_t)rec[i].len + 1);
+            acc += buf[i & 7];
+        }
+    double copy = now_ns() - t;
+    report("  copy only", copy, (long)passes * nrec);
+
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            memcpy(buf, rec[i].frame, (size_t)rec[i].len + 1);
+            acc += parse_client_message(buf, &msg);
+            acc += msg.field_count;
+        }
+    double parse = now_ns() - t;
+    report("parse (parse_client_message)", parse - copy, (long)passes * nrec);
+
+    // MOVE fields to numbers, as session_step does after parsing
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            if (rec[i].pile == 0) continue;
+            memcpy(buf, rec[i].frame, (size_t)rec[i].len + 1);
+            parse_client_message(buf, &msg);
+            acc += strtol(msg.fields[0], NULL, 10) + strtol(msg.fields[1], NULL, 10);
+        }
+    double parse_moves = now_ns() - t;
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            if (rec[i].pile == 0) continue;
+            memcpy(buf, rec[i].frame, (size_t)rec[i].len + 1);
+            acc += parse_client_message(buf, &msg);
+        }
+    report("  MOVE fields (strtol)", parse_moves - (now_ns() - t), (long)passes * nmoves);
+
+    // The same frames in binary: the type fixes the size and MOVE carries its numbers as bytes
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            if (rec[i].bin_len == 0) continue;
+            acc += ngp_bin_frame_status(rec[i].bin, (size_t)rec[i].bin_len);
+        }
+    report("binary frame", now_ns() - t, (long)passes * nbin);
+
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            if (rec[i].bin_len == 0) continue;
+            memcpy(buf, rec[i].bin, (size_t)rec[i].bin_len);
+            acc += buf[i & 3];
+        }
+    double bin_copy = now_ns() - t;
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            if (rec[i].bin_len == 0) continue;
+            memcpy(buf, rec[i].bin, (size_t)rec[i].bin_len);
+            acc += ngp_bin_parse(buf, rec[i].bin_len, &msg);
+            acc += msg.pile;
+        }
+    report("binary parse (ngp_bin_parse)", now_ns() - t - bin_copy, (long)passes * nbin);
+
+    // Validation and the move itself, on the board each MOVE saw
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            Recorded *r = &rec[i];
+            if (r->pile == 0) continue;
+            acc += nim_check_n(r->board, piles, r->turn, r->turn, r->pile, r->qty);
+        }
+    report("validate (nim_check_n)", now_ns() - t, (long)passes * nmoves);
+
+    int board[NIM_MAX_PILES];
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            Recorded *r = &rec[i];
+            if (r->pile == 0) continue;
+            memcpy(board, r->board, sizeof(board));
+            acc += nim_play_n(board, piles, r->turn, r->turn, r->pile, r->qty);
+        }
+    report("apply (nim_play_n)", now_ns() - t, (long)passes * nmoves);
+
+    // The answer to each MOVE. The server passes a constant pile count on the default board
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            Recorded *r = &rec[i];
+            if (r->pile == 0) continue;
+            acc += ngp_play_n(buf, nim_other(r->turn), r->board, piles);
+        }
+    report("encode PLAY (ngp_play_n)", now_ns() - t, (long)passes * nmoves);
+
+    if (piles == 5) {
+        t = now_ns();
+        for (int p = 0; p < passes; p++)
+            for (int i = 0; i < nrec; i++) {
+                Recorded *r = &rec[i];
+                if (r->pile == 0) continue;
+                acc += ngp_play_n(buf, nim_other(r->turn), r->board, 5);
+            }
+        report("  5 piles, constant", now_ns() - t, (long)passes * nmoves);
+    }
+
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            Recorded *r = &rec[i];
+            if (r->pile == 0) continue;
+            acc += ngp_over_n(buf, i & 1, r->turn, r->board, piles);
+        }
+    report("encode OVER (ngp_over_n)", now_ns() - t, (long)passes * nmoves);
+
+    t = now_ns();
+    for (int p = 0; p < passes; p++)
+        for (int i = 0; i < nrec; i++) {
+            Recorded *r = &rec[i];
+            if (r->pile == 0) continue;
+            acc += ngp_bin_play_n(buf, nim_other(r->turn), r->board, piles);
+            acc += buf[5 + (i & 3)];
+        }
+    report("binary PLAY (ngp_bin_play_n)", now_ns() - t, (long)passes * nmoves);
+
+    sink = acc;
+    free(rec);
+    return 0;
+}
@@ -0,0 +1,138 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "nim_rules.h"
+
+// Headless self-play: bot against bot with the server's own rules (nim_rules.h), no sockets
+// Every thread takes batches of games from a shared count and advances each batch one move
+// at a time across all of its games until the last one is over
+
+typedef struct {
+    int id;
+    long games; // Finished by this thread
+    long moves;
+    long wins[2];
+} Worker;
+
+static long g_left; // Games not handed to a thread yet
+static int g_batch = 1024;
+static int g_skill[2] = { 100, 100 };
+static int g_board[NIM_MAX_PILES] = { 1, 3, 5, 7, 9 };
+static int g_piles = 5;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void *worker_thread(void *arg) {
+    Worker *w = arg;
+    NimGame *games = malloc((size_t)g_batch * sizeof(NimGame));
+    if (games == NULL) return NULL;
+
+    uint32_t seed = (uint32_t)w->id * 0x9e3779b9u + (uint32_t)time(NULL);
+    for (;;) {
+        long n = __atomic_sub_fetch(&g_left, g_batch, __ATOMIC_RELAXED) + g_batch;
+        if (n <= 0) break;
+        if (n > g_batch) n = g_batch;
+
+        nim_batch_reset(games, (int)n, g_board, g_piles, seed);
+        seed += (uint32_t)n;
+        while (nim_batch_step(games, (int)n, g_piles, g_skill) > 0) {}
+
+        for (long i = 0; i < n; i++) {
+            w->moves += games[i].moves;
+            w->wins[games[i].winner - 1]++;
+        }
+        w->games += n;
+    }
+    free(games);
+    return NULL;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [-g games] [-t threads] [-n batch] [-x p1_skill] [-y p2_skill] [-b pile,pile,...]\n", prog);
+}
+
+int main(int argc, char **argv) {
+    long games = 10000000;
+    int threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) threads = 1;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "g:t:n:x:y:b:")) != -1) {
+        switch (opt) {
+            case 'g': games = atol(optarg); break;
+            case 't': threads = atoi(optarg); break;
+            case 'n': g_batch = atoi(optarg); break;
+            case 'x': g_skill[0] = atoi(optarg); break;
+            case 'y': g_skill[1] = atoi(optarg); break;
+            case 'b':
+                g_piles = nim_board_parse(optarg, g_board);
+                if (g_piles == 0) {
+                    fprintf(stderr, "-b takes 1 to %d pile sizes from 1 to %d, like 1,3,5,7,9\n", NIM_MAX_PILES, NIM_MAX_PILE_SIZE);
+                    return 2;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind != argc || games <= 0 || threads <= 0 || g_batch <= 0 ||
+        g_skill[0] < 0 || g_skill[0] > 100 || g_skill[1] < 0 || g_skill[1] > 100) {
+        usage(argv[0]);
+        return 2;
+    }
+    g_left = games;
+
+    char board[4 * NIM_MAX_PILES] = "";
+    for (int i = 0; i < g_piles; i++) snprintf(board + strlen(board), sizeof(board) - strlen(board), i ? " %d" : "%d", g_board[i]);
+    printf("NimSim -> games=%ld threads=%d batch=%d board=%s skill P1=%d P2=%d\n", games, threads, g_batch, board, g_skill[0], g_skill[1]);
+
+    Worker *workers = calloc((size_t)threads, sizeof(Worker));
+    pthread_t *tids = calloc((size_t)threads, sizeof(pthread_t));
+    if (workers == NULL || tids == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    double start = now_us();
+    int started = 0;
+    for (int i = 0; i < threads; i++) {
+        workers[i].id = i;
+        if (pthread_create(&tids[i], NULL, worker_thread, &workers[i]) != 0) {
+            perror("pthread_create");
+            break;
+        }
+        started++;
+    }
+    for (int i = 0; i < started; i++) pthread_join(tids[i], NULL);
+    double secs = (now_us() - start) / 1e6;
+
+    long done = 0, moves = 0, wins[2] = { 0, 0 };
+    for (int i = 0; i < started; i++) {
+        done += workers[i].games;
+        moves += workers[i].moves;
+        wins[0] += workers[i].wins[0];
+        wins[1] += workers[i].wins[1];
+    }
+
+    printf("\n");
+    printf("elapsed            %.3f s\n", secs);
+    printf("games finished     %ld\n", done);
+    printf("games/sec          %.0f\n", done / secs);
+    printf("moves/sec          %.0f\n", moves / secs);
+    printf("moves/game         %.2f\n", done ? (double)moves / done : 0.0);
+    printf("P1 wins            %ld (%.1f%%)\n", wins[0], done ? 100.0 * wins[0] / done : 0.0);
+    printf("P2 wins            %ld (%.1f%%)\n", wins[1], done ? 100.0 * wins[1] / done : 0.0);
+
+    free(workers);
+    free(tids);
+    return done == games ? 0 : 1;
+}
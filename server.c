@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // SO_REUSEPORT
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -11,17 +12,72 @@
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <stdint.h>
+#include <limits.h>
+#include <assert.h>
+#include <sys/resource.h>
+#include "logger.h"
+#include "metrics.h"
+#include "uring.h"
+#include "timer.h"
+#include "journal.h"
+#include "snapshot.h"
+#include "handoff.h"
+#include "nim_rules.h"
+#include "ngp.h"
 
 #define QUEUE_SIZE 256
-#define MAX_MESSAGE_LEN 104
-#define MSG_HEADER_LEN 5
 #define HOSTSIZE 100
 #define PORTSIZE 10
 
 #define RECV_OK        1   // return >0 for success (actual value = total bytes)
 #define RECV_EOF       0   // clean EOF
 #define RECV_SYSERR   -1   // read() error
-#define RECV_BADFRAME -2   // malformed NGP framing
+#define RECV_BADFRAME NGP_BADFRAME // malformed NGP framing
+#define RECV_AGAIN    -3   // non-blocking socket has no more bytes yet
+#define RECV_BUF_SIZE 1024 // per connection, room for several whole frames
+
+#define ENGINE_THREAD 0    // one detached pthread per connection
+#define ENGINE_EPOLL  1    // a few event loops drive non-blocking sockets
+#define ENGINE_SHARD  2    // loops that each own a listener, a game registry and matchmaking
+#define ENGINE_URING  3    // shards driven by io_uring instead of epoll
+#define MAX_EVENTS    256
+#define SHARD_TICK_MS  20  // How often a shard looks for players stranded in its waiting queue
+#define SHARD_STEAL_MS 50  // How long a lone player waits before moving to another shard
+#define OUT_MAX_FRAMES 4   // Most frames one event sends to one socket (WAIT, NAME, PLAY)
+
+#define URING_ENTRIES    1024 // Submission queue size per loop
+#define URING_BUFS       2048 // Provided receive buffers per loop, a power of two
+#define URING_BUF_SIZE   512
+#define SEND_BUF_SIZE    512  // Room for every frame one event sends to one socket
+#define WATCH_MAX_QUEUED 64   // uring: sends in flight to one spectator before it is cut off
+#define URING_TAG_RECV   0    // user_data is a Conn
+#define URING_TAG_ACCEPT 1    // user_data is the EventLoop
+#define URING_TAG_SEND   2    // user_data is a SendBuf
+#define URING_TAG_OTHER  3    // close or cancel; a shutdown carries (fd + 1) << 2
+#define URING_TAG_MASK   3
+
+#define TIMER_TICK_MS     100 // Resolution of the connection deadlines
+#define OPEN_TIMEOUT_S    10  // Default time from accept to a successful OPEN
+#define IDLE_TIMEOUT_S    300 // Default time an OPENed connection may go without a frame
+
+#define SNAPSHOT_MS       100  // How often the snapshot writer copies changed games
+#define UPGRADE_DRAIN_S   60   // thread engine: how long the old server lets its games run on
+#define RESUME_BUCKETS    1024 // Hash buckets for restored games waiting for their players
+
+#define NAME_STRIPES      64 // Independently locked parts of the name set
+#define NAME_BUCKETS_INIT 16 // Starting buckets per stripe
+
+#define MAX_PILES      NIM_MAX_PILES // Largest board -b takes, journal records and snapshot entries hold it
+#define MAX_PILE_SIZE  NIM_MAX_PILE_SIZE // They keep a pile in a byte
+#define STD_PILES      5   // The default board, 1 3 5 7 9, has code of its own
+#define BOARD_TEXT_LEN (4 * MAX_PILES) // A board as text with its NUL, see board_text
+
+#define BOT_NAME "nimd-bot" // What a player playing the bot gets in NAME
 
 
 volatile int active = 1;
@@ -30,10 +86,43 @@ volatile int active = 1;
 char *custom1 = "0|18|CONNECTION_FAILED|";
 char *custom2 = "0|16|SERVER_SHUTDOWN|";
 
-//This number is 
-int max_games = 4;
-int cur_game_index = -1;
-pthread_mutex_t registry_lock;
+//Connection engine, picked on the command line
+int engine = ENGINE_THREAD;
+int num_loops = 0; // 0 = one loop (or shard) per online CPU
+int prealloc_games = 0; // Games to allocate before accepting
+int open_timeout_ms = OPEN_TIMEOUT_S * 1000; // 0 = no OPEN deadline
+int idle_timeout_ms = IDLE_TIMEOUT_S * 1000; // 0 = no idle deadline
+
+// Admission control: past a limit new sockets get CONNECTION_FAILED right after accept
+// instead of slowing down the games in progress. 0 = unlimited
+int limit_conns = 0; // Seated connections
+int limit_games = 0; // Games out of the pools
+int limit_pending = 0; // Connections that have not OPENed yet
+int conns_live = 0; // Seated connections not yet cleaned up
+int conns_pending = 0; // Of those, the ones without a successful OPEN
+int games_live = 0; // Games handed out by every pool
+
+// Crash recovery: with -s the games in play are kept in a snapshot file; with -r a restart
+// holds the previous run's games for this long so their players can reattach
+int resume_window_ms = 0;
+long long resume_until = 0; // When the reattach window closes (ms), 0 once it has
+
+// The board every game starts with, -b; the default one takes the specialized paths
+int board_piles = STD_PILES;
+int board_start[MAX_PILES] = { 1, 3, 5, 7, 9 };
+int board_std = 1; // board_start is 1 3 5 7 9
+
+// The bot: a player who OPENs with BOT, or has waited bot_wait_ms for an opponent, gets the
+// server itself as P2
+int bot_wait_ms = 0; // 0 = only on request
+int bot_skill = 100; // Percent of its moves the bot plays perfectly, the rest are random
+
+typedef char board_fits_records[MAX_PILES <= JOURNAL_PILES && MAX_PILES <= SNAPSHOT_PILES && MAX_PILES <= NGP_BIN_PILES ? 1 : -1];
+
+// Hot upgrade: SIGUSR2 asks main to hand everything to a freshly exec'd server
+volatile int upgrade_requested = 0;
+int upgrade_fd = -1; // -u: in the new server, its end of the handoff socket
+pthread_t main_tid;
 
 enum State {
     AWAITING_SECOND_PLAYER,
@@ -42,6 +131,8 @@ enum State {
     AWAITING_FIRST_PLAYER,
     GAME_START,
     GAME_OVER,
+    RESUMING, // Restored from the snapshot, waiting for its players to reattach
+    NUM_STATES
 };
 
 const char *state_to_str(int s) {
@@ -58,40 +149,241 @@ const char *state_to_str(int s) {
             return "GAME_START";
         case GAME_OVER:             
             return "GAME_OVER";
+        case RESUMING:
+            return "RESUMING";
         default:                    
             return "UNKNOWN_STATE";
     }
 }
 
+#define MM_NONE    0 // Game is in play (or finishing) and on no list
+#define MM_FREE    1 // Game has no players and sits on the pool free list
+#define MM_WAITING 2 // Game has one player waiting for an opponent
+
+#define CACHE_LINE     64
+#define GAME_SLAB_SIZE 64    // Games per slab
+#define MAX_GAME_SLABS 16384 // Pool tops out at about a million games
+
 //A players name has max 72 Characters, 73 used for identifying Null Term
 //Board always has 5 stones
-typedef struct {
+struct Registry;
+struct Conn;
+struct Bcast;
+
+typedef struct Game {
     int p1_s; // Player 1 Socket
     int p2_s; // Player 2 Socket
     char p1_name[73]; // Player 1 Name
     char p2_name[73]; // Player 2 Name
-    int board[5]; // Board State
-    int state; // Game Session State
+    int board[MAX_PILES]; // Board State, board_piles of it used
+    int state; // Game Session State, changed by game_state_set under lock, read anywhere with game_state
     pthread_mutex_t lock; // Mutex Lock for Game
-    int index; // Index for game inside of Game Array
+    int index; // Game number used in logs, unique across shards
+    int slot; // Index inside its registry's pool
+    struct Registry *reg; // Registry (shard) whose pool owns this game
     pthread_t p1_t; // Thread for Player 1
     pthread_t p2_t; // Thread for Player 2
-} Game;
+    struct Conn *p1_c; // Connection of Player 1, lets a shard move a lone waiting player
+    struct Conn *p2_c; // Connection of Player 2
+    long long waiting_since; // When the game last joined the waiting queue (ms)
+    unsigned long p1_open_seq; // Order P1 sent OPEN in, across every shard (valid once p1_name is set)
+    unsigned long p2_open_seq;
+    struct Game *mm_prev; // Waiting queue links
+    struct Game *mm_next;
+    int mm_list; // Where matchmaking has the game (MM_*)
+    int next_free; // Index of the next free game while on the free list
+    uint64_t journal_id; // Set when the game starts with the journal on
+    unsigned journal_seq; // Next event number in the journal
+    int resume_turn; // RESUMING: who moves once both players are back
+    uint64_t resume_key; // RESUMING: the snapshot's key for this game
+    unsigned snap_round; // Bumped when a game starts or is restored, it needs new snapshot entries
+    int snap_queued; // On the snapshot writer's list
+    struct Game *snap_next;
+    int snap_p1; // Snapshot writer only: this game's entries, -1 for none
+    int snap_p2;
+    unsigned snap_round_put; // Snapshot writer only: snap_round the entries were made for
+    uint64_t snap_key; // Snapshot writer only: key of the entries
+    int nwatchers; // Spectators following the game, it is not reset before they are gone
+    unsigned long watch_seq; // Frames queued for spectators so far
+    struct Bcast *watch_pending; // Queued for spectators and not sent yet, newest first
+    int watch_draining; // Someone is sending the queued frames
+    pthread_mutex_t watch_lock; // Guards watchers against the sends
+    struct Conn *watchers;
+    int bot; // P2 is the server's bot, which has no socket and moves as soon as it is its turn
+    uint32_t bot_rng; // The bot's random numbers, xorshift
+} __attribute__((aligned(CACHE_LINE))) Game; // Neighbouring games never share a line
+
+// The state machine. Every change goes through game_state_set with the game's lock held and
+// must be one of these; the state is an atomic word, so a thread can look at it without the lock
+#define STATE_BIT(s) (1u << (s))
+
+static const unsigned state_next[NUM_STATES] = {
+    // Seated by matchmaking
+    [AWAITING_FIRST_PLAYER] = STATE_BIT(AWAITING_SECOND_PLAYER),
+    // Second player (or the bot) seated, or the lone one left; any live game can end on an error
+    [AWAITING_SECOND_PLAYER] = STATE_BIT(GAME_START) | STATE_BIT(AWAITING_FIRST_PLAYER) | STATE_BIT(GAME_OVER),
+    // Both named: play. One left before that: the other waits again, as P1
+    [GAME_START] = STATE_BIT(P1_TURN) | STATE_BIT(AWAITING_SECOND_PLAYER) | STATE_BIT(GAME_OVER),
+    [P1_TURN] = STATE_BIT(P2_TURN) | STATE_BIT(GAME_OVER),
+    [P2_TURN] = STATE_BIT(P1_TURN) | STATE_BIT(GAME_OVER),
+    [RESUMING] = STATE_BIT(P1_TURN) | STATE_BIT(P2_TURN) | STATE_BIT(GAME_OVER),
+    // Everyone gone, back to the pool
+    [GAME_OVER] = STATE_BIT(AWAITING_FIRST_PLAYER),
+};
+
+typedef char state_bits_fit[NUM_STATES <= 32 ? 1 : -1];
+
+static inline int game_state(Game *g)
+{
+    return __atomic_load_n(&g->state, __ATOMIC_ACQUIRE);
+}
+
+// Caller holds g's lock
+// A change state_next does not list is a bug: debug builds stop on it, others log it and
+// leave the state alone
+static void game_state_set(Game *g, int to)
+{
+    if (!(state_next[g->state] & STATE_BIT(to))) {
+        assert(!"illegal game state change");
+        LOG_ERROR("[GAME %d] Refused state change %s -> %s", g->index, state_to_str(g->state), state_to_str(to));
+        return;
+    }
+    __atomic_store_n(&g->state, to, __ATOMIC_RELEASE);
+}
+
+// Caller holds g's lock
+// Puts a game fresh from the pool straight into a saved state: a restored or handed over game
+// picks up where it was, which no step of state_next leads to
+static void game_state_enter(Game *g, int to)
+{
+    if (g->state != AWAITING_FIRST_PLAYER || to < 0 || to >= NUM_STATES) {
+        assert(!"game state entered from a used game");
+        LOG_ERROR("[GAME %d] Refused entering %d from %s", g->index, to, state_to_str(g->state));
+        return;
+    }
+    __atomic_store_n(&g->state, to, __ATOMIC_RELEASE);
+}
+
+typedef struct {
+    Game *head;
+    Game *tail;
+    int count; // Written under the registry's lock, read without it by shard_rebalance
+} GameList;
 
 typedef struct {
+    Game *slabs[MAX_GAME_SLABS]; // GAME_SLAB_SIZE games each, never moved once allocated
+    int nslabs;
+    int free_head; // Index of the first free game, -1 when empty
+    int in_use; // Games handed out and not yet returned
+} GamePool;
+
+// Everything matchmaking needs: one in the thread and epoll engines, one per shard otherwise
+typedef struct Registry {
+    pthread_mutex_t lock; // Guards the pool, its growth and the waiting queue
+    GamePool pool;
+    GameList waiting; // Games with one player, oldest first
+    int max_games; // Number of games the pool currently has room for
+    int id; // Shard number, 0 without shards
+} Registry;
+
+Registry registry; // The only registry unless sharded
+Registry *shards; // num_loops registries with -e shard
+int num_registries = 1;
+
+//Bytes read from a socket but not yet consumed as frames
+typedef struct {
+    char data[RECV_BUF_SIZE];
+    size_t start; // First unconsumed byte
+    size_t end; // One past the last byte read
+} RecvBuf;
+
+typedef char rx_holds_uring_buf[URING_BUF_SIZE <= RECV_BUF_SIZE ? 1 : -1]; // See conn_run_bytes
+
+struct EventLoop;
+
+//Per connection state, owned by its thread or by exactly one event loop
+typedef struct Conn {
     int sock; // Player Sock
     struct sockaddr_storage rem; // Based on Class Code
     socklen_t rem_len; // Based on Class Code
     Game *session; // Ref to Game Session
-} ConnArgs;
-
+    int seat; // Its seat in session, 1 or 2; set by seat_take under the game's lock, read by its own thread without
+    char host[HOSTSIZE]; // Printable peer address
+    char port[PORTSIZE];
+    int have_open; // has this client sent a successful OPEN?
+    int proto; // NGP_TEXT or NGP_BIN, the id byte of its first frame; 0 until that arrives
+    char name[73]; // Name this connection claimed, released on cleanup
+    int bytes; // Last recv result, tells cleanup why we stopped
+    RecvBuf rx; // Buffered socket bytes, may hold several frames
+    struct EventLoop *owner; // Event loop driving this connection, NULL in the thread engine
+    int recv_armed; // uring: a multishot recv is still outstanding for this Conn
+    int dead; // uring: session closed, free once the recv completes for the last time
+    struct EventLoop *migrate_to; // uring: loop taking the connection over after a shard move
+    int rx_bad; // uring: bytes were lost while moving, report a bad frame once adopted
+    struct Conn *inbox_next;
+    unsigned long long accepted_ns; // When accept_conn got the socket, for the accept histogram
+    Timer timer; // OPEN or idle deadline
+    long long frame_ms; // Last whole frame after OPEN; conn_expired counts the idle deadline from it
+    int expired; // thread engine: the deadline passed, the socket was shut down to wake the reader
+    struct EventLoop *move_to; // uring: a reattach seated it in another loop's game, move once its frames are run
+    int watching; // Sent VIEW: a spectator of session, holds no seat
+    struct Conn *watch_prev; // session->watchers links
+    struct Conn *watch_next;
+    unsigned long watch_from; // First of the game's spectator frames meant for it
+    int watch_cut; // Hung up on, gets nothing more
+} Conn;
+
+// A frame for spectators, encoded once and shared by every send of it until the last is done
+typedef struct Bcast {
+    struct Bcast *next; // Game's watch_pending link
+    int refs;
+    unsigned long seq; // Number among the game's spectator frames
+    struct Conn *only; // For this spectator alone (what it sees on joining), NULL for all
+    int len; // 0: no frame, the game is over and its spectators are hung up
+    char data[];
+} Bcast;
+
+// Copy of one socket's output while an io_uring send is in flight
+typedef struct SendBuf {
+    struct SendBuf *next; // Free list link
+    int fd;
+    struct Bcast *shared; // Sends this frame instead of data, holding a reference
+    char data[SEND_BUF_SIZE];
+} SendBuf;
+
+// Output queued by a uring loop until the end of its batch
 typedef struct {
-    char *type;       // "OPEN" or "MOVE"
-    char *fields[3];  // up to 3 fields (we only need up to 2)
-    int field_count;
-} ParsedMsg;
-
-Game **sessions;
+    int fd;
+    int op; // IORING_OP_SEND, IORING_OP_SHUTDOWN or IORING_OP_CLOSE
+    int seq; // Queue order, kept within each socket
+    unsigned len;
+    SendBuf *sb;
+} NetOp;
+
+//One epoll instance and the thread that drives it
+//A shard loop also owns a SO_REUSEPORT listener and a registry
+typedef struct EventLoop {
+    int epfd;
+    pthread_t thread;
+    int listener; // -1 unless sharded
+    Registry *reg; // Where this loop matches the players it accepts
+    long long last_rebalance; // ms, shards only
+    Uring ring; // uring engine only
+    SendBuf *send_free;
+    int sends_out; // SendBufs taken from send_free and not back yet
+    NetOp *ops; // Output queued during this batch
+    int nops;
+    int ops_cap;
+    pthread_mutex_t inbox_lock; // Guards inbox
+    Conn *inbox; // Connections other loops moved here, not yet adopted
+    TimerWheel wheel; // Deadlines of the connections this loop drives
+    int wheel_shared; // -e epoll: main arms the timers of the connections it hands over
+    pthread_mutex_t wheel_lock; // Guards wheel when wheel_shared
+    int accept_armed; // uring: the multishot accept is outstanding
+    int quiesced; // uring: parked for an upgrade, nothing gets armed again
+} EventLoop;
+
+EventLoop *loops;
 
 // Thread entry point, just wraps handle_connection for my args
 // Also sets up a cleanup function if one thread had to cancel the other
@@ -100,150 +392,195 @@ void free_connargs(void *arg) {
     free(arg);
 }
 
-void handle_connection(int sock, struct sockaddr *rem, socklen_t rem_len, Game *session);
+void handle_connection(Conn *c);
+int open_listener(char *service, int queue_size, int reuseport);
 
 void *connection_thread(void *arg)
 {
-    ConnArgs *c = arg;
+    Conn *c = arg;
     pthread_cleanup_push(free_connargs, c);
-    handle_connection(c->sock, (struct sockaddr *)&c->rem, c->rem_len, c->session);
+    handle_connection(c);
     
     //If we return safely from the handle_connection then we should pop the cleanuphandler before returning
     pthread_cleanup_pop(1);
     return NULL;
 }
 
-// Extract payload from "id|len|payload|" into a modifiable buffer
-int extract_payload(char *buf, char **payload_out, int *payload_len_out) {
-    char *id_str = buf;
-    char *bar1 = strchr(id_str, '|');
-    if (!bar1) return -1;
-    *bar1 = '\0';
-
-    char *len_str = bar1 + 1;
-    char *bar2 = strchr(len_str, '|');
-    if (!bar2) return -1;
-    *bar2 = '\0';
-
-    // Require protocol id "0"
-    if (strcmp(id_str, "0") != 0) return -1;
-
-    // Enforce EXACTLY two digits for length
-    if (strlen(len_str) != 2 || !isdigit((unsigned char)len_str[0]) || !isdigit((unsigned char)len_str[1]))
-        return -1;
-
-    int expected = (len_str[0] - '0') * 10 + (len_str[1] - '0');
-    if (expected < 5 || expected > 104) return -1; // sanity
+// Active player names, a hash set split into stripes so OPENs on different
+// names rarely touch the same lock. Claiming is the uniqueness check itself,
+// so two players can never both pass it with the same name
+typedef struct NameNode {
+    struct NameNode *next;
+    unsigned hash;
+    Conn *conn; // Holder of the name
+    char name[73];
+} NameNode;
 
-    char *payload = bar2 + 1;
-
-    // Ensure buffer actually contains expected bytes
-    if ((int)strlen(payload) < expected) return -1;
+typedef struct {
+    pthread_mutex_t lock;
+    NameNode **buckets;
+    unsigned nbuckets; // Always a power of two
+    unsigned count;
+} NameStripe;
 
-    // Payload must end with '|'
-    if (payload[expected - 1] != '|') return -1;
+NameStripe name_stripes[NAME_STRIPES];
 
-    // Null-terminate right after payload so tokenizers are safe
-    payload[expected] = '\0';
+// FNV-1a
+static unsigned name_hash(const char *name)
+{
+    unsigned h = 2166136261u;
+    for (; *name; name++) {
+        h ^= (unsigned char)*name;
+        h *= 16777619u;
+    }
+    return h;
+}
 
-    *payload_out = payload;
-    *payload_len_out = expected;
+int name_registry_init(void)
+{
+    for (int i = 0; i < NAME_STRIPES; i++) {
+        NameStripe *s = &name_stripes[i];
+        pthread_mutex_init(&s->lock, NULL);
+        s->nbuckets = NAME_BUCKETS_INIT;
+        s->count = 0;
+        s->buckets = calloc(s->nbuckets, sizeof(NameNode *));
+        if (s->buckets == NULL) return 1;
+    }
     return 0;
 }
 
-int parse_client_message(char *buf, ParsedMsg *out) {
-    char *payload;
-    int plen;
-
-    if (extract_payload(buf, &payload, &plen) != 0) return -1;
-
-    // payload includes trailing '|', length plen
-    int bars = 0;
-    for (int i = 0; i < plen; i++) if (payload[i] == '|') bars++;
-
-    // Type must be 4 chars then '|'
-    if (plen < 5) return -1;
-    if (payload[4] != '|') return -1;
-
-    // Split type (safe because we own buffer)
-    payload[4] = '\0';
-    out->type = payload;
-
-    // Enforce allowed types early
-    int expected_bars = -1;
-    if (strcmp(out->type, "OPEN") == 0) expected_bars = 2;
-    else if (strcmp(out->type, "MOVE") == 0) expected_bars = 3;
-    else return -1;
-
-    if (bars != expected_bars) return -1;
-
-    // Now tokenize fields (no need to preserve empties because bar-count already enforced)
-    char *saveptr = NULL;
-    char *tok = strtok_r(payload + 5, "|", &saveptr); // after "TYPE\0"
-    int idx = 0;
-
-    while (tok != NULL) {
-        if (idx >= 2) return -1; // too many fields for client messages
-        out->fields[idx++] = tok;
-        tok = strtok_r(NULL, "|", &saveptr);
+// Double a stripe's table once it averages two names per bucket, caller holds the lock
+static void name_stripe_grow(NameStripe *s)
+{
+    unsigned new_n = s->nbuckets * 2;
+    NameNode **nb = calloc(new_n, sizeof(NameNode *));
+    if (nb == NULL) return; // Still correct, just longer chains
+
+    for (unsigned i = 0; i < s->nbuckets; i++) {
+        NameNode *n = s->buckets[i];
+        while (n) {
+            NameNode *next = n->next;
+            unsigned b = (n->hash / NAME_STRIPES) & (new_n - 1);
+            n->next = nb[b];
+            nb[b] = n;
+            n = next;
+        }
     }
-    out->field_count = idx;
+    free(s->buckets);
+    s->buckets = nb;
+    s->nbuckets = new_n;
+}
 
-    if (strcmp(out->type, "OPEN") == 0 && out->field_count != 1) return -1;
-    if (strcmp(out->type, "MOVE") == 0 && out->field_count != 2) return -1;
+// Returns 0 if the name is now c's, 1 if someone already has it, -1 on malloc failure
+int name_claim(const char *name, Conn *c)
+{
+    unsigned h = name_hash(name);
+    NameStripe *s = &name_stripes[h % NAME_STRIPES];
+
+    pthread_mutex_lock(&s->lock);
+    unsigned b = (h / NAME_STRIPES) & (s->nbuckets - 1);
+    for (NameNode *n = s->buckets[b]; n; n = n->next) {
+        if (n->hash == h && strcmp(n->name, name) == 0) {
+            pthread_mutex_unlock(&s->lock);
+            return 1;
+        }
+    }
 
+    NameNode *n = malloc(sizeof(NameNode));
+    if (n == NULL) {
+        pthread_mutex_unlock(&s->lock);
+        return -1;
+    }
+    n->hash = h;
+    n->conn = c;
+    strncpy(n->name, name, 72);
+    n->name[72] = '\0';
+    n->next = s->buckets[b];
+    s->buckets[b] = n;
+
+    if (++s->count > s->nbuckets * 2) name_stripe_grow(s);
+    pthread_mutex_unlock(&s->lock);
     return 0;
 }
 
-// uses sessions[], cur_game_index, registry_lock from your file
-static int name_in_use(const char *name) {
-    int used = 0;
-
-    pthread_mutex_lock(&registry_lock);
-    for (int i = 0; i <= cur_game_index && !used; i++) {
-        Game *g = sessions[i];
-        if (!g || g->state == AWAITING_FIRST_PLAYER) continue;
-
-        pthread_mutex_lock(&g->lock);
-        if (g->p1_s != -1 &&
-            g->p1_name[0] &&
-            strcmp(g->p1_name, name) == 0) {
-            used = 1;
-        } else if (g->p2_s != -1 &&
-                   g->p2_name[0] &&
-                   strcmp(g->p2_name, name) == 0) {
-            used = 1;
+// Make c the holder of a name claimed for it before it had a Conn, as a takeover does
+// for the players it is handed; nothing can look the name up until they are seated
+void name_hold(const char *name, Conn *c)
+{
+    unsigned h = name_hash(name);
+    NameStripe *s = &name_stripes[h % NAME_STRIPES];
+
+    pthread_mutex_lock(&s->lock);
+    unsigned b = (h / NAME_STRIPES) & (s->nbuckets - 1);
+    for (NameNode *n = s->buckets[b]; n; n = n->next) {
+        if (n->hash == h && strcmp(n->name, name) == 0) {
+            n->conn = c;
+            break;
         }
+    }
+    pthread_mutex_unlock(&s->lock);
+}
 
-        pthread_mutex_unlock(&g->lock);
+void name_release(const char *name)
+{
+    unsigned h = name_hash(name);
+    NameStripe *s = &name_stripes[h % NAME_STRIPES];
+
+    pthread_mutex_lock(&s->lock);
+    unsigned b = (h / NAME_STRIPES) & (s->nbuckets - 1);
+    for (NameNode **pp = &s->buckets[b]; *pp; pp = &(*pp)->next) {
+        NameNode *n = *pp;
+        if (n->hash == h && strcmp(n->name, name) == 0) {
+            *pp = n->next;
+            s->count--;
+            free(n);
+            break;
+        }
     }
-    pthread_mutex_unlock(&registry_lock);
+    pthread_mutex_unlock(&s->lock);
+}
 
-    return used;
+// Game of the player holding name, NULL if nobody does. The holder frees its Conn only after
+// releasing the name; it can still change games, so check the game under its lock
+Game *name_game(const char *name)
+{
+    unsigned h = name_hash(name);
+    NameStripe *s = &name_stripes[h % NAME_STRIPES];
+    Game *g = NULL;
+
+    pthread_mutex_lock(&s->lock);
+    unsigned b = (h / NAME_STRIPES) & (s->nbuckets - 1);
+    for (NameNode *n = s->buckets[b]; n; n = n->next) {
+        if (n->hash == h && strcmp(n->name, name) == 0) {
+            g = n->conn->session;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+    return g;
 }
 
 //Reset a Game State that was game Over'ed
 void resetGame(Game *g)
 {
-    for (int i = 0; i < 5; i++) {
-        g->board[i] = 2 * i + 1;
-    }
+    memcpy(g->board, board_start, sizeof(g->board));
     g->p1_s = -1;
     g->p2_s = -1;
     g->p1_name[0] = '\0';
     g->p2_name[0] = '\0';
-    g->state = AWAITING_FIRST_PLAYER;
+    game_state_set(g, AWAITING_FIRST_PLAYER);
     g->p1_t = 0;
     g->p2_t = 0;
+    g->p1_c = NULL;
+    g->p2_c = NULL;
+    g->bot = 0;
 }
 
 
 //Intiallize Game
 void gameInit(Game *session)
 {
-    for (int i = 0; i < 5; i++) {
-        session->board[i] = 2 * i + 1;
-    }
+    memcpy(session->board, board_start, sizeof(session->board));
 
     session->p1_s = -1;
     session->p2_s = -1;
@@ -251,8 +588,29 @@ void gameInit(Game *session)
 
     session->p1_name[0] = '\0';
     session->p2_name[0] = '\0';
+    session->p1_c = NULL;
+    session->p2_c = NULL;
+
+    session->mm_prev = NULL;
+    session->mm_next = NULL;
+    session->mm_list = MM_NONE;
+
+    session->snap_round = 0;
+    session->snap_queued = 0;
+    session->snap_next = NULL;
+    session->snap_p1 = -1;
+    session->snap_p2 = -1;
+    session->snap_round_put = 0;
+
+    session->nwatchers = 0;
+    session->watch_seq = 0;
+    session->watch_pending = NULL;
+    session->watch_draining = 0;
+    session->watchers = NULL;
+    session->bot = 0;
 
     pthread_mutex_init(&session->lock, NULL);
+    pthread_mutex_init(&session->watch_lock, NULL);
 }
 
 /*
@@ -299,360 +657,1126 @@ int gameDestroy(Game ***sessions, int index)
 
 */
 
-void formatOver(char *buf, int forfeit, int winner, int *board) {
-    char payload[64];
-    int pos = 0;
+// Board code takes the pile count as an argument and is called with the constant STD_PILES
+// for the default board, which gets a copy of its own with the loops unrolled
+
+static inline char *put_board(char *p, const int *board)
+{
+    if (board_std) return put_board_n(p, board, STD_PILES);
+    return put_board_n(p, board, board_piles);
+}
 
-    pos += sprintf(payload + pos, "OVER|%d|", winner);
+// player's move on board while turn is to move, by the rules core: NIM_OK, NIM_WON or a FAIL code
+static inline int board_play(int *board, int turn, int player, long pile, long qty)
+{
+    if (board_std) return nim_play_n(board, STD_PILES, turn, player, pile, qty);
+    return nim_play_n(board, board_piles, turn, player, pile, qty);
+}
 
-    for (int i = 0; i < 5; i++) {
-        pos += sprintf(payload + pos, "%d", board[i]);
-        if (i < 4) {
-            payload[pos++] = ' ';
-            payload[pos] = '\0';
-        }
+// For log lines, buf needs BOARD_TEXT_LEN bytes
+static char *board_text(char *buf, const int *board)
+{
+    *put_board(buf, board) = '\0';
+    return buf;
+}
+
+// Frames that carry the board, encoded by ngp.h with the board's pile count
+int formatOver(char *buf, int forfeit, int winner, const int *board) {
+    if (board_std) return ngp_over_n(buf, forfeit, winner, board, STD_PILES);
+    return ngp_over_n(buf, forfeit, winner, board, board_piles);
+}
+
+static int formatPlay(char *buf, int whose_turn, const int *board) {
+    if (board_std) return ngp_play_n(buf, whose_turn, board, STD_PILES);
+    return ngp_play_n(buf, whose_turn, board, board_piles);
+}
+
+static int formatOverBin(char *buf, int forfeit, int winner, const int *board) {
+    if (board_std) return ngp_bin_over_n(buf, forfeit, winner, board, STD_PILES);
+    return ngp_bin_over_n(buf, forfeit, winner, board, board_piles);
+}
+
+static int formatPlayBin(char *buf, int whose_turn, const int *board) {
+    if (board_std) return ngp_bin_play_n(buf, whose_turn, board, STD_PILES);
+    return ngp_bin_play_n(buf, whose_turn, board, board_piles);
+}
+
+// Socket output. An io_uring loop queues sends, shutdowns and closes for the sockets it
+// owns and turns them into SQEs at the end of its batch, so one io_uring_enter carries
+// the output of many events. Each socket's operations become one hard linked chain.
+// io_uring runs a shutdown (and a send that would block) on a worker thread, which looks
+// the fd number up only then; if the number had been closed and handed to a new
+// connection by that time, the operation would hit the wrong socket. So a close waits
+// until every earlier operation on its fd has completed: linked behind them when they
+// are in its own chain, run by the last completion when they came from an earlier batch.
+// Everywhere else (other engines, sockets another loop owns) they are plain syscalls
+
+typedef struct {
+    EventLoop *loop; // Loop allowed to queue output for this fd
+    int inflight; // SQEs submitted for it and not completed yet
+    int close_pending; // Closed by its owner, the last completion closes the fd
+} NetFd;
+
+NetFd *net_fds; // Indexed by fd, uring engine only
+int net_fds_max;
+static __thread EventLoop *cur_loop;
+
+static int net_owned(int sock)
+{
+    return cur_loop != NULL && sock >= 0 && sock < net_fds_max && net_fds[sock].loop == cur_loop;
+}
+
+// Ask for fd to be closed; returns 1 when the caller must close it now, 0 when the
+// completion of its last in-flight operation will
+static int net_close_ready(int fd)
+{
+    if (fd < 0 || fd >= net_fds_max) return 1;
+    NetFd *f = &net_fds[fd];
+    __atomic_store_n(&f->close_pending, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&f->inflight, __ATOMIC_SEQ_CST) != 0) return 0;
+    // Whoever clears the flag closes, so a completion racing with us cannot close twice
+    return __atomic_exchange_n(&f->close_pending, 0, __ATOMIC_SEQ_CST);
+}
+
+static void net_op_start(int fd)
+{
+    if (fd >= 0 && fd < net_fds_max) __atomic_add_fetch(&net_fds[fd].inflight, 1, __ATOMIC_SEQ_CST);
+}
+
+static void net_op_done(int fd)
+{
+    if (fd < 0 || fd >= net_fds_max) return;
+    NetFd *f = &net_fds[fd];
+    if (__atomic_sub_fetch(&f->inflight, 1, __ATOMIC_SEQ_CST) == 0 && __atomic_exchange_n(&f->close_pending, 0, __ATOMIC_SEQ_CST)) {
+        close(fd);
     }
+}
 
-    pos += sprintf(payload + pos, "|");
+// Next SQE of a loop's ring, submitting what is queued if the ring is full
+static struct io_uring_sqe *uring_sqe(EventLoop *loop)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(&loop->ring);
+    if (sqe == NULL) {
+        uring_submit(&loop->ring, 0, 0);
+        sqe = uring_get_sqe(&loop->ring);
+    }
+    return sqe;
+}
 
-    if (forfeit) {
-        pos += sprintf(payload + pos, "Forfeit|");
-        
+static Bcast *bcast_new(const char *frames, int len)
+{
+    Bcast *b = malloc(sizeof(Bcast) + (size_t)len);
+    if (b == NULL) return NULL;
+    b->next = NULL;
+    b->refs = 1;
+    b->seq = 0;
+    b->only = NULL;
+    b->len = len;
+    memcpy(b->data, frames, (size_t)len);
+    return b;
+}
+
+static void bcast_drop(Bcast *b)
+{
+    if (__atomic_sub_fetch(&b->refs, 1, __ATOMIC_ACQ_REL) == 0) free(b);
+}
+
+static SendBuf *send_buf_get(EventLoop *loop)
+{
+    SendBuf *sb = loop->send_free;
+    if (sb != NULL) loop->send_free = sb->next;
+    else sb = malloc(sizeof(SendBuf));
+    if (sb != NULL) {
+        sb->shared = NULL;
+        loop->sends_out++;
+    }
+    return sb;
+}
+
+static const char *send_buf_data(SendBuf *sb)
+{
+    return sb->shared != NULL ? sb->shared->data : sb->data;
+}
+
+static void send_buf_put(EventLoop *loop, SendBuf *sb)
+{
+    if (sb->shared != NULL) bcast_drop(sb->shared);
+    sb->next = loop->send_free;
+    loop->send_free = sb;
+    loop->sends_out--;
+}
+
+// Returns 0 once the operation is queued on this thread's loop
+static int net_queue(int fd, int op, SendBuf *sb, unsigned len)
+{
+    EventLoop *loop = cur_loop;
+    if (loop->nops == loop->ops_cap) {
+        int cap = loop->ops_cap ? loop->ops_cap * 2 : 64;
+        NetOp *ops = realloc(loop->ops, cap * sizeof(NetOp));
+        if (ops == NULL) return 1;
+        loop->ops = ops;
+        loop->ops_cap = cap;
+    }
+    NetOp *o = &loop->ops[loop->nops];
+    o->fd = fd;
+    o->op = op;
+    o->seq = loop->nops++;
+    o->len = len;
+    o->sb = sb;
+    return 0;
+}
+
+static int netop_cmp(const void *a, const void *b)
+{
+    const NetOp *x = a, *y = b;
+    if (x->fd != y->fd) return (x->fd > y->fd) - (x->fd < y->fd);
+    return x->seq - y->seq;
+}
+
+// Run one queued operation as a syscall (ring full)
+static void net_run_direct(EventLoop *loop, NetOp *o)
+{
+    if (o->op == IORING_OP_SEND) {
+        write(o->fd, send_buf_data(o->sb), o->len);
+        send_buf_put(loop, o->sb);
+    } else if (o->op == IORING_OP_SHUTDOWN) {
+        shutdown(o->fd, SHUT_RDWR);
     } else {
-        pos += sprintf(payload + pos, "|");
+        close(o->fd);
+    }
+}
+
+// Turn the batch's queued output into SQEs, one chain per socket
+static void net_flush(EventLoop *loop)
+{
+    Uring *r = &loop->ring;
+    if (loop->nops == 0) return;
+    if (loop->nops > 1) qsort(loop->ops, loop->nops, sizeof(NetOp), netop_cmp);
+
+    for (int i = 0; i < loop->nops; ) {
+        int fd = loop->ops[i].fd;
+        int n = 1;
+        while (i + n < loop->nops && loop->ops[i + n].fd == fd) n++;
+
+        // Nothing is queued for a socket after its close, so a close ends the chain.
+        // Operations from earlier batches still running keep the fd open until they finish
+        if (loop->ops[i + n - 1].op == IORING_OP_CLOSE && !net_close_ready(fd)) n--;
+        if (n == 0) {
+            i++;
+            continue;
+        }
+
+        // A chain has to go to the kernel in one piece
+        if (r->sq_entries - (r->sqe_tail - *r->sq_head) < (unsigned)n) uring_submit(r, 0, 0);
+
+        for (int k = 0; k < n; k++) {
+            NetOp *o = &loop->ops[i + k];
+            struct io_uring_sqe *sqe = uring_get_sqe(r);
+            if (sqe == NULL) {
+                net_run_direct(loop, o);
+                continue;
+            }
+            if (o->op == IORING_OP_SEND) {
+                o->sb->fd = fd;
+                uring_prep_send(sqe, fd, send_buf_data(o->sb), o->len, (uintptr_t)o->sb | URING_TAG_SEND);
+                net_op_start(fd);
+            } else if (o->op == IORING_OP_SHUTDOWN) {
+                uring_prep_shutdown(sqe, fd, SHUT_RDWR, ((unsigned long long)(fd + 1) << 2) | URING_TAG_OTHER);
+                net_op_start(fd);
+            } else {
+                uring_prep_close(sqe, fd, URING_TAG_OTHER);
+            }
+            // Later operations on this socket wait for this one, whatever its result
+            if (k < n - 1) sqe->flags |= IOSQE_IO_HARDLINK;
+        }
+        i += n;
+        // Skip a close left to the last completion
+        while (i < loop->nops && loop->ops[i].fd == fd) i++;
+    }
+    loop->nops = 0;
+}
+
+static void net_writev(int sock, const struct iovec *iov, int n)
+{
+    if (net_owned(sock)) {
+        size_t len = 0;
+        for (int i = 0; i < n; i++) len += iov[i].iov_len;
+
+        SendBuf *sb = (len <= SEND_BUF_SIZE) ? send_buf_get(cur_loop) : NULL;
+        if (sb != NULL) {
+            char *p = sb->data;
+            for (int i = 0; i < n; i++) {
+                memcpy(p, iov[i].iov_base, iov[i].iov_len);
+                p += iov[i].iov_len;
+            }
+            if (net_queue(sock, IORING_OP_SEND, sb, (unsigned)len) == 0) return;
+            send_buf_put(cur_loop, sb);
+        }
     }
+    writev(sock, iov, n);
+}
+
+static void net_write(int sock, const char *buf, int len)
+{
+    struct iovec iov = { (void *)buf, (size_t)len };
+    net_writev(sock, &iov, 1);
+}
+
+static void net_shutdown(int sock)
+{
+    if (net_owned(sock) && net_queue(sock, IORING_OP_SHUTDOWN, NULL, 0) == 0) return;
+    shutdown(sock, SHUT_RDWR);
+}
 
-    int payload_len = pos;
+static void net_close(int sock)
+{
+    if (net_owned(sock)) {
+        // The fd number stays taken until the queued close runs, after everything else queued for it
+        net_fds[sock].loop = NULL;
+        if (net_queue(sock, IORING_OP_CLOSE, NULL, 0) == 0) return;
+    }
+    if (net_close_ready(sock)) close(sock);
+}
 
-    sprintf(buf, "0|%02d|%s", payload_len, payload);
+// Lock a Game, timing only the waits that actually block
+static void game_lock(Game *g)
+{
+    if (pthread_mutex_trylock(&g->lock) == 0) {
+        metric_time(PHASE_LOCK_WAIT, 0);
+        return;
+    }
+    unsigned long long t0 = now_ns();
+    pthread_mutex_lock(&g->lock);
+    metric_time(PHASE_LOCK_WAIT, now_ns() - t0);
 }
 
-// FAIL|code|msg|
-void formatFail(char *buf, int code, const char *msg) {
-    char payload[80];
-    int pos = 0;
-    pos += sprintf(payload + pos, "FAIL|%d %s|", code, msg);
-    int payload_len = pos;
-    sprintf(buf, "0|%02d|%s", payload_len, payload);
+// Games whose snapshot is out of date, pushed by whoever changed them and taken by the writer
+Game *snap_dirty;
+
+// Queue g for the snapshot writer; call it under g's lock, the writer reads g once it is free
+static void snap_mark(Game *g)
+{
+    if (!snapshot_on || __atomic_exchange_n(&g->snap_queued, 1, __ATOMIC_ACQ_REL)) return;
+    Game *head = __atomic_load_n(&snap_dirty, __ATOMIC_RELAXED);
+    do {
+        g->snap_next = head;
+    } while (!__atomic_compare_exchange_n(&snap_dirty, &head, g, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
 }
 
-void formatWait(char *buf) {
-    const char *payload = "WAIT|";
-    sprintf(buf, "0|0%zu|%s", strlen(payload), payload);
+// Spectators: a connection that sends VIEW instead of OPEN follows a game in play and gets
+// every PLAY and OVER its players get. Whoever changes the game encodes the frame once into a
+// Bcast and queues it on the game under the game's lock, which keeps the frames in game order;
+// after unlocking it sends the queue to every spectator. Those sends never wait: a uring loop
+// queues the shared frame for the sockets it owns, anything else is a non-blocking send, and a
+// spectator that cannot keep up is hung up instead of holding up the players
+
+// Queue b for g's spectators, caller holds g's lock
+static void watch_push(Game *g, Bcast *b)
+{
+    b->seq = ++g->watch_seq;
+    Bcast *head = __atomic_load_n(&g->watch_pending, __ATOMIC_RELAXED);
+    do {
+        b->next = head;
+    } while (!__atomic_compare_exchange_n(&g->watch_pending, &head, b, 1, __ATOMIC_SEQ_CST, __ATOMIC_RELAXED));
 }
 
-// NAME|player_num|opponent|p1 p2 p3 p4 p5|
-void formatName(char *buf, int player_num, const char *opponent, int *board) {
-    char payload[128];
-    int pos = 0;
+// A frame g's players were just sent; caller holds g's lock
+static void watch_publish(Game *g, const char *frame, int len)
+{
+    if (g->nwatchers == 0) return;
+    Bcast *b = bcast_new(frame, len);
+    if (b != NULL) watch_push(g, b);
+}
 
-    pos += sprintf(payload + pos, "NAME|%d|%s|", player_num, opponent);
+// g is over: its spectators are hung up once they have what was queued before; caller holds g's lock
+static void watch_end(Game *g)
+{
+    if (g->nwatchers == 0) return;
+    Bcast *b = bcast_new("", 0);
+    if (b != NULL) watch_push(g, b);
+}
 
-    /*
-    for (int i = 0; i < 5; i++) {
-        pos += sprintf(payload + pos, "%d", board[i]);
-        if (i < 4) {
-            payload[pos++] = ' ';
-            payload[pos] = '\0';
+// One frame to one spectator, caller holds g's watch_lock
+static void watch_send(Game *g, Conn *w, Bcast *b)
+{
+    int fd = w->sock;
+    if (net_owned(fd)) {
+        SendBuf *sb = NULL;
+        if (__atomic_load_n(&net_fds[fd].inflight, __ATOMIC_RELAXED) < WATCH_MAX_QUEUED && (sb = send_buf_get(cur_loop)) != NULL) {
+            __atomic_add_fetch(&b->refs, 1, __ATOMIC_RELAXED);
+            sb->shared = b;
+            if (net_queue(fd, IORING_OP_SEND, sb, (unsigned)b->len) == 0) return;
+            send_buf_put(cur_loop, sb);
         }
+    } else if (send(fd, b->data, (size_t)b->len, MSG_DONTWAIT | MSG_NOSIGNAL) == b->len) {
+        return;
     }
-    pos += sprintf(payload + pos, "|");
-    */
 
-    int payload_len = pos;
-    sprintf(buf, "0|%02d|%s", payload_len, payload);
+    LOG_INFO("[GAME %d] Spectator socket %d is not keeping up, hanging up", g->index, fd);
+    metric_inc(MET_SPECTATORS_CUT);
+    net_shutdown(fd);
+    w->watch_cut = 1;
 }
 
-// PLAY|whose_turn|p1 p2 p3 p4 p5|
-static void formatPlay(char *buf, int whose_turn, int *board) {
-    char payload[96];
-    int pos = 0;
+// Send g's queued frames to its spectators; call it after unlocking g. A thread that finds
+// another one sending leaves its frames to that one
+static void watch_flush(Game *g)
+{
+    while (__atomic_load_n(&g->watch_pending, __ATOMIC_SEQ_CST) != NULL &&
+           __atomic_exchange_n(&g->watch_draining, 1, __ATOMIC_SEQ_CST) == 0) {
+        // Newest first, turn it around
+        Bcast *list = __atomic_exchange_n(&g->watch_pending, NULL, __ATOMIC_SEQ_CST);
+        Bcast *b = NULL;
+        while (list != NULL) {
+            Bcast *next = list->next;
+            list->next = b;
+            b = list;
+            list = next;
+        }
 
-    pos += sprintf(payload + pos, "PLAY|%d|", whose_turn);
-    for (int i = 0; i < 5; i++) {
-        pos += sprintf(payload + pos, "%d", board[i]);
-        if (i < 4) {
-            payload[pos++] = ' ';
-            payload[pos] = '\0';
+        pthread_mutex_lock(&g->watch_lock);
+        while (b != NULL) {
+            Bcast *next = b->next;
+            for (Conn *w = g->watchers; w != NULL; w = w->watch_next) {
+                // A spectator gets nothing queued before it joined but its own first frames
+                if (w->watch_cut || b->seq < w->watch_from || (b->only != NULL && b->only != w)) continue;
+                if (b->len == 0) {
+                    net_shutdown(w->sock);
+                    w->watch_cut = 1;
+                } else {
+                    watch_send(g, w, b);
+                }
+            }
+            bcast_drop(b);
+            b = next;
         }
+        pthread_mutex_unlock(&g->watch_lock);
+        // Anything queued while this thread was sending is picked up by the loop condition
+        __atomic_store_n(&g->watch_draining, 0, __ATOMIC_SEQ_CST);
     }
-    pos += sprintf(payload + pos, "|");
+}
+
+// Binary NGP goes to the players whose first frame had its id. A Conn's proto is set by that
+// frame, before its OPEN stores the name under the game's lock, so anyone writing to a seat of
+// a game that started sees it
 
-    int payload_len = pos;
-    sprintf(buf, "0|%02d|%s", payload_len, payload);
+// Whether the player in seat (1 or 2) speaks binary NGP; caller holds the game's lock
+static int seat_bin(Game *g, int seat)
+{
+    Conn *c = seat == 1 ? g->p1_c : g->p2_c;
+    return c != NULL && c->proto == NGP_BIN;
 }
 
-static void send_fail_and_maybe_forfeit(Game *session, int sock, int player, int code, const char *msg, int *bytes_ptr)
+// A frame to seat's player, if there is one, in its protocol; caller holds the game's lock
+static void seat_write(Game *g, int seat, const char *text, int text_len, const char *bin, int bin_len)
 {
-    char buf[MAX_MESSAGE_LEN + 1];
-    formatFail(buf, code, msg);
-    write(sock, buf, strlen(buf));
+    int sock = seat == 1 ? g->p1_s : g->p2_s;
+    if (sock == -1) return;
+    if (seat_bin(g, seat)) net_write(sock, bin, bin_len);
+    else net_write(sock, text, text_len);
+}
+
+// OVER for both seats and the spectators: the text frame, and the binary one when a seat needs it
+// Caller holds the game's lock
+static void over_encode(Game *g, int forfeit, int winner, char *text, int *text_len, char *bin, int *bin_len)
+{
+    *text_len = formatOver(text, forfeit, winner, g->board);
+    *bin_len = (seat_bin(g, 1) || seat_bin(g, 2)) ? formatOverBin(bin, forfeit, winner, g->board) : 0;
+}
+
+static const char *conn_fail(const Conn *c, int code, int *len)
+{
+    return c->proto == NGP_BIN ? ngp_bin_fail(code, len) : formatFail(code, len);
+}
+
+static void send_fail_and_maybe_forfeit(Conn *c, Game *session, int code, const char *msg, int *bytes_ptr)
+{
+    int sock = c->sock;
+    int len;
+    const char *fail = conn_fail(c, code, &len);
+    net_write(sock, fail, len);
+    metric_fail(code);
 
-    pthread_mutex_lock(&session->lock);
+    game_lock(session);
 
     // Only forfeit if we’re actually in a playing state
     if (session->state == P1_TURN || session->state == P2_TURN) {
-        int loser  = player;
-        int winner = (player == 1) ? 2 : 1;
+        int loser  = c->seat; // Exact under the lock
+        int winner = (loser == 1) ? 2 : 1;
 
         int loser_sock  = (loser  == 1) ? session->p1_s : session->p2_s;
         int winner_sock = (winner == 1) ? session->p1_s : session->p2_s;
 
+        char over_buf[MAX_MESSAGE_LEN + 1], over_bin[NGP_BIN_MAX];
+        int over_len, bin_len;
+        over_encode(session, 1, winner, over_buf, &over_len, over_bin, &bin_len);
+        watch_publish(session, over_buf, over_len);
+        watch_end(session);
+
         // Send OVER to the winner
         if (winner_sock != -1) {
-            char over_buf[MAX_MESSAGE_LEN + 1];
-            formatOver(over_buf, 1, winner, session->board);
-            write(winner_sock, over_buf, strlen(over_buf));
+            seat_write(session, winner, over_buf, over_len, over_bin, bin_len);
 
             // Wake up winner thread's read() so it can hit cleanup and close
-            shutdown(winner_sock, SHUT_RDWR);
+            net_shutdown(winner_sock);
         }
 
         // Also wake up loser thread's read() (this same sock or the other one)
         if (loser_sock != -1 && loser_sock != winner_sock) {
-            shutdown(loser_sock, SHUT_RDWR);
+            net_shutdown(loser_sock);
         }
 
-        session->state = GAME_OVER;
+        game_state_set(session, GAME_OVER);
+
+        LOG_INFO("[GAME %d] P%d forfeits after FAIL %d %s; P%d wins.", session->index, loser, code, msg, winner);
+        metric_inc(MET_WINS_FORFEIT);
+        if (journal_on) journal_over(session->journal_id, &session->journal_seq, winner, 1, session->board);
+        snap_mark(session);
     }
 
     pthread_mutex_unlock(&session->lock);
+    watch_flush(session);
 
     // And ensure THIS thread’s recv loop sees EOF / error
-    shutdown(sock, SHUT_RDWR);
+    net_shutdown(sock);
     if (bytes_ptr) *bytes_ptr = 0;  // so your cleanup sees bytes == 0 if you use that
 }
 
 
-static void maybe_start_game(Game *session) {
-    pthread_mutex_lock(&session->lock);
-    if (session->state == GAME_START &&
-        session->p1_name[0] != '\0' && session->p2_name[0] != '\0') {
+// Frames one event produces for one socket, sent together with a single writev
+typedef struct {
+    int n;
+    struct iovec iov[OUT_MAX_FRAMES];
+} OutBatch;
 
-        // starting piles: 1 3 5 7 9
-        for (int i = 0; i < 5; i++) {
-            session->board[i] = 2 * i + 1;
-        }
+static inline void out_add(OutBatch *o, const char *frame, int len)
+{
+    if (o->n == OUT_MAX_FRAMES) return;
+    o->iov[o->n].iov_base = (void *)frame;
+    o->iov[o->n].iov_len = (size_t)len;
+    o->n++;
+}
 
-        session->state = P1_TURN;
+static inline void out_flush(int sock, OutBatch *o)
+{
+    if (o->n > 0 && sock != -1) net_writev(sock, o->iov, o->n);
+    o->n = 0;
+}
+
+// NAME to each player and PLAY to both, for a game that is (back) in play; caller holds its lock
+// mine holds frames already queued for sock (its WAIT); they go out in front of its NAME and PLAY
+// and the batch is left empty. mine may be NULL when neither player is the caller
+static void send_start(Game *session, int sock, OutBatch *mine, int whose_turn)
+{
+    char name1[MAX_MESSAGE_LEN + 1];
+    char name2[MAX_MESSAGE_LEN + 1];
+    char play[MAX_MESSAGE_LEN + 1];
+    char play_bin[NGP_BIN_MAX];
+    int bin1 = seat_bin(session, 1), bin2 = seat_bin(session, 2);
+
+    int name1_len = bin1 ? ngp_bin_name(name1, 1, session->p2_name) : formatName(name1, 1, session->p2_name);
+    int name2_len = bin2 ? ngp_bin_name(name2, 2, session->p1_name) : formatName(name2, 2, session->p1_name);
+    // Both players get the same PLAY, encode it once per protocol they speak
+    int play_len = (!bin1 || !bin2) ? formatPlay(play, whose_turn, session->board) : 0;
+    int play_bin_len = (bin1 || bin2) ? formatPlayBin(play_bin, whose_turn, session->board) : 0;
+
+    OutBatch p1_out = { 0 }, p2_out = { 0 };
+    OutBatch *o1 = (mine && sock == session->p1_s) ? mine : &p1_out;
+    OutBatch *o2 = (mine && sock == session->p2_s) ? mine : &p2_out;
+
+    out_add(o1, name1, name1_len);
+    if (bin1) out_add(o1, play_bin, play_bin_len);
+    else out_add(o1, play, play_len);
+    out_add(o2, name2, name2_len);
+    if (bin2) out_add(o2, play_bin, play_bin_len);
+    else out_add(o2, play, play_len);
+
+    out_flush(session->p1_s, o1);
+    out_flush(session->p2_s, o2);
+}
 
-        char name1[MAX_MESSAGE_LEN + 1];
-        char name2[MAX_MESSAGE_LEN + 1];
-        char play[MAX_MESSAGE_LEN + 1];
+// Put a game with both players seated and named in play; caller holds its lock
+// mine is as for send_start
+static void game_begin(Game *session, int sock, OutBatch *mine)
+{
+    memcpy(session->board, board_start, sizeof(session->board));
 
-        formatName(name1, 1, session->p2_name, session->board);
-        formatName(name2, 2, session->p1_name, session->board);
-        formatPlay(play, 1, session->board);
+    game_state_set(session, P1_TURN);
+    if (journal_on) {
+        session->journal_id = journal_game_id();
+        session->journal_seq = 0;
+        journal_start(session->journal_id, &session->journal_seq, session->p1_name, session->p2_name);
+    }
+    session->snap_round++;
+    snap_mark(session);
 
-        if (session->p1_s != -1) {
-            write(session->p1_s, name1, strlen(name1));
-            write(session->p1_s, play,  strlen(play));
-        }
-        if (session->p2_s != -1) {
-            write(session->p2_s, name2, strlen(name2));
-            write(session->p2_s, play,  strlen(play));
-        }
+    send_start(session, sock, mine, 1);
 
-        printf("[GAME %d] Starting game: P1='%s' P2='%s'\n", session->index, session->p1_name, session->p2_name);
-        printf("[GAME %d] Initial board: %d %d %d %d %d\n", session->index, session->board[0], session->board[1], session->board[2], session->board[3], session->board[4]);
-        printf("[GAME %d] -> NAME to P1, NAME to P2, then PLAY whose_turn=1\n", session->index);
+    LOG_INFO("[GAME %d] Starting game: P1='%s' P2='%s'", session->index, session->p1_name, session->p2_name);
+    metric_inc(MET_GAMES_STARTED);
+    char text[BOARD_TEXT_LEN];
+    LOG_DEBUG("[GAME %d] Initial board: %s", session->index, board_text(text, session->board));
+    LOG_DEBUG("[GAME %d] -> NAME to P1, NAME to P2, then PLAY whose_turn=1", session->index);
+}
 
+// Starts the game once both players have OPENed
+// mine is as for send_start; if the game does not start the caller still has to flush it.
+// Returns 1 if the game started
+static int maybe_start_game(Game *session, int sock, OutBatch *mine) {
+    int started = 0;
+    game_lock(session);
+    if (session->state == GAME_START &&
+        session->p1_name[0] != '\0' && session->p2_name[0] != '\0') {
+        game_begin(session, sock, mine);
+        started = 1;
     }
     pthread_mutex_unlock(&session->lock);
+    return started;
 }
 
-int recv_ngp_message(int sock, char *buf, size_t bufsize)
+// Check player's move against the game and apply it: the journal records it and both players
+// and the spectators get PLAY, or OVER when it took the last stone. The bot's moves come
+// through here too. Caller holds the game's lock and flushes its spectators after unlocking
+// Returns NIM_OK, NIM_WON or the FAIL code of a refused move, which changed nothing
+static int game_move(Game *session, int player, long pile, long qty)
 {
-    size_t total = 0;
+    int state = session->state;
+    if (state != P1_TURN && state != P2_TURN) return 24;
 
-    // 1) Read "id|"  (we don't care what id is right now)
-    while (1) {
-        char c;
-        ssize_t n = read(sock, &c, 1);
-        if (n == 0) {
-            return RECV_EOF;    // connection closed
-        } else if (n < 0) {
-            return RECV_SYSERR; // read error
-        }
+    // Turn, pile index and quantity checks, then the move itself
+    int result = board_play(session->board, state == P1_TURN ? 1 : 2, player, pile, qty);
+    if (result != NIM_OK && result != NIM_WON) return result;
 
-        if (total + 1 >= bufsize) {
-            return RECV_BADFRAME; // header too long for buffer
-        }
+    if (journal_on) journal_move(session->journal_id, &session->journal_seq, player, (int)pile, (int)qty, session->board);
+    snap_mark(session);
 
-        buf[total++] = c;
+    if (result == NIM_WON) {
+        int winner = player;
 
-        if (c == '|') {
-            break; // finished id field
-        }
-    }
+        char over_buf[MAX_MESSAGE_LEN + 1], over_bin[NGP_BIN_MAX];
+        int over_len, bin_len;
+        over_encode(session, 0, winner, over_buf, &over_len, over_bin, &bin_len); // forfeit=0
 
-    // 2) Read "<len>|"  (decimal length until next '|')
-    size_t len_start = total;
-    int have_digit = 0;
+        int p1 = session->p1_s;
+        int p2 = session->p2_s;
 
-    while (1) {
-        char c;
-        ssize_t n = read(sock, &c, 1);
-        if (n == 0) {
-            return RECV_EOF;
-        } else if (n < 0) {
-            return RECV_SYSERR;
+        // Send OVER to both players (if they exist)
+        seat_write(session, 1, over_buf, over_len, over_bin, bin_len);
+        if (p2 != p1) {
+            seat_write(session, 2, over_buf, over_len, over_bin, bin_len);
         }
+        watch_publish(session, over_buf, over_len);
+        watch_end(session);
 
-        if (total + 1 >= bufsize) {
-            return RECV_BADFRAME; // header too long for buffer
-        }
+        LOG_INFO("[GAME %d] Normal win by P%d. Sending OVER to both.", session->index, winner);
+        metric_inc(MET_WINS_NORMAL);
+        if (journal_on) journal_over(session->journal_id, &session->journal_seq, winner, 0, session->board);
 
-        buf[total++] = c;
+        // Mark game over under the lock
+        game_state_set(session, GAME_OVER);
 
-        if (c == '|') {
-            break; // end of length field
+        if (p1 != -1) {
+            net_shutdown(p1);
         }
-        if (!isdigit((unsigned char)c)) {
-            return RECV_BADFRAME; // length field must be digits
+        if (p2 != -1 && p2 != p1) {
+            net_shutdown(p2);
         }
-        have_digit = 1;
+        return NIM_WON;
     }
 
-    if (!have_digit) {
-        return RECV_BADFRAME; // empty length field
-    }
+    // Game continues, swap turn
+    int next = nim_other(player);
+    game_state_set(session, (next == 1) ? P1_TURN : P2_TURN);
 
-    //Must be two digits wide
-    if ((total - len_start - 1) != 2)  // -1 for end '|'
-        return RECV_BADFRAME;
+    // Spectators always get the text frame
+    char play_buf[MAX_MESSAGE_LEN + 1], play_bin[NGP_BIN_MAX];
+    int play_len = formatPlay(play_buf, next, session->board);
+    int bin_len = (seat_bin(session, 1) || seat_bin(session, 2)) ? formatPlayBin(play_bin, next, session->board) : 0;
 
-    // Parse length: from len_start up to (total - 1), since total-1 is the '|'
-    int msg_len = 0;
-    for (size_t i = len_start; i < total - 1; i++) {
-        msg_len = msg_len * 10 + (buf[i] - '0');
-        if (msg_len < 0) {
-            return RECV_BADFRAME; // overflow or nonsense
-        }
-    }
-    if (msg_len <= 0) {
-        return RECV_BADFRAME;
-    }
+    seat_write(session, 1, play_buf, play_len, play_bin, bin_len);
+    seat_write(session, 2, play_buf, play_len, play_bin, bin_len);
+    watch_publish(session, play_buf, play_len);
+
+    char text[BOARD_TEXT_LEN];
+    LOG_DEBUG("[GAME %d] -> PLAY whose_turn=%d board=%s", session->index, next, board_text(text, session->board));
+    return NIM_OK;
+}
+
+// Make the bot's move if it is the bot's turn; caller holds the game's lock
+// Returns NIM_WON when the bot took the last stone, else NIM_OK
+static int bot_play(Game *g)
+{
+    if (!g->bot || g->state != P2_TURN) return NIM_OK;
+    long pile = 0, qty = 0;
+    nim_bot_move(g->board, board_std ? STD_PILES : board_piles, bot_skill, &g->bot_rng, &pile, &qty);
+    LOG_DEBUG("[GAME %d][BOT] MOVE pile=%ld qty=%ld", g->index, pile, qty);
+    return game_move(g, 2, pile, qty) == NIM_WON ? NIM_WON : NIM_OK;
+}
+
+// Whether the have bytes at data start with a whole frame of c's protocol
+// The first byte c sends picks the protocol of everything after it: binary for NGP_BIN,
+// text for anything else, which the text framing then judges
+// Returns the frame length, 0 when more bytes are required, or RECV_BADFRAME
+static int frame_status(Conn *c, const char *data, size_t have, size_t bufsize)
+{
+    if (c->proto == 0 && have > 0) c->proto = data[0] == NGP_BIN ? NGP_BIN : NGP_TEXT;
+    return c->proto == NGP_BIN ? ngp_bin_frame_status(data, have) : ngp_frame_status(data, have, bufsize);
+}
+
+// Pops the next complete frame already sitting in c->rx into buf (NUL terminated)
+// Returns the frame length, 0 when rx only holds a partial frame, or RECV_BADFRAME
+int recv_next_frame(Conn *c, char *buf, size_t bufsize)
+{
+    RecvBuf *rx = &c->rx;
+    int status = frame_status(c, rx->data + rx->start, rx->end - rx->start, bufsize);
+    if (status <= 0) return status;
+
+    memcpy(buf, rx->data + rx->start, (size_t)status);
+    buf[status] = '\0';
+    rx->start += (size_t)status;
+    if (rx->start == rx->end) rx->start = rx->end = 0;
+    return status;
+}
 
-    if ((size_t)msg_len + total >= bufsize) {
-        // not enough room in buffer for payload + '\0'
-        return RECV_BADFRAME;
+// Check a frame in c's protocol and split it into msg, in place. Returns 0 if it is a valid
+// client frame
+static int parse_frame(const Conn *c, char *buf, int len, ParsedMsg *msg)
+{
+    if (c->proto == NGP_BIN) return ngp_bin_parse(buf, len, msg);
+    return parse_client_message(buf, msg);
+}
+
+// Slide the partial frame to the front so there is always room for a whole one
+static void recv_compact(RecvBuf *rx)
+{
+    if (rx->start > 0) {
+        memmove(rx->data, rx->data + rx->start, rx->end - rx->start);
+        rx->end -= rx->start;
+        rx->start = 0;
     }
+}
+
+// One read() for as many bytes as the kernel has, keeping the partial tail
+// Returns bytes read, RECV_EOF, RECV_SYSERR or RECV_AGAIN (non-blocking socket drained)
+int recv_fill(int sock, RecvBuf *rx)
+{
+    recv_compact(rx);
 
-    // 3) Read exactly msg_len payload bytes
-    size_t need = (size_t)msg_len;
-    while (need > 0) {
-        ssize_t n = read(sock, buf + total, need);
+    while (1) {
+        ssize_t n = read(sock, rx->data + rx->end, sizeof(rx->data) - rx->end);
         if (n == 0) {
-            return RECV_EOF;    // EOF mid-message
+            return RECV_EOF;    // connection closed
         } else if (n < 0) {
+            if (errno == EINTR && active) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return RECV_AGAIN;
             return RECV_SYSERR; // read error
         }
-        total += (size_t)n;
-        need  -= (size_t)n;
+        rx->end += (size_t)n;
+        return (int)n;
     }
+}
 
-    buf[total] = '\0';
+// Append bytes something else already received (io_uring provided buffers)
+// Returns n, or RECV_BADFRAME when they do not fit behind the unconsumed bytes
+int recv_push(RecvBuf *rx, const char *data, int n)
+{
+    recv_compact(rx);
+    if ((size_t)n > sizeof(rx->data) - rx->end) return RECV_BADFRAME;
+    memcpy(rx->data + rx->end, data, (size_t)n);
+    rx->end += (size_t)n;
+    return n;
+}
 
-    // 4) Spec requires payload end with '|' terminator
-    if (buf[total - 1] != '|') {
-        return RECV_BADFRAME;
+// Blocking read of the next NGP frame into buf (thread engine)
+// Frames that arrived together are served from the Conn's buffer without another syscall
+int recv_ngp_message(Conn *c, char *buf, size_t bufsize)
+{
+    while (1) {
+        int status = recv_next_frame(c, buf, bufsize);
+        if (status != 0) return status;
+
+        int n = recv_fill(c->sock, &c->rx);
+        if (n <= 0) return n;
     }
+}
+
+// Non-blocking version of recv_ngp_message for the event engine
+// Reads at most once per readable event, then hands out the frames that are already whole;
+// returns RECV_AGAIN once only a partial frame (or nothing) is left
+int recv_ngp_nonblock(Conn *c, char *buf, size_t bufsize, int *filled)
+{
+    while (1) {
+        int status = recv_next_frame(c, buf, bufsize);
+        if (status != 0) return status;
+
+        // Level triggered epoll calls us again if the kernel still has bytes
+        if (*filled) return RECV_AGAIN;
+        *filled = 1;
 
-    // Success: total = header + payload bytes
-    return (int)total;
+        int n = recv_fill(c->sock, &c->rx);
+        if (n <= 0) return n;
+    }
 }
 
 
-//Either Adds a game OR switches the game context to a previous stuck state I.E. someone waiting prior. Games that are ended are ended
-// Yes I know it O(N) time but I do not want to rewrite my code
-int addGame(Game ***sessions){
-    
-    pthread_mutex_lock(&registry_lock);
-
-    for (int i = 0; i <= cur_game_index; i++) {
-        Game *g = (*sessions)[i];
-        if (!g) continue;
-
-        if (g->state == AWAITING_FIRST_PLAYER || g->state == AWAITING_SECOND_PLAYER || g->state == GAME_OVER) 
-        {
-        // Found a waiting game.
-        // We want this game to become the "front" game at cur_game_index,
-        // since main() will use sessions[cur_game_index] for the new connection.
-            printf("[REGISTRY] Reusing game %d in state %s\n", g->index, state_to_str(g->state));
-
-            if (g->state == GAME_OVER) {
-                pthread_mutex_lock(&g->lock);
-                printf("[REGISTRY] Resetting GAME_OVER game %d\n", g->index);
-                resetGame(g);
-                pthread_mutex_unlock(&g->lock);
-            }
+// Game pool: games live in cache line aligned slabs that never move, addressed by slot
+// Growing adds one slab instead of reallocating, and empty games are kept on a
+// slot linked free list. Everything here is guarded by the registry's lock
+
+long long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void registry_init(Registry *reg, int id)
+{
+    memset(reg, 0, sizeof(*reg));
+    pthread_mutex_init(&reg->lock, NULL);
+    reg->pool.free_head = -1;
+    reg->id = id;
+}
+
+// Game at a pool slot
+Game *game_at(Registry *reg, int slot)
+{
+    return &reg->pool.slabs[slot / GAME_SLAB_SIZE][slot % GAME_SLAB_SIZE];
+}
+
+// Add one slab of games to the free list, caller holds reg->lock
+int pool_grow(Registry *reg)
+{
+    GamePool *pool = &reg->pool;
+    if (pool->nslabs == MAX_GAME_SLABS) return 1;
+
+    void *mem;
+    if (posix_memalign(&mem, CACHE_LINE, GAME_SLAB_SIZE * sizeof(Game)) != 0) {
+        return 1;
+    }
+
+    Game *slab = mem;
+    int base = pool->nslabs * GAME_SLAB_SIZE;
+    pool->slabs[pool->nslabs++] = slab;
+    metric_inc(MET_POOL_GROWS);
+
+    // Push in reverse so the lowest slot is handed out first
+    for (int i = GAME_SLAB_SIZE - 1; i >= 0; i--) {
+        Game *g = &slab[i];
+        gameInit(g);
+        g->reg = reg;
+        g->slot = base + i;
+        // Interleave shards so every game number is unique
+        g->index = g->slot * num_registries + reg->id;
+        g->next_free = pool->free_head;
+        g->mm_list = MM_FREE;
+        pool->free_head = g->slot;
+    }
+    reg->max_games = pool->nslabs * GAME_SLAB_SIZE;
+
+    LOG_INFO("[REGISTRY %d] Pool grew to %d games in %d slab(s) (%d in use)", reg->id, reg->max_games, pool->nslabs, pool->in_use);
+    return 0;
+}
 
-            if (i != cur_game_index) {
+// Take an empty game, growing the pool if needed; NULL when out of memory
+Game *pool_get(Registry *reg)
+{
+    GamePool *pool = &reg->pool;
+    if (pool->free_head == -1 && pool_grow(reg)) return NULL;
+
+    Game *g = game_at(reg, pool->free_head);
+    pool->free_head = g->next_free;
+    g->next_free = -1;
+    g->mm_list = MM_NONE;
+    pool->in_use++;
+    __atomic_add_fetch(&games_live, 1, __ATOMIC_RELAXED);
+    return g;
+}
 
-                printf("[REGISTRY] Swapped game %d with game %d; cur_game_index=%d\n", i, cur_game_index, cur_game_index);
+// Return an empty game to its pool, most recently used games are reused first
+void pool_put(Game *g)
+{
+    GamePool *pool = &g->reg->pool;
+    g->next_free = pool->free_head;
+    g->mm_list = MM_FREE;
+    pool->free_head = g->slot;
+    pool->in_use--;
+    __atomic_sub_fetch(&games_live, 1, __ATOMIC_RELAXED);
+}
 
-                Game *cur = (*sessions)[cur_game_index];
+// Make sure at least n games exist before the first player shows up
+int pool_prealloc(Registry *reg, int n)
+{
+    int failed = 0;
+    pthread_mutex_lock(&reg->lock);
+    while (!failed && reg->max_games < n) {
+        failed = pool_grow(reg);
+    }
+    pthread_mutex_unlock(&reg->lock);
+    return failed;
+}
 
-                // swap positions
-                (*sessions)[cur_game_index] = g;
-                g->index = cur_game_index;
+// Pool occupancy for reporting
+void pool_stats(Registry *reg, int *in_use, int *capacity)
+{
+    pthread_mutex_lock(&reg->lock);
+    *in_use = reg->pool.in_use;
+    *capacity = reg->max_games;
+    pthread_mutex_unlock(&reg->lock);
+}
 
-                (*sessions)[i] = cur;
-                cur->index = i;
+// Gauges for the metrics exposition: live games per state and pool capacity
+// Slabs never move and are only freed at exit, so they are walked without the registry
+// lock and no game is held up; the counts are a snapshot, not a consistent cut
+int pool_gauges(char *buf, int cap)
+{
+    long by_state[NUM_STATES] = { 0 };
+    long max_games = 0;
+
+    for (int i = 0; i < num_registries; i++) {
+        Registry *reg = shards ? &shards[i] : &registry;
+        pthread_mutex_lock(&reg->lock);
+        int nslabs = reg->pool.nslabs;
+        max_games += reg->max_games;
+        pthread_mutex_unlock(&reg->lock);
+
+        for (int s = 0; s < nslabs; s++) {
+            Game *slab = reg->pool.slabs[s];
+            for (int k = 0; k < GAME_SLAB_SIZE; k++) {
+                if (__atomic_load_n(&slab[k].mm_list, __ATOMIC_RELAXED) == MM_FREE) continue;
+                int state = __atomic_load_n(&slab[k].state, __ATOMIC_RELAXED);
+                if (state >= 0 && state < NUM_STATES) by_state[state]++;
             }
+        }
+    }
 
-            pthread_mutex_unlock(&registry_lock);
-            return 0;
+    int pos = snprintf(buf, cap, "# HELP nimd_games Games off the free lists, by state\n# TYPE nimd_games gauge\n");
+    for (int st = 0; st < NUM_STATES && pos < cap; st++) {
+        pos += snprintf(buf + pos, cap - pos, "nimd_games{state=\"%s\"} %ld\n", state_to_str(st), by_state[st]);
+    }
+    if (pos < cap) {
+        pos += snprintf(buf + pos, cap - pos, "# HELP nimd_max_games Games the pools can hold without growing\n# TYPE nimd_max_games gauge\nnimd_max_games %ld\n", max_games);
+    }
+    if (pos < cap) {
+        pos += snprintf(buf + pos, cap - pos, "# HELP nimd_connections_pending Connections that have not OPENed yet\n# TYPE nimd_connections_pending gauge\nnimd_connections_pending %d\n",
+                        __atomic_load_n(&conns_pending, __ATOMIC_RELAXED));
+    }
+    return pos < cap ? pos : cap - 1;
+}
+
+void pool_destroy(Registry *reg)
+{
+    GamePool *pool = &reg->pool;
+    for (int s = 0; s < pool->nslabs; s++) {
+        for (int i = 0; i < GAME_SLAB_SIZE; i++) {
+            pthread_mutex_destroy(&pool->slabs[s][i].lock);
         }
+        free(pool->slabs[s]);
+    }
+    pool->nslabs = 0;
 }
 
-    if (cur_game_index == max_games - 1) {
-        printf("[REGISTRY] Resized sessions: old max=%d new max=%d\n", max_games / 2, max_games);
+// Waiting queue, guarded by the registry's lock
+// Lock order is always a registry lock, then a Game's lock. A shard that needs two
+// registries takes the higher numbered shard first
 
-        int new_max = max_games * 2;
-        Game **tmp = realloc(*sessions, new_max * sizeof(Game *));
-        if(tmp == NULL) {
-            pthread_mutex_unlock(&registry_lock);
-            return 1;
-        }
-        *sessions = tmp;
-        max_games = new_max;
+static unsigned long open_seq_next; // Hands out p1_open_seq / p2_open_seq
+
+static void list_push(GameList *l, Game *g)
+{
+    g->mm_list = MM_WAITING;
+    g->waiting_since = now_ms();
+    g->mm_prev = l->tail;
+    g->mm_next = NULL;
+    if (l->tail) l->tail->mm_next = g;
+    else l->head = g;
+    l->tail = g;
+    __atomic_store_n(&l->count, l->count + 1, __ATOMIC_RELAXED);
+}
+
+static void list_remove(GameList *l, Game *g)
+{
+    if (g->mm_prev) g->mm_prev->mm_next = g->mm_next;
+    else l->head = g->mm_next;
+    if (g->mm_next) g->mm_next->mm_prev = g->mm_prev;
+    else l->tail = g->mm_prev;
+
+    g->mm_prev = g->mm_next = NULL;
+    g->mm_list = MM_NONE;
+    __atomic_store_n(&l->count, l->count - 1, __ATOMIC_RELAXED);
+}
+
+// Put c in seat (1 or 2) of g, which is how c learns its role; caller holds g's lock
+// Every seating and remap goes through here, so a connection never needs the lock to know
+// which player it is
+static void seat_take(Game *g, int seat, Conn *c)
+{
+    if (seat == 1) {
+        g->p1_s = c->sock;
+        g->p1_c = c;
+    } else {
+        g->p2_s = c->sock;
+        g->p2_c = c;
     }
+    __atomic_store_n(&c->seat, seat, __ATOMIC_RELEASE);
+}
 
-    Game *newSession = malloc(sizeof(Game));
-    if(newSession == NULL) {
-        pthread_mutex_unlock(&registry_lock);
-        return 1;
+// Attach a freshly accepted connection to a game in O(1):
+// the oldest game with one player, else an empty game from the pool
+// Claims the player slot before returning; NULL if no game could be made
+Game *mm_join(Registry *reg, Conn *c, int *player)
+{
+    pthread_mutex_lock(&reg->lock);
+
+    Game *g = reg->waiting.head;
+    if (g) {
+        list_remove(&reg->waiting, g);
+    } else if (limit_games > 0 && __atomic_load_n(&games_live, __ATOMIC_RELAXED) >= limit_games) {
+        // Joining a waiting game is always fine, only a new one is refused
+        pthread_mutex_unlock(&reg->lock);
+        metric_inc(MET_SHED_GAMES);
+        return NULL;
+    } else if ((g = pool_get(reg)) == NULL) {
+        pthread_mutex_unlock(&reg->lock);
+        return NULL;
     }
 
-    gameInit(newSession);
-    
-    cur_game_index += 1;
-    newSession->index = cur_game_index;
-    
-    printf("[REGISTRY] Created new game %d; total games now: %d (max_games=%d)\n", newSession->index, cur_game_index + 1, max_games);
+    pthread_mutex_lock(&g->lock);
+    if (g->state == AWAITING_SECOND_PLAYER) {
+        // Game is ready to start
+        seat_take(g, 2, c);
+        game_state_set(g, GAME_START);
+        *player = 2;
+    } else {
+        seat_take(g, 1, c);
+        game_state_set(g, AWAITING_SECOND_PLAYER);
+        list_push(&reg->waiting, g);
+        *player = 1;
+    }
+    pthread_mutex_unlock(&g->lock);
 
-    (*sessions)[cur_game_index] = newSession;
+    pthread_mutex_unlock(&reg->lock);
+    return g;
+}
 
-    pthread_mutex_unlock(&registry_lock);
+// Put a game back where matchmaking can find it after a player left
+void mm_update(Game *g)
+{
+    Registry *reg = g->reg;
+    pthread_mutex_lock(&reg->lock);
+    pthread_mutex_lock(&g->lock);
+
+    int want = MM_NONE;
+    if (g->state == AWAITING_SECOND_PLAYER) {
+        want = MM_WAITING;
+    } else if (g->state == AWAITING_FIRST_PLAYER) {
+        want = MM_FREE;
+    } else if (g->state == GAME_OVER && g->p1_s == -1 && g->p2_s == -1 && g->nwatchers == 0) {
+        // Both players and every spectator are gone, the game can be handed out again
+        LOG_DEBUG("[REGISTRY %d] Resetting GAME_OVER game %d", reg->id, g->index);
+        resetGame(g);
+        want = MM_FREE;
+    }
 
-    return 0;
+    if (g->mm_list != want) {
+        if (g->mm_list == MM_WAITING) list_remove(&reg->waiting, g);
+        if (want == MM_WAITING) list_push(&reg->waiting, g);
+        else if (want == MM_FREE) pool_put(g);
+    }
+
+    pthread_mutex_unlock(&g->lock);
+    pthread_mutex_unlock(&reg->lock);
 }
 
-//free one game at index
-void gameDestroyOne(int index) {
-    Game *session = sessions[index];
-    
-    printf("[REGISTRY] Destroying game %d\n", index);
+// Move the lone player of waiting game from into waiting game to, seated by OPEN order
+// Caller holds both registries' locks and owns the player's connection, so nothing
+// else touches it while its session changes. Returns the moved connection, or NULL
+static Conn *mm_move(Game *from, Game *to, struct EventLoop *loop)
+{
+    Conn *moved = NULL;
+    pthread_mutex_lock(&from->lock);
+    pthread_mutex_lock(&to->lock);
+
+    Conn *c = from->p1_c;
+    if (from->state == AWAITING_SECOND_PLAYER && to->state == AWAITING_SECOND_PLAYER &&
+        c != NULL && c->owner == loop) {
+        // Whoever sent OPEN first plays first, as if both had joined the same shard
+        unsigned long from_seq = from->p1_name[0] ? from->p1_open_seq : ULONG_MAX;
+        unsigned long to_seq = to->p1_name[0] ? to->p1_open_seq : ULONG_MAX;
+        if (from_seq < to_seq) {
+            // to's P1 becomes its P2, seat_take tells that connection
+            seat_take(to, 2, to->p1_c);
+            memcpy(to->p2_name, to->p1_name, sizeof(to->p2_name));
+            seat_take(to, 1, c);
+            memcpy(to->p1_name, from->p1_name, sizeof(to->p1_name));
+            to->p2_open_seq = to->p1_open_seq;
+            to->p1_open_seq = from->p1_open_seq;
+        } else {
+            seat_take(to, 2, c);
+            memcpy(to->p2_name, from->p1_name, sizeof(to->p2_name));
+            to->p2_open_seq = from->p1_open_seq;
+        }
+        game_state_set(to, GAME_START);
+        list_remove(&to->reg->waiting, to);
+
+        from->p1_s = -1;
+        from->p1_c = NULL;
+        from->p1_name[0] = '\0';
+        game_state_set(from, AWAITING_FIRST_PLAYER);
+        list_remove(&from->reg->waiting, from);
+        pool_put(from);
+
+        c->session = to;
+        moved = c;
+        LOG_DEBUG("[REGISTRY %d] Moved waiting socket %d from game %d to game %d", from->reg->id, c->sock, from->index, to->index);
+    }
+
+    pthread_mutex_unlock(&to->lock);
+    pthread_mutex_unlock(&from->lock);
+    return moved;
+}
 
-    if (!session) return;
+// Seat the bot as P2 of a waiting game whose P1 has OPENed and start it
+// Caller holds the registry's lock and the game's; mine is as for send_start
+// Returns 1 if the game started
+static int bot_start(Game *g, int sock, OutBatch *mine)
+{
+    if (g->state != AWAITING_SECOND_PLAYER || g->mm_list != MM_WAITING || g->p1_name[0] == '\0') return 0;
+    list_remove(&g->reg->waiting, g);
 
-    pthread_mutex_destroy(&session->lock);
-    free(session);
-    sessions[index] = NULL;
+    g->p2_s = -1;
+    g->p2_c = NULL;
+    strcpy(g->p2_name, BOT_NAME);
+    g->p2_open_seq = 0;
+    g->bot = 1;
+    g->bot_rng = (uint32_t)now_ns() ^ ((uint32_t)g->index * 2654435761u);
+    if (g->bot_rng == 0) g->bot_rng = 1;
+    game_state_set(g, GAME_START);
+    game_begin(g, sock, mine);
+
+    LOG_DEBUG("[GAME %d] P1 plays the bot", g->index);
+    metric_inc(MET_BOT_GAMES);
+    return 1;
 }
 
+// The bot takes on every player in reg who has waited bot_wait_ms for a human
+// The waiting queue is oldest first, so the walk stops at the first one still in time
+static void bot_sweep(Registry *reg)
+{
+    if (__atomic_load_n(&reg->waiting.count, __ATOMIC_RELAXED) == 0) return;
+
+    long long now = now_ms();
+    pthread_mutex_lock(&reg->lock);
+    Game *next;
+    for (Game *g = reg->waiting.head; g != NULL && now - g->waiting_since >= bot_wait_ms; g = next) {
+        next = g->mm_next;
+        game_lock(g);
+        // One that has not OPENed yet stays, whatever its wait
+        bot_start(g, -1, NULL);
+        pthread_mutex_unlock(&g->lock);
+    }
+    pthread_mutex_unlock(&reg->lock);
+}
 
 //For Graceful shutdowns
 void handler(int signum)
@@ -660,6 +1784,18 @@ void handler(int signum)
     active = 0;
 }
 
+void dump_handler(int signum)
+{
+    metrics_request_dump();
+}
+
+void upgrade_handler(int signum)
+{
+    upgrade_requested = 1;
+    // Only a signal to main itself cuts its accept short
+    if (!pthread_equal(pthread_self(), main_tid)) pthread_kill(main_tid, SIGUSR2);
+}
+
 void
 install_handlers(void)
 {
@@ -672,415 +1808,2294 @@ install_handlers(void)
 
     sigaction(SIGINT, &act, NULL);
     sigaction(SIGTERM, &act, NULL);
+
+    // A metrics dump must not cut a blocking read short, so this one restarts syscalls
+    struct sigaction dump;
+    dump.sa_handler = dump_handler;
+    dump.sa_flags = SA_RESTART;
+    sigemptyset(&dump.sa_mask);
+    sigaction(SIGUSR1, &dump, NULL);
+
+    // An upgrade is run by main, which must wake up for it
+    struct sigaction upgrade;
+    upgrade.sa_handler = upgrade_handler;
+    upgrade.sa_flags = 0;
+    sigemptyset(&upgrade.sa_mask);
+    sigaction(SIGUSR2, &upgrade, NULL);
 }
 
-// Handles Game Connections per Socket
-//One of the two connections is responsible for starting the game for the players
-void handle_connection(int sock, struct sockaddr *rem, socklen_t rem_len, Game *session)
+// Give back what admit reserved; pending is 0 once the connection has OPENed
+static void admit_undo(int pending)
+{
+    __atomic_sub_fetch(&conns_live, 1, __ATOMIC_RELAXED);
+    if (pending) __atomic_sub_fetch(&conns_pending, 1, __ATOMIC_RELAXED);
+}
+
+// Reserve room for one more connection, still without an OPEN
+// Returns -1 when admitted, otherwise the shed counter of the limit it ran into
+static int admit(void)
 {
-    char buf[MAX_MESSAGE_LEN + 1], host[HOSTSIZE], port[PORTSIZE];
-    int bytes = 0, error;
-    int have_open = 0;  // has this client sent a successful OPEN?
+    int conns = __atomic_add_fetch(&conns_live, 1, __ATOMIC_RELAXED);
+    int pending = __atomic_add_fetch(&conns_pending, 1, __ATOMIC_RELAXED);
+    int shed = -1;
+    if (limit_conns > 0 && conns > limit_conns) shed = MET_SHED_CONNS;
+    else if (limit_pending > 0 && pending > limit_pending) shed = MET_SHED_PENDING;
+    if (shed >= 0) admit_undo(1);
+    return shed;
+}
 
-    error = getnameinfo(rem, rem_len, host, HOSTSIZE, port, PORTSIZE, NI_NUMERICSERV);
-    if (error) {
-        fprintf(stderr, "getnameinfo: %s\n", gai_strerror(error));
-        strcpy(host, "??");
-        strcpy(port, "??");
+// Connection deadlines: until its OPEN a connection has open_timeout_ms from accept, after
+// that every frame buys it another idle_timeout_ms. A frame only stamps frame_ms; when the
+// timer fires, conn_expired moves it to the deadline the last frame set, if that is still
+// ahead. A loop keeps the deadlines of the connections it drives on its own wheel; the
+// thread engine shares one, ticked by its own thread
+TimerWheel conn_wheel;
+pthread_mutex_t conn_wheel_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t conn_timer_tid;
+
+void session_close(Conn *c);
+static void uring_conn_end(Conn *c);
+
+// The wheel c's timer lives on, locked when other threads use it too
+static TimerWheel *conn_wheel_get(Conn *c)
+{
+    if (c->owner == NULL) {
+        pthread_mutex_lock(&conn_wheel_lock);
+        return &conn_wheel;
+    }
+    if (c->owner->wheel_shared) pthread_mutex_lock(&c->owner->wheel_lock);
+    return &c->owner->wheel;
+}
+
+static void conn_wheel_put(Conn *c)
+{
+    if (c->owner == NULL) pthread_mutex_unlock(&conn_wheel_lock);
+    else if (c->owner->wheel_shared) pthread_mutex_unlock(&c->owner->wheel_lock);
+}
+
+// When c's next frame is due, 0 for never
+static long long conn_deadline(Conn *c)
+{
+    if (c->watching) return 0;
+    if (!c->have_open) return open_timeout_ms > 0 ? (long long)(c->accepted_ns / 1000000) + open_timeout_ms : 0;
+    return idle_timeout_ms > 0 ? now_ms() + idle_timeout_ms : 0;
+}
+
+// Arm, push back or drop c's deadline to match its state
+static void conn_timer_arm(Conn *c)
+{
+    long long when = conn_deadline(c);
+    TimerWheel *w = conn_wheel_get(c);
+    if (when > 0) timer_arm(w, &c->timer, when);
+    else timer_cancel(w, &c->timer);
+    conn_wheel_put(c);
+}
+
+static void conn_timer_stop(Conn *c)
+{
+    // A loop's connections are only armed by that loop (or by main before handing them over),
+    // and an expiring timer is already disarmed when its callback cleans the connection up
+    if (c->owner != NULL && !timer_armed(&c->timer)) return;
+    TimerWheel *w = conn_wheel_get(c);
+    timer_cancel(w, &c->timer);
+    conn_wheel_put(c);
+}
+
+// Runs on the thread that advances c's wheel, with the wheel locked if it is shared
+static void conn_expired(Timer *t)
+{
+    Conn *c = t->data;
+    Game *session = c->session;
+    TimerWheel *w = c->owner != NULL ? &c->owner->wheel : &conn_wheel;
+
+    if (c->have_open) {
+        long long now = now_ms();
+        long long due = __atomic_load_n(&c->frame_ms, __ATOMIC_RELAXED) + idle_timeout_ms;
+        if (due > now) {
+            // Frames came in since the timer was armed
+            timer_arm(w, t, due);
+            return;
+        }
+        // Nothing is expected from a player still waiting for an opponent
+        int state = game_state(session);
+        if (state == AWAITING_SECOND_PLAYER || state == GAME_START || state == RESUMING) {
+            timer_arm(w, t, now + idle_timeout_ms);
+            return;
+        }
+    }
+
+    LOG_INFO("[GAME %d] Socket %d sent no %s in time, disconnecting", session->index, c->sock, c->have_open ? "frame" : "OPEN");
+    metric_inc(c->have_open ? MET_TIMEOUTS_IDLE : MET_TIMEOUTS_OPEN);
+
+    if (c->owner == NULL) {
+        // Its thread is blocked in recv; waking it with EOF runs the usual disconnect cleanup
+        __atomic_store_n(&c->expired, 1, __ATOMIC_RELAXED);
+        shutdown(c->sock, SHUT_RDWR);
+        return;
     }
 
-    printf("[GAME %d] New connection thread started for socket %d from %s:%s\n", session->index, sock, host, port);
+    // Same as the peer hanging up
+    c->bytes = RECV_EOF;
+    if (engine == ENGINE_URING) {
+        uring_conn_end(c);
+    } else {
+        session_close(c);
+        free(c);
+    }
+}
 
+// Thread engine: connection threads sit in recv, so the shared wheel gets a thread of its own
+void *conn_timer_thread(void *arg)
+{
+    (void)arg;
+    struct timespec tick = { 0, TIMER_TICK_MS * 1000000L };
     while (active) {
-        
-        bytes = recv_ngp_message(sock, buf, sizeof(buf));
+        nanosleep(&tick, NULL);
+        pthread_mutex_lock(&conn_wheel_lock);
+        timer_advance(&conn_wheel, now_ms());
+        pthread_mutex_unlock(&conn_wheel_lock);
+        if (bot_wait_ms > 0) bot_sweep(&registry);
+    }
+    return NULL;
+}
 
-          // Figure out if this socket is currently player 1 or 2 (handles the rare remap case)
-        int player = 0;
-        pthread_mutex_lock(&session->lock);
-        if (sock == session->p1_s) player = 1;
-        else if (sock == session->p2_s) player = 2;
-        pthread_mutex_unlock(&session->lock);
+// Fire a loop's due deadlines, between events
+static void loop_timers(EventLoop *loop)
+{
+    if (loop->wheel_shared) pthread_mutex_lock(&loop->wheel_lock);
+    timer_advance(&loop->wheel, now_ms());
+    if (loop->wheel_shared) pthread_mutex_unlock(&loop->wheel_lock);
+}
 
-        if (player == 0) {
-            // Socket no longer belongs to this game
-            bytes = 0;
-            break;
+// Take sock's seat in a game that has not started, caller holds the game's lock
+// mm_update then puts the game where it belongs now
+static void seat_vacate(Game *session, int sock)
+{
+    if (session->state == AWAITING_SECOND_PLAYER) {
+        // Means their was only one player in the game
+        // We can just remove the player and do nothing
+        game_state_set(session, AWAITING_FIRST_PLAYER);
+
+        if (sock == session->p1_s) {
+            session->p1_s = -1;
+            session->p1_c = NULL;
+            session->p1_name[0] = '\0';
+            session->p1_t = 0;
         }
 
-        // After determining 'player' (1 or 2)
-        printf("[GAME %d] Socket %d identified as Player %d (state=%s)\n", session->index, sock, player, state_to_str(session->state));
+    } else if (session->state == GAME_START) {
+        // This is the very RARE case where this happens
+        /*
+        player 1 Connects ->
+        player 1 sends name ->
+        <- wait player 1
+        player 2 Connects ->
+        player 1 disconnects ->
+        Game state is in GAME_START but player 1 disconnected
+        move player 2 to player 1, change the GAME_STAT,
+        player 1(2) Sends Name ->
+        <- wait player 1(2)
+        */
 
-        if (bytes == RECV_EOF || bytes == RECV_SYSERR) {
-            // normal cleanup will handle this
-            break;
+        if (sock == session->p1_s) {
+            // move socket / thread; seat_take tells P2's connection it is P1 now
+            seat_take(session, 1, session->p2_c);
+            session->p1_t = session->p2_t;
+
+            // safely move name p2 -> p1
+            memmove(session->p1_name, session->p2_name, sizeof(session->p1_name));
+            session->p1_open_seq = session->p2_open_seq;
+
+            // make sure it's null-terminated
+            session->p1_name[sizeof(session->p1_name) - 1] = '\0';
         }
-        if (bytes == RECV_BADFRAME) {
-            
-            if (player != 0) {
-                send_fail_and_maybe_forfeit(session, sock, player, 10, "Invalid", NULL);
-            }
-            bytes = 0; // so cleanup code treats as EOF/close
-            break;
+        // Seat 2 is empty whoever left. A name left behind by a P2 that OPENed and went
+        // would let maybe_start_game start P1's game against nobody
+        session->p2_s = -1;
+        session->p2_c = NULL;
+        session->p2_t = 0;
+        session->p2_name[0] = '\0';
+        game_state_set(session, AWAITING_SECOND_PLAYER);
+    }
+}
+
+// Give up the seat matchmaking handed c at accept, c is about to go to another game
+static void seat_release(Conn *c)
+{
+    Game *from = c->session;
+    game_lock(from);
+    if (from->state == AWAITING_SECOND_PLAYER || from->state == GAME_START) {
+        seat_vacate(from, c->sock);
+    } else if (c->sock == from->p1_s) {
+        from->p1_s = -1;
+        from->p1_c = NULL;
+    } else if (c->sock == from->p2_s) {
+        from->p2_s = -1;
+        from->p2_c = NULL;
+    }
+    pthread_mutex_unlock(&from->lock);
+    mm_update(from);
+}
+
+// Crash recovery: the snapshot writer keeps the games in play in the snapshot file, a pass
+// every SNAPSHOT_MS for the games marked since the last one. A restart with -r maps the old
+// file and restores a game only when one of its players OPENs under a saved name; the game
+// resumes once the other is back too, or ends when the reattach window closes
+
+// A restored game and its snapshot key, kept until the window closes so a game that resumed
+// or ended is never restored twice
+typedef struct Resume {
+    uint64_t key;
+    Game *game; // NULL once it resumed or ended
+    struct Resume *next;
+} Resume;
+
+static Resume *resume_map[RESUME_BUCKETS]; // Guarded by resume_lock, as is the old snapshot
+static pthread_mutex_t resume_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_t snapshot_tid;
+static uint64_t snap_key_next; // Snapshot writer only
+static int snap_stop; // Stops the writer before shutdown, for an upgrade
+
+static Resume *resume_find(uint64_t key)
+{
+    Resume *r = resume_map[key % RESUME_BUCKETS];
+    while (r != NULL && r->key != key) r = r->next;
+    return r;
+}
+
+// Rebuild a saved game in reg with nobody seated yet
+static Game *game_restore(Registry *reg, const SnapEntry *e)
+{
+    pthread_mutex_lock(&reg->lock);
+    Game *g = pool_get(reg);
+    pthread_mutex_unlock(&reg->lock);
+    if (g == NULL) return NULL;
+
+    game_lock(g);
+    for (int i = 0; i < board_piles; i++) g->board[i] = e->board[i];
+    memcpy(e->seat == 1 ? g->p1_name : g->p2_name, e->name, sizeof(g->p1_name));
+    memcpy(e->seat == 1 ? g->p2_name : g->p1_name, e->opponent, sizeof(g->p1_name));
+    g->p1_s = g->p2_s = -1;
+    g->p1_c = g->p2_c = NULL;
+    game_state_enter(g, RESUMING);
+    g->resume_turn = e->turn;
+    g->resume_key = e->game;
+    g->bot = e->bot;
+    g->bot_rng = (uint32_t)now_ns() | 1;
+    g->journal_id = e->journal_id;
+    g->journal_seq = e->journal_seq;
+    g->snap_round++;
+    snap_mark(g);
+    pthread_mutex_unlock(&g->lock);
+
+    LOG_INFO("[GAME %d] Restored game P1='%s' P2='%s' from the snapshot", g->index, g->p1_name, g->p2_name);
+    return g;
+}
+
+// c just OPENed as name; if name was in a game when the previous run died, seat c back in it
+// Returns that game, now c's session, or NULL when c stays where matchmaking put it
+static Game *reattach(Conn *c, const char *name)
+{
+    if (__atomic_load_n(&resume_until, __ATOMIC_ACQUIRE) == 0) return NULL;
+
+    pthread_mutex_lock(&resume_lock);
+    SnapEntry e;
+    // A board of another size is no game this server can play
+    if (resume_until == 0 || now_ms() >= resume_until || snapshot_find(name, &e) != 0 || e.piles != board_piles) {
+        pthread_mutex_unlock(&resume_lock);
+        return NULL;
+    }
+
+    Game *from = c->session;
+    Resume *r = resume_find(e.game);
+    if (r == NULL && (r = calloc(1, sizeof(Resume))) != NULL) {
+        // First of the two back: the game comes back in this player's registry
+        r->key = e.game;
+        r->game = game_restore(from->reg, &e);
+        r->next = resume_map[e.game % RESUME_BUCKETS];
+        resume_map[e.game % RESUME_BUCKETS] = r;
+    }
+
+    Game *g = r != NULL ? r->game : NULL;
+    int seated = 0;
+    if (g != NULL) {
+        game_lock(g);
+        if (g->state != RESUMING || g->resume_key != e.game) {
+            r->game = NULL;
+        } else if ((e.seat == 1 || e.seat == 2) && (e.seat == 1 ? g->p1_c : g->p2_c) == NULL) {
+            seat_take(g, e.seat, c);
+            seated = 1;
         }
-        buf[bytes] = '\0';
-        printf("[%s:%s] read %d bytes {%s} | Game Index [%d] \n", host, port, bytes, buf, session->index);
+        pthread_mutex_unlock(&g->lock);
+    }
+    pthread_mutex_unlock(&resume_lock);
+    if (!seated) return NULL;
+
+    seat_release(c);
+    c->session = g;
+    LOG_INFO("[GAME %d] '%s' reattached as P%d", g->index, name, e.seat);
+    metric_inc(MET_REATTACHED);
+    return g;
+}
 
-        ParsedMsg msg;
-        if (parse_client_message(buf, &msg) != 0) {
-            // FAIL 10 Invalid, and if game started, opponent wins by forfeit
-            send_fail_and_maybe_forfeit(session, sock, player, 10, "Invalid", &bytes);
-            break;
+// Put a restored game back in play once both players are seated again
+// mine is as for send_start; returns 1 if the game resumed
+static int resume_game(Game *g, int sock, OutBatch *mine)
+{
+    int resumed = 0;
+    pthread_mutex_lock(&resume_lock);
+    game_lock(g);
+    if (g->state == RESUMING && g->p1_c != NULL && (g->p2_c != NULL || g->bot)) {
+        Resume *r = resume_find(g->resume_key);
+        if (r != NULL) r->game = NULL;
+
+        game_state_set(g, g->resume_turn == 1 ? P1_TURN : P2_TURN);
+        if (journal_on && g->journal_id == 0) {
+            // The previous run had no journal, the game starts in this one
+            g->journal_id = journal_game_id();
+            g->journal_seq = 0;
+            journal_start(g->journal_id, &g->journal_seq, g->p1_name, g->p2_name);
         }
+        snap_mark(g);
 
-        printf("[GAME %d][P%d] Received type=%s with %d field(s)\n", session->index, player, msg.type, msg.field_count);
-        for (int i = 0; i < msg.field_count; i++) {
-            printf("    field[%d] = '%s'\n", i, msg.fields[i]);
+        send_start(g, sock, mine, g->resume_turn);
+        if (g->bot && g->resume_turn == 2) {
+            // The bot's answer goes out behind the frames above
+            if (mine != NULL) out_flush(sock, mine);
+            bot_play(g);
         }
 
+        LOG_INFO("[GAME %d] Resuming game: P1='%s' P2='%s', P%d to move", g->index, g->p1_name, g->p2_name, g->resume_turn);
+        metric_inc(MET_RESUMED);
+        resumed = 1;
+    }
+    pthread_mutex_unlock(&g->lock);
+    pthread_mutex_unlock(&resume_lock);
+    return resumed;
+}
 
-        // ---------- FIRST MESSAGE MUST BE OPEN ----------
-        if (!have_open) {
-            if (strcmp(msg.type, "OPEN") != 0) {
-                // First valid payload but not OPEN -> FAIL 24 Not Playing
-                send_fail_and_maybe_forfeit(session, sock, player, 24, "Not Playing", &bytes);
-                break;
-            }
+// The window closed with g still missing a player: whoever came back wins by forfeit
+static void resume_abandon(Game *g, uint64_t key)
+{
+    pthread_mutex_lock(&g->lock);
+    if (g->state != RESUMING || g->resume_key != key) {
+        pthread_mutex_unlock(&g->lock);
+        return;
+    }
 
-            if (msg.field_count < 1 || !msg.fields[0]) {
-                send_fail_and_maybe_forfeit(session, sock, player, 10, "Invalid", &bytes);
-                break;
-            }
+    int winner = g->p1_c != NULL ? 1 : g->p2_c != NULL ? 2 : 0;
+    if (winner != 0) {
+        int sock = winner == 1 ? g->p1_s : g->p2_s;
+        char buf[MAX_MESSAGE_LEN + 1], bin[NGP_BIN_MAX];
+        int len, bin_len;
+        over_encode(g, 1, winner, buf, &len, bin, &bin_len);
+        seat_write(g, winner, buf, len, bin, bin_len);
+        net_shutdown(sock);
+        LOG_INFO("[GAME %d] P%d did not reattach in time; P%d wins.", g->index, winner == 1 ? 2 : 1, winner);
+        metric_inc(MET_WINS_FORFEIT);
+    } else {
+        LOG_INFO("[GAME %d] Neither player reattached in time, dropping the restored game", g->index);
+    }
+    if (journal_on && g->journal_id != 0) journal_over(g->journal_id, &g->journal_seq, winner, winner != 0, g->board);
+    game_state_set(g, GAME_OVER);
+    snap_mark(g);
+    pthread_mutex_unlock(&g->lock);
 
-            char *name = msg.fields[0];
-            size_t name_len = strlen(name);
-            if (name_len == 0 || name_len > 72) {
-                // FAIL 21 Long Name
-                send_fail_and_maybe_forfeit(session, sock, player, 21, "Long Name", &bytes);
-                break;
-            }
+    // The winner's cleanup frees the game, otherwise nobody is left to
+    if (winner == 0) mm_update(g);
+}
 
-            // Already in another game? → FAIL 22 Already Playing
-            if (name_in_use(name)) {
-                send_fail_and_maybe_forfeit(session, sock, player, 22, "Already Playing", &bytes);
-                break;
-            }
+static void resume_expire(void)
+{
+    if (resume_until == 0 || now_ms() < resume_until) return;
+
+    pthread_mutex_lock(&resume_lock);
+    int restored = 0;
+    for (int b = 0; b < RESUME_BUCKETS; b++) {
+        while (resume_map[b] != NULL) {
+            Resume *r = resume_map[b];
+            resume_map[b] = r->next;
+            if (r->game != NULL) resume_abandon(r->game, r->key);
+            free(r);
+            restored++;
+        }
+    }
+    __atomic_store_n(&resume_until, 0, __ATOMIC_RELEASE);
+    snapshot_release();
+    pthread_mutex_unlock(&resume_lock);
 
-            // Store the name into the Game
-            pthread_mutex_lock(&session->lock);
-            if (player == 1) {
-                strncpy(session->p1_name, name, 72);
-                session->p1_name[72] = '\0';
-            } else {
-                strncpy(session->p2_name, name, 72);
-                session->p2_name[72] = '\0';
+    LOG_INFO("[RESTORE] Reattach window closed, %d game(s) were restored", restored);
+}
+
+// Bring g's entries in the snapshot up to date
+static void snap_write(Game *g)
+{
+    SnapEntry e[2];
+    memset(e, 0, sizeof(e));
+
+    // Not game_lock, the lock wait histogram is about the players
+    pthread_mutex_lock(&g->lock);
+    int state = g->state;
+    int live = state == P1_TURN || state == P2_TURN || state == RESUMING;
+    unsigned round = g->snap_round;
+    if (live) {
+        int turn = state == RESUMING ? g->resume_turn : state == P1_TURN ? 1 : 2;
+        for (int p = 0; p < 2; p++) {
+            e[p].seat = (uint8_t)(p + 1);
+            e[p].turn = (uint8_t)turn;
+            e[p].piles = (uint8_t)board_piles;
+            for (int i = 0; i < board_piles; i++) e[p].board[i] = (uint8_t)g->board[i];
+            e[p].journal_id = g->journal_id;
+            e[p].journal_seq = g->journal_seq;
+            memcpy(e[p].name, p == 0 ? g->p1_name : g->p2_name, sizeof(e[p].name));
+            memcpy(e[p].opponent, p == 0 ? g->p2_name : g->p1_name, sizeof(e[p].opponent));
+            e[p].bot = (uint8_t)g->bot;
+        }
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    // A game that ended, or a new game in the same slot, loses the old entries
+    if (!live || round != g->snap_round_put) {
+        snapshot_del(&g->snap_p1);
+        snapshot_del(&g->snap_p2);
+    }
+    if (!live) return;
+
+    if (g->snap_p1 < 0 && g->snap_p2 < 0) {
+        g->snap_key = ++snap_key_next;
+        g->snap_round_put = round;
+    }
+    e[0].game = e[1].game = g->snap_key;
+    snapshot_put(&g->snap_p1, &e[0]);
+    // Nobody reattaches as the bot
+    if (!e[1].bot) snapshot_put(&g->snap_p2, &e[1]);
+}
+
+// The table is too full: start a bigger one and write every game in play into it
+// Slabs never move, so they are walked like pool_gauges does
+static void snap_rebuild(void)
+{
+    if (snapshot_grow()) return;
+
+    for (int i = 0; i < num_registries; i++) {
+        Registry *reg = shards ? &shards[i] : &registry;
+        pthread_mutex_lock(&reg->lock);
+        int nslabs = reg->pool.nslabs;
+        pthread_mutex_unlock(&reg->lock);
+
+        for (int s = 0; s < nslabs; s++) {
+            for (int k = 0; k < GAME_SLAB_SIZE; k++) {
+                Game *g = &reg->pool.slabs[s][k];
+                g->snap_p1 = g->snap_p2 = -1;
+                snap_write(g);
             }
-            pthread_mutex_unlock(&session->lock);
+        }
+    }
+    LOG_INFO("[SNAPSHOT] Rebuilt the snapshot table");
+}
+
+void *snapshot_thread(void *arg)
+{
+    (void)arg;
+    struct timespec tick = { 0, SNAPSHOT_MS * 1000000L };
+    while (active && !__atomic_load_n(&snap_stop, __ATOMIC_ACQUIRE)) {
+        Game *g = __atomic_exchange_n(&snap_dirty, NULL, __ATOMIC_ACQUIRE);
+        int wrote = g != NULL;
+        while (g != NULL) {
+            Game *next = g->snap_next;
+            // Changes from here on queue it again
+            __atomic_store_n(&g->snap_queued, 0, __ATOMIC_RELEASE);
+            if (snapshot_full()) snap_rebuild();
+            snap_write(g);
+            g = next;
+        }
+        if (wrote) snapshot_commit();
+
+        resume_expire();
+        nanosleep(&tick, NULL);
+    }
+    return NULL;
+}
+
+// The game a VIEW names: that of the player called target, else the game numbered target
+// *by_name tells which; a player can change games, so the caller checks the names
+static Game *watch_find(const char *target, int *by_name)
+{
+    Game *g = name_game(target);
+    *by_name = g != NULL;
+    if (g != NULL) return g;
+
+    char *end;
+    errno = 0;
+    long n = strtol(target, &end, 10);
+    if (!isdigit((unsigned char)target[0]) || *end != '\0' || errno != 0 || n > INT_MAX) return NULL;
+
+    // Game numbers interleave the shards, see pool_grow
+    Registry *reg = shards ? &shards[n % num_registries] : &registry;
+    long slot = n / num_registries;
+    pthread_mutex_lock(&reg->lock);
+    int exists = slot < reg->max_games;
+    pthread_mutex_unlock(&reg->lock);
+    return exists ? game_at(reg, (int)slot) : NULL;
+}
+
+// c sent VIEW as its first frame: it leaves its seat and follows target's game from now on
+// Returns 0 once it watches, else the FAIL code to answer with
+static int watch_join(Conn *c, const char *target)
+{
+    int by_name;
+    Game *g = watch_find(target, &by_name);
+    if (g == NULL || g == c->session) return 24;
+
+    char first[2 * (MAX_MESSAGE_LEN + 1)];
+    int wait_len;
+    const char *wait = formatWait(&wait_len);
+    memcpy(first, wait, (size_t)wait_len);
+
+    game_lock(g);
+    if ((g->state != P1_TURN && g->state != P2_TURN) ||
+        (by_name && strcmp(g->p1_name, target) != 0 && strcmp(g->p2_name, target) != 0)) {
+        pthread_mutex_unlock(&g->lock);
+        return 24;
+    }
+
+    // WAIT and the board as it is now go through the game's queue too, so no later frame
+    // can overtake them
+    int len = wait_len + formatPlay(first + wait_len, g->state == P1_TURN ? 1 : 2, g->board);
+    Bcast *b = bcast_new(first, len);
+    if (b == NULL) {
+        pthread_mutex_unlock(&g->lock);
+        return 10;
+    }
+    b->only = c;
+    g->nwatchers++;
+    c->watch_from = g->watch_seq + 1;
+    c->watch_cut = 0;
+
+    // Listed before its frames are queued, or another thread's flush could take them first
+    pthread_mutex_lock(&g->watch_lock);
+    c->watch_prev = NULL;
+    c->watch_next = g->watchers;
+    if (g->watchers != NULL) g->watchers->watch_prev = c;
+    g->watchers = c;
+    pthread_mutex_unlock(&g->watch_lock);
+    watch_push(g, b);
+    pthread_mutex_unlock(&g->lock);
+
+    seat_release(c);
+    c->session = g;
+    c->watching = 1;
+    LOG_INFO("[GAME %d] Socket %d is watching P1='%s' P2='%s'", g->index, c->sock, g->p1_name, g->p2_name);
+    metric_inc(MET_SPECTATORS);
+    watch_flush(g);
+    return 0;
+}
+
+// A spectator's connection ends
+static void watch_leave(Conn *c)
+{
+    Game *g = c->session;
+
+    // Waits out a send to it in progress, the fd number is free for reuse once closed
+    pthread_mutex_lock(&g->watch_lock);
+    if (c->watch_prev != NULL) c->watch_prev->watch_next = c->watch_next;
+    else g->watchers = c->watch_next;
+    if (c->watch_next != NULL) c->watch_next->watch_prev = c->watch_prev;
+    pthread_mutex_unlock(&g->watch_lock);
+    net_close(c->sock);
+
+    pthread_mutex_lock(&g->lock);
+    g->nwatchers--;
+    pthread_mutex_unlock(&g->lock);
+    LOG_DEBUG("[GAME %d] Spectator socket %d left", g->index, c->sock);
+
+    // The last one out of a finished game frees it
+    mm_update(g);
+}
+
+// A spectator has nothing to say: any frame ends its connection
+static int watch_step(Conn *c, char *buf, int bytes)
+{
+    c->bytes = bytes;
+    if (bytes == RECV_EOF || bytes == RECV_SYSERR) return 0;
+
+    int code = 10;
+    ParsedMsg msg;
+    if (bytes > 0) {
+        buf[bytes] = '\0';
+        if (parse_frame(c, buf, bytes, &msg) == 0) code = msg.kind == NGP_MOVE ? 24 : 23;
+    }
+    int len;
+    const char *fail = conn_fail(c, code, &len);
+    net_write(c->sock, fail, len);
+    metric_fail(code);
+    c->bytes = 0;
+    return 0;
+}
+
+// Resolve the peer address and announce the connection
+void conn_begin(Conn *c)
+{
+    metric_time(PHASE_ACCEPT, now_ns() - c->accepted_ns);
+
+    // The event engine resolves on the accept path, so never block on reverse DNS there
+    int flags = NI_NUMERICSERV;
+    if (engine != ENGINE_THREAD) flags |= NI_NUMERICHOST;
+
+    int error = getnameinfo((struct sockaddr *)&c->rem, c->rem_len, c->host, HOSTSIZE, c->port, PORTSIZE, flags);
+    if (error) {
+        fprintf(stderr, "getnameinfo: %s\n", gai_strerror(error));
+        strcpy(c->host, "??");
+        strcpy(c->port, "??");
+    }
+
+    c->have_open = 0;
+    c->name[0] = '\0';
+    c->bytes = 0;
+    c->rx.start = c->rx.end = 0;
+
+    LOG_DEBUG("[GAME %d] New connection %s for socket %d from %s:%s", c->session->index, engine != ENGINE_THREAD ? "registered" : "thread started", c->sock, c->host, c->port);
+}
+
+// Runs the OPEN/MOVE state machine for one recv result
+// Returns 1 to keep reading, 0 once the connection must be cleaned up (c->bytes says why)
+int session_step(Conn *c, char *buf, int bytes)
+{
+    if (c->watching) return watch_step(c, buf, bytes);
+
+    Game *session = c->session;
+    int sock = c->sock;
+    char *host = c->host, *port = c->port;
+    unsigned long long t0 = now_ns();
+
+    c->bytes = bytes;
+    // Only a stamp: the timer is pushed back when it fires, so frames never touch the wheel
+    if (bytes > 0 && c->have_open) __atomic_store_n(&c->frame_ms, (long long)(t0 / 1000000), __ATOMIC_RELAXED);
+
+    // Whether this socket is player 1 or 2, without the game's lock: seat_take keeps it in the
+    // Conn, the rare remap case included. It is read again under the lock where it decides
+    // something, as a remap can land between here and there
+    int player = __atomic_load_n(&c->seat, __ATOMIC_ACQUIRE);
+
+    if (player == 0) {
+        // Socket no longer belongs to this game
+        c->bytes = 0;
+        return 0;
+    }
+
+    // After determining 'player' (1 or 2)
+    LOG_DEBUG("[GAME %d] Socket %d identified as Player %d (state=%s)", session->index, sock, player, state_to_str(game_state(session)));
+
+    if (bytes == RECV_EOF || bytes == RECV_SYSERR) {
+        // normal cleanup will handle this
+        return 0;
+    }
+    if (bytes == RECV_BADFRAME) {
+        
+        if (player != 0) {
+            send_fail_and_maybe_forfeit(c, session, 10, "Invalid", NULL);
+        }
+        c->bytes = 0; // so cleanup code treats as EOF/close
+        return 0;
+    }
+    buf[bytes] = '\0';
+    if (c->proto == NGP_BIN) LOG_DEBUG("[%s:%s] read %d bytes {binary type %d} | Game Index [%d] ", host, port, bytes, buf[1], session->index);
+    else LOG_DEBUG("[%s:%s] read %d bytes {%s} | Game Index [%d] ", host, port, bytes, buf, session->index);
+
+    ParsedMsg msg;
+    if (parse_frame(c, buf, bytes, &msg) != 0) {
+        // FAIL 10 Invalid, and if game started, opponent wins by forfeit
+        send_fail_and_maybe_forfeit(c, session, 10, "Invalid", &c->bytes);
+        return 0;
+    }
+
+    LOG_DEBUG("[GAME %d][P%d] Received type=%s with %d field(s)", session->index, player, msg.type, msg.field_count);
+    for (int i = 0; i < msg.field_count; i++) {
+        LOG_DEBUG("    field[%d] = '%s'", i, msg.fields[i]);
+    }
+
+
+    // ---------- FIRST MESSAGE MUST BE OPEN (or VIEW) ----------
+    if (!c->have_open) {
+        if (msg.kind == NGP_VIEW) {
+            int code = watch_join(c, msg.fields[0]);
+            if (code != 0) {
+                send_fail_and_maybe_forfeit(c, session, code, code == 24 ? "Not Playing" : "Invalid", &c->bytes);
+                return 0;
+            }
+            c->have_open = 1;
+            __atomic_sub_fetch(&conns_pending, 1, __ATOMIC_RELAXED);
+            conn_timer_arm(c); // Spectators have no deadline
+            // Its frames are queued by the loop that runs the game
+            if (engine == ENGINE_URING && c->owner != &loops[c->session->reg->id]) c->move_to = &loops[c->session->reg->id];
+            return 1;
+        }
+        if (msg.kind != NGP_OPEN) {
+            // First valid payload but not OPEN -> FAIL 24 Not Playing
+            send_fail_and_maybe_forfeit(c, session, 24, "Not Playing", &c->bytes);
+            return 0;
+        }
+
+        if (msg.field_count < 1 || !msg.fields[0]) {
+            send_fail_and_maybe_forfeit(c, session, 10, "Invalid", &c->bytes);
+            return 0;
+        }
+
+        char *name = msg.fields[0];
+        size_t name_len = strlen(name);
+        if (name_len == 0 || name_len > 72) {
+            // FAIL 21 Long Name
+            send_fail_and_maybe_forfeit(c, session, 21, "Long Name", &c->bytes);
+            return 0;
+        }
+
+        // Already in another game? → FAIL 22 Already Playing
+        // Claiming is atomic, so nobody else can take the name between here and the copy below
+        int claim = name_claim(name, c);
+        if (claim != 0) {
+            if (claim < 0) {
+                send_fail_and_maybe_forfeit(c, session, 10, "Invalid", &c->bytes);
+            } else {
+                send_fail_and_maybe_forfeit(c, session, 22, "Already Playing", &c->bytes);
+            }
+            return 0;
+        }
+        strncpy(c->name, name, 72);
+        c->name[72] = '\0';
+
+        // A player back after a crash returns to their own game instead
+        Game *restored = reattach(c, name);
+        if (restored != NULL) {
+            session = restored;
+            // Both players of a game share one writer
+            if (engine == ENGINE_URING && c->owner != &loops[session->reg->id]) c->move_to = &loops[session->reg->id];
+        } else {
+            // Store the name into the Game
+            unsigned long seq = __atomic_add_fetch(&open_seq_next, 1, __ATOMIC_RELAXED);
+            game_lock(session);
+            player = c->seat;
+            if (player == 1) {
+                strncpy(session->p1_name, name, 72);
+                session->p1_name[72] = '\0';
+                session->p1_open_seq = seq;
+            } else {
+                strncpy(session->p2_name, name, 72);
+                session->p2_name[72] = '\0';
+                session->p2_open_seq = seq;
+            }
+            pthread_mutex_unlock(&session->lock);
+        }
+        metric_inc(MET_OPEN);
+
+        // Send WAIT| back
+        // Held back so it shares one writev with NAME and PLAY if this OPEN starts the game
+        int wait_len;
+        const char *wait_msg = c->proto == NGP_BIN ? ngp_bin_wait(&wait_len) : formatWait(&wait_len);
+        OutBatch out = { 0 };
+        out_add(&out, wait_msg, wait_len);
+
+        LOG_DEBUG("[GAME %d][P%d] -> WAIT", session->index, player);
+
+
+        c->have_open = 1;
+        __atomic_sub_fetch(&conns_pending, 1, __ATOMIC_RELAXED);
+        conn_timer_arm(c); // From the OPEN deadline to the idle one
+
+        // If this completes both names and state == GAME_START, start the game
+        // A player who asked for the bot and is still alone gets it now
+        int started = 0;
+        if (restored != NULL) {
+            started = resume_game(session, sock, &out);
+        } else if (msg.field_count == 2 && player == 1) {
+            pthread_mutex_lock(&session->reg->lock);
+            game_lock(session);
+            started = bot_start(session, sock, &out);
+            pthread_mutex_unlock(&session->lock);
+            pthread_mutex_unlock(&session->reg->lock);
+        }
+        if (!started && restored == NULL) started = maybe_start_game(session, sock, &out);
+        out_flush(sock, &out);
+        unsigned long long t = now_ns() - t0;
+        metric_time(PHASE_OPEN_WAIT, t);
+        if (started) metric_time(PHASE_START, t);
+        return 1;
+    }
+
+    // ---------- AFTER OPEN: either MOVE or protocol fail ----------
+
+    if (msg.kind == NGP_OPEN) {
+        // Second OPEN -> FAIL 23 Already Open, then drop; if game started, opponent wins
+        send_fail_and_maybe_forfeit(c, session, 23, "Already Open", &c->bytes);
+        return 0;
+    }
+
+    if (msg.kind != NGP_MOVE) {
+        // Unknown type -> FAIL 10 Invalid
+        send_fail_and_maybe_forfeit(c, session, 10, "Invalid", &c->bytes);
+        return 0;
+    }
+    metric_inc(MET_MOVE);
+
+    long pile = msg.pile;
+    long qty = msg.qty;
+    if (!msg.numeric) {
+        // MOVE requires two integer fields: pile, qty
+        if (msg.field_count < 2 || !msg.fields[0] || !msg.fields[1]) {
+            send_fail_and_maybe_forfeit(c, session, 10, "Invalid", &c->bytes);
+            return 0;
+        }
+
+        char *pile_str = msg.fields[0];
+        char *qty_str  = msg.fields[1];
+        char *endp;
+
+        pile = strtol(pile_str, &endp, 10);
+        if (*endp != '\0') {
+            send_fail_and_maybe_forfeit(c, session, 10, "Invalid", &c->bytes);
+            return 0;
+        }
+        qty = strtol(qty_str, &endp, 10);
+        if (*endp != '\0') {
+            send_fail_and_maybe_forfeit(c, session, 10, "Invalid", &c->bytes);
+            return 0;
+        }
+    }
+
+    // The move is the only part of the frame that needs the game to itself
+    game_lock(session);
+    player = c->seat;
+    LOG_DEBUG("[GAME %d][P%d] MOVE request: pile=%ld qty=%ld (state=%s)", session->index, player, pile, qty, state_to_str(session->state));
+
+    int result = game_move(session, player, pile, qty);
+    // Against the bot the answer comes right away, from this thread
+    if (result == NIM_OK) result = bot_play(session);
+
+    if (result == 24) {
+        // If game isn't actually in a playing state -> FAIL 24 Not Playing
+        pthread_mutex_unlock(&session->lock);
+        send_fail_and_maybe_forfeit(c, session, 24, "Not Playing", &c->bytes);
+        return 0;
+    }
+    if (result != NIM_OK && result != NIM_WON) {
+        // Wrong turn (31), pile index (32) or quantity (33): FAIL, but the game continues
+        pthread_mutex_unlock(&session->lock);
+        int flen;
+        const char *fbuf = conn_fail(c, result, &flen);
+        net_write(sock, fbuf, flen);
+        metric_fail(result);
+
+        LOG_DEBUG("[GAME %d][P%d] Invalid MOVE -> FAIL %d", session->index, player, result);
+
+        return 1;
+    }
+
+    pthread_mutex_unlock(&session->lock);
+    metric_time(PHASE_MOVE, now_ns() - t0);
+    watch_flush(session);
+
+    if (result == NIM_WON) {
+        // this connection also leaves the recv loop cleanly
+        c->bytes = 0;   // cleanup sees "EOF-ish"
+        return 0;
+    }
+    return 1;
+}
+
+// Here we handle when the game closes
+// Either we sigInt, or a player disconnected, or game ends normally
+// The other player is woken with shutdown() so its own connection runs this too;
+// only the owner of a socket ever closes it
+void session_close(Conn *c)
+{
+    Game *session = c->session;
+    int sock = c->sock;
+    int bytes = c->bytes;
+    char *host = c->host, *port = c->port;
+    char buf[MAX_MESSAGE_LEN + 1];
+
+    metric_inc(MET_CONN_CLOSED);
+    conn_timer_stop(c);
+    admit_undo(!c->have_open);
+
+    // Whatever happens below, this player no longer holds its name
+    if (c->name[0]) {
+        name_release(c->name);
+        c->name[0] = '\0';
+    }
+
+    if (c->watching) {
+        watch_leave(c);
+        return;
+    }
+
+    //Lock so only one of the two games handles this
+    game_lock(session);
+    if (session->state == GAME_OVER) {
+        net_close(sock);
+        if (sock == session->p1_s) {
+            session->p1_s = -1;
+            session->p1_c = NULL;
+        } else if (sock == session->p2_s) {
+            session->p2_s = -1;
+            session->p2_c = NULL;
+        }
+        pthread_mutex_unlock(&session->lock);
+        mm_update(session);
+        return;
+    }
+
+    LOG_DEBUG("[GAME %d] Cleanup for socket %d: bytes=%d, state=%s", session->index, sock, bytes, state_to_str(session->state));
+
+    if (bytes == 0) {
+        if (session->state == AWAITING_SECOND_PLAYER || session->state == GAME_START) {
+            seat_vacate(session, sock);
+        } else if (session->state == RESUMING) {
+            // The game stays restored, this player can still come back before the window closes
+            LOG_INFO("[GAME %d] Socket %d left before the restored game resumed", session->index, sock);
+        }
+        else {
+            // Otherwise we need to Forfeit the game because the game started
+            // and the players recieved their names
+
+            LOG_INFO("[GAME %d] Socket %d disconnected; treating as forfeit.", session->index, sock);
+            metric_inc(MET_WINS_FORFEIT);
+            if (journal_on) journal_over(session->journal_id, &session->journal_seq, sock == session->p1_s ? 2 : 1, 1, session->board);
+            snap_mark(session);
+
+            char bin[NGP_BIN_MAX];
+            int len, bin_len;
+            if (sock == session->p1_s) {
+                // Player 1 disconnected so send player 2 info and wake its reader
+                // (the bot has no socket, it just wins)
+                over_encode(session, 1, 2, buf, &len, bin, &bin_len);
+                if (session->p2_s != -1) {
+                    seat_write(session, 2, buf, len, bin, bin_len);
+                    net_shutdown(session->p2_s);
+                }
+                watch_publish(session, buf, len);
+            } else {
+                //Player 2 disconnected so send player 1 info and wake its reader
+                over_encode(session, 1, 1, buf, &len, bin, &bin_len);
+                seat_write(session, 1, buf, len, bin, bin_len);
+                net_shutdown(session->p1_s);
+                watch_publish(session, buf, len);
+            }
+
+            //Shut down this Game
+            game_state_set(session, GAME_OVER);
+        }
+        LOG_DEBUG("[%s:%s] got EOF", host, port);
+
+    } else if (bytes == -1) {
+        //Read Failed treat as Connection failed for both Players and handle both not for official submission
+        //if (session->p1_s != -1) write(session->p1_s, custom1, strlen(custom1));
+        //if (session->p2_s != -1) write(session->p2_s, custom1, strlen(custom1));
+
+        LOG_INFO("[GAME %d] Read error on socket %d: %s", session->index, sock, strerror(errno));
+
+
+        if (sock == session->p1_s && session->p2_s != -1) {
+            // only if P2 actually existed
+            net_shutdown(session->p2_s);
+        } else if (sock == session->p2_s && session->p1_s != -1) {
+            net_shutdown(session->p1_s);
+        }
+
+        // A game in play ends without a winner
+        if (journal_on && (session->state == P1_TURN || session->state == P2_TURN)) journal_over(session->journal_id, &session->journal_seq, 0, 0, session->board);
+        game_state_set(session, GAME_OVER);
+        snap_mark(session);
+        LOG_DEBUG("[%s:%s] failed to read, sending connection failure: %s", host, port, strerror(errno));
+    } else {
+        //if (session->p1_s != -1) write(session->p1_s, custom2, strlen(custom2));
+        //if (session->p2_s != -1) write(session->p2_s, custom2, strlen(custom2));
+        // Not for official submission only for my modified version
+        LOG_INFO("[GAME %d] Sending SERVER_SHUTDOWN to remaining players.", session->index);
+
+        if (sock == session->p1_s && session->p2_s != -1) {
+            // only if P2 actually existed
+            net_shutdown(session->p2_s);
+        } else if (sock == session->p2_s && session->p1_s != -1) {
+            net_shutdown(session->p1_s);
+        }
+
+        // A game in play ends without a winner
+        if (journal_on && (session->state == P1_TURN || session->state == P2_TURN)) journal_over(session->journal_id, &session->journal_seq, 0, 0, session->board);
+        game_state_set(session, GAME_OVER);
+        snap_mark(session);
+        LOG_DEBUG("[%s:%s] terminating, sending SERVER SHUTDOWN: %s", host, port, strerror(errno));
+    }
+    
+    // Every way past here that ended the game in play hangs its spectators up
+    if (session->state == GAME_OVER) watch_end(session);
+
+    net_close(sock);
+    if (sock == session->p1_s) {
+        session->p1_s = -1;
+        session->p1_c = NULL;
+    } else if (sock == session->p2_s) {
+        session->p2_s = -1;
+        session->p2_c = NULL;
+    }
+    pthread_mutex_unlock(&session->lock);
+    watch_flush(session);
+
+    // Back to the free list or the waiting queue, if it belongs on one
+    mm_update(session);
+}
+
+// Handles Game Connections per Socket (thread engine)
+//One of the two connections is responsible for starting the game for the players
+void handle_connection(Conn *c)
+{
+    char buf[MAX_MESSAGE_LEN + 1];
+
+    conn_begin(c);
+    conn_timer_arm(c);
+
+    while (active) {
+        int bytes = recv_ngp_message(c, buf, sizeof(buf));
+        if (__atomic_load_n(&c->expired, __ATOMIC_RELAXED)) {
+            c->bytes = RECV_EOF;
+            break;
+        }
+        if (!session_step(c, buf, bytes)) break;
+    }
+
+    session_close(c);
+}
+
+// Run the state machine over every whole frame already buffered in c->rx
+// Returns 1 when only a partial frame (or nothing) is left, 0 once the connection must be cleaned up
+int conn_run_frames(Conn *c)
+{
+    char buf[MAX_MESSAGE_LEN + 1];
+    while (active) {
+        int status = recv_next_frame(c, buf, sizeof(buf));
+        if (status == 0) return 1;
+        if (!session_step(c, buf, status)) return 0;
+        // The rest is for the loop it moves to
+        if (c->move_to != NULL) return 1;
+    }
+    return 0;
+}
+
+// Run the state machine over the whole frames of n bytes received somewhere else (io_uring
+// provided buffers) while c->rx is empty, so they are not copied into it first. A partial
+// frame left at the end, or the frames for the loop c moves to, go into c->rx
+// Returns like conn_run_frames
+int conn_run_bytes(Conn *c, const char *data, int n)
+{
+    char buf[MAX_MESSAGE_LEN + 1];
+    int off = 0;
+    while (active) {
+        int status = c->move_to == NULL ? frame_status(c, data + off, (size_t)(n - off), sizeof(buf)) : 0;
+        if (status == 0) {
+            // Always fits, rx was empty and holds more than a provided buffer
+            recv_push(&c->rx, data + off, n - off);
+            return 1;
+        }
+        if (status > 0) {
+            memcpy(buf, data + off, (size_t)status);
+            buf[status] = '\0';
+            off += status;
+        }
+        if (!session_step(c, buf, status)) return 0;
+    }
+    return 0;
+}
+
+// Drain every complete frame the socket has for one connection (event engine)
+// Returns 0 once the connection has been cleaned up and freed
+int conn_readable(Conn *c)
+{
+    char buf[MAX_MESSAGE_LEN + 1];
+    int filled = 0;
+
+    while (active) {
+        int bytes = recv_ngp_nonblock(c, buf, sizeof(buf), &filled);
+        if (bytes == RECV_AGAIN) return 1;
+        if (!session_step(c, buf, bytes)) break;
+    }
+
+    session_close(c);
+    free(c);
+    return 0;
+}
+
+// Make a Conn for an accepted socket and give it a seat in reg
+// On failure the client is told to reconnect and the socket is closed
+Conn *accept_conn(Registry *reg, int sock, struct sockaddr_storage *rem, socklen_t rem_len, int *player)
+{
+    unsigned long long t0 = now_ns();
+    int shed = admit();
+    if (shed >= 0) {
+        metric_inc(shed);
+        write(sock, custom1, strlen(custom1));
+        close(sock);
+        return NULL;
+    }
+
+    Conn *c = calloc(1, sizeof(Conn));
+    if (c == NULL) {
+        admit_undo(1);
+        write(sock, custom1, strlen(custom1));
+        close(sock);
+        return NULL;
+    }
+
+    c->accepted_ns = t0;
+    timer_init(&c->timer, conn_expired, c);
+    c->sock = sock;
+    c->rem_len = rem_len;
+    memcpy(&c->rem, rem, rem_len);
+
+    c->session = mm_join(reg, c, player);
+    if (c->session == NULL) {
+        //Send Close to Socket and Ask it to Reconnect
+        admit_undo(1);
+        free(c);
+        write(sock, custom1, strlen(custom1));
+        close(sock);
+        return NULL;
+    }
+
+    LOG_DEBUG("[ACCEPT] Accepted socket %d; attached to game %d as P%d", sock, c->session->index, *player);
+    metric_inc(MET_CONN_ACCEPTED);
+    return c;
+}
+
+// Give up on a Conn that already holds a seat; the normal cleanup detaches it from the game
+void abort_conn(Conn *c)
+{
+    write(c->sock, custom1, strlen(custom1));
+    c->bytes = RECV_EOF;
+    session_close(c);
+    free(c);
+}
+
+// Hand an attached socket to an event loop
+int register_conn(EventLoop *loop, Conn *c)
+{
+    c->owner = loop;
+    conn_begin(c);
+
+    int flags = fcntl(c->sock, F_GETFL, 0);
+    if (flags < 0 || fcntl(c->sock, F_SETFL, flags | O_NONBLOCK) < 0) {
+        perror("fcntl");
+        return 1;
+    }
+
+    // Before the loop can see the socket, so only main has touched the timer when it does
+    conn_timer_arm(c);
+
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = c;
+    if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, c->sock, &ev) < 0) {
+        perror("epoll_ctl");
+        return 1;
+    }
+    return 0;
+}
+
+// Accept everything queued on a shard's own listener and match it inside the shard
+void shard_accept(EventLoop *loop)
+{
+    while (active) {
+        struct sockaddr_storage rem;
+        socklen_t rem_len = sizeof(rem);
+        int sock = accept(loop->listener, (struct sockaddr *)&rem, &rem_len);
+        if (sock < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+
+        int player;
+        Conn *c = accept_conn(loop->reg, sock, &rem, rem_len, &player);
+        if (c != NULL && register_conn(loop, c)) abort_conn(c);
+    }
+}
+
+// io_uring engine: each shard's accepts, receives and output all go through its own ring
+
+static void uring_arm_accept(EventLoop *loop)
+{
+    if (loop->quiesced) return;
+    struct io_uring_sqe *sqe = uring_sqe(loop);
+    if (sqe == NULL) {
+        LOG_INFO("[URING] Submission queue full, listener %d not re-armed", loop->listener);
+        return;
+    }
+    uring_prep_accept_multishot(sqe, loop->listener, (uintptr_t)loop | URING_TAG_ACCEPT);
+    // The ring never blocks on a socket, but a plain write to one (net_run_direct, abort_conn,
+    // a game's other player on another shard) must not stall the loop either
+    sqe->accept_flags = SOCK_NONBLOCK;
+    loop->accept_armed = 1;
+}
+
+static void uring_arm_recv(EventLoop *loop, Conn *c)
+{
+    if (loop->quiesced) return;
+    struct io_uring_sqe *sqe = uring_sqe(loop);
+    if (sqe == NULL) {
+        // Without a recv nothing would ever clean this connection up
+        net_shutdown(c->sock);
+        sqe = uring_sqe(loop);
+        if (sqe == NULL) return;
+    }
+    uring_prep_recv_multishot(sqe, c->sock, (uintptr_t)c | URING_TAG_RECV);
+    c->recv_armed = 1;
+}
+
+// The session ended on this loop
+static void uring_conn_end(Conn *c)
+{
+    // An armed multishot recv keeps the socket alive; shutting the read side down makes it finish
+    if (c->recv_armed) shutdown(c->sock, SHUT_RD);
+    session_close(c);
+    if (c->recv_armed) c->dead = 1;
+    else free(c);
+}
+
+static void uring_migrate(EventLoop *loop, Conn *c, EventLoop *to);
+
+// c's frames ran: keep receiving, move it to the loop a reattach sent it to, or end it
+static void uring_conn_ran(EventLoop *loop, Conn *c, int alive)
+{
+    if (!alive) {
+        uring_conn_end(c);
+        return;
+    }
+    if (c->move_to != NULL) {
+        EventLoop *to = c->move_to;
+        c->move_to = NULL;
+        uring_migrate(loop, c, to);
+        return;
+    }
+    if (!c->recv_armed) uring_arm_recv(loop, c);
+}
+
+// Feed one recv result (bytes > 0 are already in c->rx) to the state machine
+static void uring_conn_input(EventLoop *loop, Conn *c, int bytes)
+{
+    if (bytes > 0) {
+        uring_conn_ran(loop, c, conn_run_frames(c));
+        return;
+    }
+    char buf[MAX_MESSAGE_LEN + 1];
+    session_step(c, buf, bytes);
+    uring_conn_end(c);
+}
+
+// Take ownership of a connection: its output is queued on this ring from now on
+static void uring_adopt(EventLoop *loop, Conn *c)
+{
+    c->owner = loop;
+    c->migrate_to = NULL;
+    if (c->sock < net_fds_max) net_fds[c->sock].loop = loop;
+    conn_timer_arm(c);
+
+    // Frames that arrived while the connection was moving between loops
+    if (c->rx_bad) {
+        c->rx_bad = 0;
+        uring_conn_input(loop, c, RECV_BADFRAME);
+    } else {
+        uring_conn_input(loop, c, 1);
+    }
+}
+
+static void uring_hand_off(Conn *c)
+{
+    EventLoop *to = c->migrate_to;
+    pthread_mutex_lock(&to->inbox_lock);
+    c->inbox_next = to->inbox;
+    __atomic_store_n(&to->inbox, c, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&to->inbox_lock);
+}
+
+static void uring_adopt_inbox(EventLoop *loop)
+{
+    if (__atomic_load_n(&loop->inbox, __ATOMIC_ACQUIRE) == NULL) return;
+
+    pthread_mutex_lock(&loop->inbox_lock);
+    Conn *list = loop->inbox;
+    loop->inbox = NULL;
+    pthread_mutex_unlock(&loop->inbox_lock);
+
+    while (list != NULL) {
+        Conn *c = list;
+        list = c->inbox_next;
+        uring_adopt(loop, c);
+    }
+}
+
+// A shard move put c into a game on loop to's shard. Both players of a game must share one
+// writer, so c moves to that loop: its queued output is submitted, then it is written with
+// plain syscalls until to adopts it, and received bytes are only buffered in the meantime
+static void uring_migrate(EventLoop *loop, Conn *c, EventLoop *to)
+{
+    net_flush(loop);
+    uring_submit(&loop->ring, 0, 0);
+    conn_timer_stop(c); // The new owner arms it on its own wheel
+    if (c->sock < net_fds_max) net_fds[c->sock].loop = NULL;
+    c->migrate_to = to;
+
+    if (!c->recv_armed) {
+        uring_hand_off(c);
+        return;
+    }
+    struct io_uring_sqe *sqe = uring_sqe(loop);
+    if (sqe != NULL) {
+        // The recv's final completion hands the connection over
+        uring_prep_rw(sqe, IORING_OP_ASYNC_CANCEL, -1, (void *)c, 0, URING_TAG_OTHER);
+    }
+}
+
+static void uring_recv_done(EventLoop *loop, Conn *c, int res, unsigned flags)
+{
+    Uring *r = &loop->ring;
+    int bytes = res;
+    if (!(flags & IORING_CQE_F_MORE)) c->recv_armed = 0;
+
+    if (res > 0 && (flags & IORING_CQE_F_BUFFER)) {
+        unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (!c->dead && c->migrate_to == NULL && c->rx.start == c->rx.end) {
+            // Nothing buffered, the usual case: the frames run straight from the provided buffer
+            int alive = conn_run_bytes(c, uring_buf(r, bid), res);
+            uring_buf_recycle(r, bid);
+            uring_conn_ran(loop, c, alive);
+            return;
+        }
+        if (!c->dead && recv_push(&c->rx, uring_buf(r, bid), res) < 0) bytes = RECV_BADFRAME;
+        uring_buf_recycle(r, bid);
+    }
+
+    if (c->dead) {
+        if (!c->recv_armed) free(c);
+        return;
+    }
+    if (c->migrate_to != NULL) {
+        if (bytes == RECV_BADFRAME) c->rx_bad = 1;
+        if (!c->recv_armed) uring_hand_off(c);
+        return;
+    }
+    if (res == -ECANCELED && loop->quiesced) {
+        // Parked for an upgrade, the socket goes to the new server as it is
+        return;
+    }
+    if (res == -ENOBUFS) {
+        // Every provided buffer was in use, the bytes are still in the socket
+        uring_arm_recv(loop, c);
+        return;
+    }
+
+    if (res == 0) {
+        bytes = RECV_EOF;
+    } else if (res < 0) {
+        errno = -res;
+        bytes = RECV_SYSERR;
+    }
+    uring_conn_input(loop, c, bytes);
+}
+
+static void uring_accept_done(EventLoop *loop, int res, unsigned flags)
+{
+    if (res >= 0) {
+        struct sockaddr_storage rem;
+        socklen_t rem_len = sizeof(rem);
+        if (getpeername(res, (struct sockaddr *)&rem, &rem_len) < 0) {
+            memset(&rem, 0, sizeof(rem));
+            rem_len = 0;
+        }
+
+        int player;
+        Conn *c = accept_conn(loop->reg, res, &rem, rem_len, &player);
+        if (c != NULL) {
+            conn_begin(c);
+            uring_adopt(loop, c);
+        }
+    } else if (res != -ECANCELED) {
+        errno = -res;
+        perror("accept");
+    }
+
+    if (!(flags & IORING_CQE_F_MORE)) {
+        loop->accept_armed = 0;
+        if (active) uring_arm_accept(loop);
+    }
+}
+
+// Dispatch every completion the ring holds
+static void uring_reap(EventLoop *loop)
+{
+    Uring *r = &loop->ring;
+    struct io_uring_cqe *cqe;
+    while ((cqe = uring_peek_cqe(r)) != NULL) {
+        unsigned long long data = cqe->user_data;
+        int res = cqe->res;
+        unsigned flags = cqe->flags;
+        uring_cqe_seen(r);
+
+        void *ptr = (void *)(uintptr_t)(data & ~(unsigned long long)URING_TAG_MASK);
+        switch (data & URING_TAG_MASK) {
+            case URING_TAG_RECV:
+                uring_recv_done(loop, ptr, res, flags);
+                break;
+            case URING_TAG_ACCEPT:
+                uring_accept_done(loop, res, flags);
+                break;
+            case URING_TAG_SEND:
+                if (res < 0) LOG_DEBUG("[URING] send failed: %s", strerror(-res));
+                net_op_done(((SendBuf *)ptr)->fd);
+                send_buf_put(loop, ptr);
+                break;
+            default:
+                if (data >> 2) net_op_done((int)(data >> 2) - 1);
+                break;
+        }
+    }
+}
+
+// Shards only match the players they accept, so two lone players on different shards
+// would wait forever. A player left alone for SHARD_STEAL_MS is moved into the waiting
+// game of a lower numbered shard (or, after a remap left two waiting games here, into
+// the older one). Only the loop that owns the player moves it, between events
+// The epoll engine's loops share one registry and only do the latter: a spectator passing
+// through a seat, or a player leaving a game that just filled, can leave two lone players
+// waiting in separate games
+void shard_rebalance(EventLoop *loop)
+{
+    Registry *mine = loop->reg;
+    long long now = now_ms();
+    if (now - loop->last_rebalance < SHARD_TICK_MS) return;
+    loop->last_rebalance = now;
+
+    if (bot_wait_ms > 0) bot_sweep(mine);
+
+    if (__atomic_load_n(&mine->waiting.count, __ATOMIC_RELAXED) == 0) return;
+
+    for (int i = 0; i <= mine->id; i++) {
+        Registry *other = shards ? &shards[i] : mine;
+        int need = (other == mine) ? 2 : 1;
+        if (__atomic_load_n(&other->waiting.count, __ATOMIC_RELAXED) < need) continue;
+
+        pthread_mutex_lock(&mine->lock);
+        if (other != mine) pthread_mutex_lock(&other->lock);
+
+        Game *from = (other == mine) ? mine->waiting.tail : mine->waiting.head;
+        Game *to = other->waiting.head;
+        Conn *moved = NULL;
+        // Two waiting games in one registry are never wanted, so those need not wait
+        if (from != NULL && to != NULL && from != to &&
+            (other == mine || now - from->waiting_since >= SHARD_STEAL_MS)) {
+            moved = mm_move(from, to, loop);
+        }
+
+        if (other != mine) pthread_mutex_unlock(&other->lock);
+        pthread_mutex_unlock(&mine->lock);
+
+        if (moved != NULL) {
+            if (engine == ENGINE_URING && other != mine) uring_migrate(loop, moved, &loops[other->id]);
+            // Both may have OPENed already
+            maybe_start_game(to, -1, NULL);
+            return;
+        }
+    }
+}
+
+// Hot upgrade. SIGUSR2 makes main exec the binary at argv[0] again, so a new build installed
+// there takes over, and hand the new server its listeners, then every game still being played
+// with its players' sockets and the bytes they sent that were not run yet. The loops park
+// between batches while that happens, so no game changes under the copy; the new server
+// carries on from there and this one exits. Connection threads sit in blocking recvs that
+// cannot be parked, so the thread engine hands over only its listener and finishes its own
+// games before exiting
+
+static int parking; // Main wants every loop stopped between batches
+static int parked; // Loops stopped so far, guarded by park_lock
+static int park_stuck; // Loops whose sockets did not go quiet in time
+static pthread_mutex_t park_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t park_cond = PTHREAD_COND_INITIALIZER;
+
+// Call fn on every game of every registry; slabs never move, see snap_rebuild
+static void games_each(void (*fn)(Game *, void *), void *arg)
+{
+    for (int i = 0; i < num_registries; i++) {
+        Registry *reg = shards ? &shards[i] : &registry;
+        pthread_mutex_lock(&reg->lock);
+        int nslabs = reg->pool.nslabs;
+        pthread_mutex_unlock(&reg->lock);
+
+        for (int s = 0; s < nslabs; s++) {
+            for (int k = 0; k < GAME_SLAB_SIZE; k++) fn(&reg->pool.slabs[s][k], arg);
+        }
+    }
+}
+
+#define QUIET_CANCEL 0 // Cancel the loop's armed recvs
+#define QUIET_CHECK  1 // Count the loop's sockets with a recv or a send outstanding
+#define QUIET_REARM  2 // Arm the recvs again, the upgrade was called off
+
+typedef struct {
+    EventLoop *loop;
+    int mode; // QUIET_*
+    int busy;
+} QuietWalk;
+
+static void uring_quiet_game(Game *g, void *arg)
+{
+    QuietWalk *w = arg;
+    pthread_mutex_lock(&g->lock);
+    Conn *seats[2] = { g->p1_c, g->p2_c };
+    for (int p = 0; p < 2; p++) {
+        Conn *c = seats[p];
+        if (c == NULL || c->owner != w->loop) continue;
+
+        if (w->mode == QUIET_CANCEL && c->recv_armed) {
+            struct io_uring_sqe *sqe = uring_sqe(w->loop);
+            if (sqe != NULL) uring_prep_rw(sqe, IORING_OP_ASYNC_CANCEL, -1, (void *)c, 0, URING_TAG_OTHER);
+        } else if (w->mode == QUIET_CHECK) {
+            int inflight = c->sock < net_fds_max ? __atomic_load_n(&net_fds[c->sock].inflight, __ATOMIC_SEQ_CST) : 0;
+            if (c->recv_armed || inflight > 0) w->busy++;
+        } else if (w->mode == QUIET_REARM && !c->recv_armed && !c->dead && c->migrate_to == NULL) {
+            uring_arm_recv(w->loop, c);
+        }
+    }
+    pthread_mutex_unlock(&g->lock);
+}
+
+// Get a uring loop's sockets quiet so they can change hands: no accept or recv armed, all
+// output sent. Whatever arrives meanwhile is run or buffered as usual
+// Returns 0 once nothing is outstanding
+static int uring_quiesce(EventLoop *loop)
+{
+    loop->quiesced = 1;
+    struct io_uring_sqe *sqe;
+    if (loop->accept_armed && (sqe = uring_sqe(loop)) != NULL) {
+        uring_prep_rw(sqe, IORING_OP_ASYNC_CANCEL, -1, (void *)((uintptr_t)loop | URING_TAG_ACCEPT), 0, URING_TAG_OTHER);
+    }
+    QuietWalk w = { loop, QUIET_CANCEL, 0 };
+    games_each(uring_quiet_game, &w);
+
+    long long until = now_ms() + 1000;
+    do {
+        net_flush(loop);
+        uring_submit(&loop->ring, 1, SHARD_TICK_MS);
+        uring_reap(loop);
+        w.mode = QUIET_CHECK;
+        w.busy = loop->accept_armed + loop->sends_out;
+        games_each(uring_quiet_game, &w);
+    } while (w.busy > 0 && now_ms() < until);
+    return w.busy > 0;
+}
+
+static void uring_unquiesce(EventLoop *loop)
+{
+    loop->quiesced = 0;
+    if (!loop->accept_armed) uring_arm_accept(loop);
+    QuietWalk w = { loop, QUIET_REARM, 0 };
+    games_each(uring_quiet_game, &w);
+}
+
+// Stop here until main is done with the upgrade
+static void loop_park(EventLoop *loop)
+{
+    int stuck = engine == ENGINE_URING && uring_quiesce(loop);
+
+    pthread_mutex_lock(&park_lock);
+    parked++;
+    park_stuck += stuck;
+    pthread_cond_broadcast(&park_cond);
+    while (__atomic_load_n(&parking, __ATOMIC_ACQUIRE)) pthread_cond_wait(&park_cond, &park_lock);
+    parked--;
+    pthread_mutex_unlock(&park_lock);
+
+    if (engine == ENGINE_URING && active) uring_unquiesce(loop);
+}
+
+// Returns 0 once every loop is parked with its sockets quiet
+static int loops_park(void)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    until.tv_sec += HANDOFF_TIMEOUT_MS / 1000;
+
+    pthread_mutex_lock(&park_lock);
+    __atomic_store_n(&parking, 1, __ATOMIC_RELEASE);
+    int err = 0;
+    while (parked < num_loops && err == 0) err = pthread_cond_timedwait(&park_cond, &park_lock, &until);
+    int failed = parked < num_loops || park_stuck > 0;
+    pthread_mutex_unlock(&park_lock);
+    return failed;
+}
+
+static void loops_unpark(void)
+{
+    pthread_mutex_lock(&park_lock);
+    __atomic_store_n(&parking, 0, __ATOMIC_RELEASE);
+    park_stuck = 0;
+    pthread_cond_broadcast(&park_cond);
+    pthread_mutex_unlock(&park_lock);
+}
+
+// One seat of a handed over game; its socket rides along with the record
+typedef struct {
+    int present; // The record carries a socket for this seat
+    int have_open;
+    int proto;
+    char name[73];
+    char host[HOSTSIZE];
+    char port[PORTSIZE];
+    struct sockaddr_storage rem;
+    socklen_t rem_len;
+    unsigned long long accepted_ns;
+    int rx_bad;
+    unsigned rx_len; // Bytes received but not run yet, they follow the record
+} HandoffSeat;
+
+// HANDOFF_GAME body: a game, then P1's buffered bytes, then P2's
+typedef struct {
+    int reg; // Registry it was in
+    int state;
+    int board[MAX_PILES];
+    char p1_name[73];
+    char p2_name[73];
+    unsigned long p1_open_seq;
+    unsigned long p2_open_seq;
+    uint64_t journal_id;
+    unsigned journal_seq;
+    int bot; // P2 is the bot, its seat has no socket
+    HandoffSeat seat[2];
+} HandoffGame;
+
+typedef struct {
+    HandoffGame g;
+    char rx[2 * RECV_BUF_SIZE];
+} HandoffGameMsg;
+
+// A game the new server received and has not seated yet
+typedef struct Handed {
+    struct Handed *next;
+    int fds[2];
+    HandoffGame g;
+    char rx[]; // Both seats' buffered bytes
+} Handed;
+
+static Handed *handed_games;
+static int handed_listeners[HANDOFF_MAX_FDS];
+static int num_handed_listeners;
+
+typedef struct {
+    int sock;
+    int games;
+    int socks;
+    int failed;
+} HandoffOut;
+
+// Games that are over or empty stay behind, their sockets close with this server
+static void handoff_game(Game *g, void *arg)
+{
+    HandoffOut *out = arg;
+    if (out->failed) return;
+
+    pthread_mutex_lock(&g->lock);
+    int playing = g->state == AWAITING_SECOND_PLAYER || g->state == GAME_START || g->state == P1_TURN || g->state == P2_TURN;
+    if (!playing || (g->p1_c == NULL && g->p2_c == NULL)) {
+        pthread_mutex_unlock(&g->lock);
+        return;
+    }
+
+    HandoffGameMsg msg;
+    HandoffGame *h = &msg.g;
+    memset(h, 0, sizeof(*h));
+    h->reg = g->reg->id;
+    h->state = g->state;
+    memcpy(h->board, g->board, sizeof(h->board));
+    memcpy(h->p1_name, g->p1_name, sizeof(h->p1_name));
+    memcpy(h->p2_name, g->p2_name, sizeof(h->p2_name));
+    h->p1_open_seq = g->p1_open_seq;
+    h->p2_open_seq = g->p2_open_seq;
+    h->journal_id = g->journal_id;
+    h->journal_seq = g->journal_seq;
+    h->bot = g->bot;
+
+    int fds[2], nfds = 0;
+    size_t rx = 0;
+    Conn *seats[2] = { g->p1_c, g->p2_c };
+    for (int p = 0; p < 2; p++) {
+        Conn *c = seats[p];
+        if (c == NULL) continue;
+        HandoffSeat *s = &h->seat[p];
+        s->present = 1;
+        s->have_open = c->have_open;
+        s->proto = c->proto;
+        memcpy(s->name, c->name, sizeof(s->name));
+        memcpy(s->host, c->host, sizeof(s->host));
+        memcpy(s->port, c->port, sizeof(s->port));
+        s->rem = c->rem;
+        s->rem_len = c->rem_len;
+        s->accepted_ns = c->accepted_ns;
+        s->rx_bad = c->rx_bad;
+        s->rx_len = (unsigned)(c->rx.end - c->rx.start);
+        memcpy(msg.rx + rx, c->rx.data + c->rx.start, s->rx_len);
+        rx += s->rx_len;
+        fds[nfds++] = c->sock;
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    if (handoff_send(out->sock, HANDOFF_GAME, &msg, sizeof(*h) + rx, fds, nfds)) {
+        out->failed = 1;
+        return;
+    }
+    out->games++;
+    out->socks += nfds;
+}
+
+// Old server once the new one has everything: its own copies of the sockets just close
+// Spectators stay behind and are hung up, they reconnect to the new server
+static void handoff_drop(Game *g, void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&g->lock);
+    Conn *seats[2] = { g->p1_c, g->p2_c };
+    for (int p = 0; p < 2; p++) {
+        if (seats[p] == NULL) continue;
+        if (seats[p]->name[0]) name_release(seats[p]->name);
+        close(seats[p]->sock);
+        free(seats[p]);
+    }
+    pthread_mutex_lock(&g->watch_lock);
+    for (Conn *w = g->watchers; w != NULL; w = w->watch_next) shutdown(w->sock, SHUT_RDWR);
+    pthread_mutex_unlock(&g->watch_lock);
+    g->p1_c = g->p2_c = NULL;
+    g->p1_s = g->p2_s = -1;
+    pthread_mutex_unlock(&g->lock);
+}
+
+// Old server: hand everything to a new one. Returns 0 once the new server has taken it all
+// over, 1 when the upgrade was called off and this server carries on
+static int upgrade(char **argv, int listener, char *admin_port)
+{
+    if (__atomic_load_n(&resume_until, __ATOMIC_ACQUIRE) != 0) {
+        LOG_INFO("[UPGRADE] Not while the reattach window is open");
+        return 1;
+    }
 
-            // Send WAIT| back
-            char wait_msg[MAX_MESSAGE_LEN + 1];
-            formatWait(wait_msg);
-            write(sock, wait_msg, strlen(wait_msg));
+    int sock;
+    pid_t pid = handoff_spawn(argv, &sock);
+    if (pid < 0) return 1;
+    LOG_INFO("[UPGRADE] Started %s as pid %d", argv[0], (int)pid);
+
+    int loops_parked = 0, metrics_stopped = 0, snap_stopped = 0;
+    HandoffOut out = { sock, 0, 0, 0 };
+    HandoffHello hello = { sizeof(HandoffGame), engine, board_piles };
+    HandoffHello reply;
+    int fds[HANDOFF_MAX_FDS], nfds;
+    size_t len;
+
+    // The new server answers once it knows it can take what this one has
+    if (handoff_send(sock, HANDOFF_HELLO, &hello, sizeof(hello), NULL, 0) ||
+        handoff_recv(sock, HANDOFF_TIMEOUT_MS, &reply, sizeof(reply), &len, fds, &nfds) != HANDOFF_READY) {
+        goto abort;
+    }
 
-            printf("[GAME %d][P%d] -> WAIT\n", session->index, player);
+    // From here nothing changes: the games stop, the new server gets the admin port and
+    // the snapshot file once it has taken over
+    if (engine != ENGINE_THREAD) {
+        loops_parked = 1;
+        if (loops_park()) goto abort;
+    }
+    metrics_stop();
+    metrics_stopped = 1;
+    if (snapshot_on) {
+        __atomic_store_n(&snap_stop, 1, __ATOMIC_RELEASE);
+        pthread_join(snapshot_tid, NULL);
+        snap_stopped = 1;
+    }
 
+    int lfds[HANDOFF_MAX_FDS], nl = 0;
+    if (engine == ENGINE_SHARD || engine == ENGINE_URING) {
+        for (int i = 0; i < num_loops && nl < HANDOFF_MAX_FDS; i++) lfds[nl++] = loops[i].listener;
+    } else {
+        lfds[nl++] = listener;
+    }
+    if (handoff_send(sock, HANDOFF_LISTENERS, NULL, 0, lfds, nl)) goto abort;
 
-            have_open = 1;
+    if (engine != ENGINE_THREAD) games_each(handoff_game, &out);
+    if (out.failed || handoff_send(sock, HANDOFF_DONE, NULL, 0, NULL, 0) ||
+        handoff_recv(sock, HANDOFF_TIMEOUT_MS, NULL, 0, &len, fds, &nfds) != HANDOFF_ACK) {
+        goto abort;
+    }
 
-            // If this completes both names and state == GAME_START, start the game
-            maybe_start_game(session);
-            continue;
-        }
+    close(sock);
+    if (snap_stopped) snapshot_close();
+    LOG_INFO("[UPGRADE] Handed %d listener(s), %d game(s) and %d player socket(s) to pid %d", nl, out.games, out.socks, (int)pid);
+    return 0;
 
-        // ---------- AFTER OPEN: either MOVE or protocol fail ----------
+abort:
+    // Without its ACK the new server may hold copies of some sockets; it must not use them
+    close(sock);
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    if (snap_stopped) {
+        __atomic_store_n(&snap_stop, 0, __ATOMIC_RELEASE);
+        if (pthread_create(&snapshot_tid, NULL, snapshot_thread, NULL) != 0) perror("pthread_create");
+    }
+    if (metrics_stopped && metrics_start(admin_port, pool_gauges)) LOG_INFO("[UPGRADE] Could not restart the metrics");
+    if (loops_parked) loops_unpark();
+    LOG_INFO("[UPGRADE] Upgrade to pid %d failed, still serving", (int)pid);
+    return 1;
+}
 
-        if (strcmp(msg.type, "OPEN") == 0) {
-            // Second OPEN -> FAIL 23 Already Open, then drop; if game started, opponent wins
-            send_fail_and_maybe_forfeit(session, sock, player, 23, "Already Open", &bytes);
-            break;
-        }
+// Old thread engine server: hang up on g's players that are not in a game yet, or on
+// everyone in it, spectators included, when *arg is set. Their threads see EOF and clean up
+// as usual; a client still waiting for an opponent connects again and finds the new server
+static void upgrade_hangup(Game *g, void *arg)
+{
+    int all = *(int *)arg;
+    pthread_mutex_lock(&g->lock);
+    if (all || g->state == AWAITING_SECOND_PLAYER || g->state == GAME_START) {
+        if (g->p1_s != -1) shutdown(g->p1_s, SHUT_RDWR);
+        if (g->p2_s != -1) shutdown(g->p2_s, SHUT_RDWR);
+    }
+    if (all) {
+        pthread_mutex_lock(&g->watch_lock);
+        for (Conn *w = g->watchers; w != NULL; w = w->watch_next) shutdown(w->sock, SHUT_RDWR);
+        pthread_mutex_unlock(&g->watch_lock);
+    }
+    pthread_mutex_unlock(&g->lock);
+}
 
-        if (strcmp(msg.type, "MOVE") != 0) {
-            // Unknown type -> FAIL 10 Invalid
-            send_fail_and_maybe_forfeit(session, sock, player, 10, "Invalid", &bytes);
-            break;
+// Old server after a successful upgrade. The event engines drop their copies of the handed
+// sockets and stop; the thread engine first lets the games in play finish, for up to
+// UPGRADE_DRAIN_S. Nobody can be matched here any more, so players still waiting go first
+static void upgrade_finish(void)
+{
+    if (engine == ENGINE_THREAD) {
+        int all = 0;
+        games_each(upgrade_hangup, &all);
+        LOG_INFO("[UPGRADE] Finishing %d connection(s) before exiting", __atomic_load_n(&conns_live, __ATOMIC_RELAXED));
+        long long deadline = now_ms() + UPGRADE_DRAIN_S * 1000LL;
+        struct timespec tick = { 0, TIMER_TICK_MS * 1000000L };
+        while (active && __atomic_load_n(&conns_live, __ATOMIC_RELAXED) > 0) {
+            if (!all && now_ms() >= deadline) {
+                LOG_INFO("[UPGRADE] %d connection(s) still open after %ds, hanging up", __atomic_load_n(&conns_live, __ATOMIC_RELAXED), UPGRADE_DRAIN_S);
+                all = 1;
+                games_each(upgrade_hangup, &all);
+            }
+            nanosleep(&tick, NULL);
         }
+        active = 0;
+        return;
+    }
+    games_each(handoff_drop, NULL);
+    active = 0;
+    loops_unpark();
+}
 
-        // MOVE requires two integer fields: pile, qty
-        if (msg.field_count < 2 || !msg.fields[0] || !msg.fields[1]) {
-            send_fail_and_maybe_forfeit(session, sock, player, 10, "Invalid", &bytes);
-            break;
-        }
+// The thread engine and the event engines cannot take each other's games, nor can a
+// sharded server and one with a single registry
+static int engine_kind(int e)
+{
+    return e == ENGINE_URING ? ENGINE_SHARD : e;
+}
 
-        char *pile_str = msg.fields[0];
-        char *qty_str  = msg.fields[1];
-        char *endp;
+// New server: take over from the old one on sock. Returns 0 once everything arrived and the
+// old server knows; the games are seated later by handoff_import
+static int handoff_accept(int sock)
+{
+    HandoffGameMsg msg;
+    int fds[HANDOFF_MAX_FDS], nfds;
+    size_t len;
+
+    HandoffHello hello;
+    int type = handoff_recv(sock, HANDOFF_TIMEOUT_MS, &msg, sizeof(msg), &len, fds, &nfds);
+    if (type != HANDOFF_HELLO || len != sizeof(hello)) return 1;
+    memcpy(&hello, &msg, sizeof(hello));
+    if (hello.game_size != sizeof(HandoffGame) || engine_kind(hello.engine) != engine_kind(engine) || hello.piles != board_piles) {
+        fprintf(stderr, "handoff: cannot take over from a server with engine %d, %u byte games and %d piles\n", hello.engine, hello.game_size, hello.piles);
+        return 1;
+    }
+    HandoffHello mine = { sizeof(HandoffGame), engine, board_piles };
+    if (handoff_send(sock, HANDOFF_READY, &mine, sizeof(mine), NULL, 0)) return 1;
+
+    int games = 0;
+    while ((type = handoff_recv(sock, HANDOFF_TIMEOUT_MS, &msg, sizeof(msg), &len, fds, &nfds)) != HANDOFF_DONE) {
+        if (type == HANDOFF_LISTENERS && num_handed_listeners + nfds <= HANDOFF_MAX_FDS) {
+            memcpy(handed_listeners + num_handed_listeners, fds, sizeof(int) * nfds);
+            num_handed_listeners += nfds;
+            continue;
+        }
 
-        long pile = strtol(pile_str, &endp, 10);
-        if (*endp != '\0') {
-            send_fail_and_maybe_forfeit(session, sock, player, 10, "Invalid", &bytes);
-            break;
+        // A record has to match the sockets that came with it
+        HandoffGame *h = &msg.g;
+        int seats = 0;
+        size_t rx = 0;
+        if (type == HANDOFF_GAME && len >= sizeof(*h)) {
+            for (int p = 0; p < 2; p++) {
+                if (!h->seat[p].present) continue;
+                seats++;
+                rx += h->seat[p].rx_len;
+                if (h->seat[p].rx_len > RECV_BUF_SIZE) seats = -2;
+            }
         }
-        long qty = strtol(qty_str, &endp, 10);
-        if (*endp != '\0') {
-            send_fail_and_maybe_forfeit(session, sock, player, 10, "Invalid", &bytes);
-            break;
+        Handed *hg = NULL;
+        if (type == HANDOFF_GAME && len >= sizeof(*h) && seats == nfds && seats > 0 && len == sizeof(*h) + rx) {
+            hg = malloc(sizeof(Handed) + rx);
+        }
+        if (hg == NULL) {
+            fprintf(stderr, "handoff: unexpected message %d from the old server\n", type);
+            for (int i = 0; i < nfds; i++) close(fds[i]);
+            return 1;
+        }
+        // A player whose name this server cannot hold would share it with the next OPEN; without
+        // the ACK the old server keeps every game, so give up instead
+        for (int p = 0; p < 2; p++) {
+            if (h->seat[p].present && h->seat[p].have_open && name_claim(h->seat[p].name, NULL) != 0) {
+                fprintf(stderr, "handoff: cannot claim the name '%.72s'\n", h->seat[p].name);
+                for (int i = 0; i < nfds; i++) close(fds[i]);
+                free(hg);
+                return 1;
+            }
         }
+        hg->g = *h;
+        memcpy(hg->rx, msg.rx, rx);
+        hg->fds[0] = fds[0];
+        hg->fds[1] = nfds > 1 ? fds[1] : -1;
+        hg->next = handed_games;
+        handed_games = hg;
+        games++;
+    }
 
-        pthread_mutex_lock(&session->lock);
-        int state = session->state;
+    if (handoff_send(sock, HANDOFF_ACK, NULL, 0, NULL, 0)) return 1;
+    close(sock);
+    LOG_INFO("[UPGRADE] Received %d listener(s) and %d game(s)", num_handed_listeners, games);
+    return 0;
+}
 
-        printf("[GAME %d][P%d] MOVE request: pile=%ld qty=%ld (state=%s)\n", session->index, player, pile, qty, state_to_str(state));
+// A listener the old server handed over, else a new one
+static int listener_take(char *service, int reuseport)
+{
+    if (num_handed_listeners > 0) return handed_listeners[--num_handed_listeners];
+    return open_listener(service, QUEUE_SIZE, reuseport);
+}
 
-        // If game isn't actually in a playing state -> FAIL 24 Not Playing
-        if (state != P1_TURN && state != P2_TURN) {
-            pthread_mutex_unlock(&session->lock);
-            send_fail_and_maybe_forfeit(session, sock, player, 24, "Not Playing", &bytes);
-            break;
-        }
+// Give a handed over connection to a loop that is not running yet
+static void handoff_attach(EventLoop *loop, Conn *c)
+{
+    if (engine == ENGINE_URING) {
+        // Non-blocking like the sockets its own accepts return, whoever handed it over
+        int flags = fcntl(c->sock, F_GETFL, 0);
+        if (flags >= 0) fcntl(c->sock, F_SETFL, flags | O_NONBLOCK);
+        // Adopted like a connection moving between shards, its buffered frames run first
+        c->migrate_to = loop;
+        uring_hand_off(c);
+        return;
+    }
 
-        int expected_player = (state == P1_TURN) ? 1 : 2;
-        if (player != expected_player) {
-            // Wrong turn -> FAIL 31 Impatient, but game continues
-            pthread_mutex_unlock(&session->lock);
-            char fbuf[MAX_MESSAGE_LEN + 1];
-            formatFail(fbuf, 31, "Impatient");
-            write(sock, fbuf, strlen(fbuf));
+    c->owner = loop;
+    int flags = fcntl(c->sock, F_GETFL, 0);
+    struct epoll_event ev;
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.ptr = c;
+    if (flags < 0 || fcntl(c->sock, F_SETFL, flags | O_NONBLOCK) < 0 || epoll_ctl(loop->epfd, EPOLL_CTL_ADD, c->sock, &ev) < 0) {
+        perror("handoff");
+        abort_conn(c);
+        return;
+    }
+    conn_timer_arm(c);
 
-            printf("[GAME %d][P%d] Invalid MOVE -> FAIL %d (%s)\n", session->index, player, 31, "Impatient");
+    // Frames the old server had read but not run
+    char buf[MAX_MESSAGE_LEN + 1];
+    int alive = c->rx_bad ? session_step(c, buf, RECV_BADFRAME) : conn_run_frames(c);
+    if (!alive) {
+        session_close(c);
+        free(c);
+    }
+}
 
+// New server: seat the games handed over, before the loops start so nothing else sees them
+// half built
+static void handoff_import(void)
+{
+    int games = 0, socks = 0;
+    unsigned next_loop = 0;
+    while (handed_games != NULL) {
+        Handed *hg = handed_games;
+        handed_games = hg->next;
+        HandoffGame *h = &hg->g;
+
+        Conn *seats[2] = { NULL, NULL };
+        int n = 0, ok = 1;
+        for (int p = 0; p < 2; p++) {
+            if (!h->seat[p].present) continue;
+            seats[p] = calloc(1, sizeof(Conn));
+            if (seats[p] == NULL) ok = 0;
+            n++;
+        }
+        if (h->state < 0 || h->state >= NUM_STATES) {
+            LOG_ERROR("[UPGRADE] Handed over game in unknown state %d", h->state);
+            ok = 0;
+        }
+        Registry *reg = shards ? &shards[(unsigned)h->reg % (unsigned)num_registries] : &registry;
+        Game *g = NULL;
+        if (ok) {
+            pthread_mutex_lock(&reg->lock);
+            g = pool_get(reg);
+            pthread_mutex_unlock(&reg->lock);
+        }
+        if (g == NULL) {
+            LOG_INFO("[UPGRADE] %s, dropping a handed over game", ok ? "Out of memory" : "Cannot import");
+            for (int i = 0; i < n; i++) close(hg->fds[i]);
+            free(seats[0]);
+            free(seats[1]);
+            free(hg);
             continue;
         }
 
-        // Pile index check
-        if (pile < 1 || pile > 5) {
-            pthread_mutex_unlock(&session->lock);
-            char fbuf[MAX_MESSAGE_LEN + 1];
-            formatFail(fbuf, 32, "Pile Index");
-            write(sock, fbuf, strlen(fbuf));
-
-            printf("[GAME %d][P%d] Invalid MOVE -> FAIL %d (%s)\n", session->index, player, 32, "Pile Index");
+        pthread_mutex_lock(&g->lock);
+        game_state_enter(g, h->state);
+        memcpy(g->board, h->board, sizeof(g->board));
+        memcpy(g->p1_name, h->p1_name, sizeof(g->p1_name));
+        memcpy(g->p2_name, h->p2_name, sizeof(g->p2_name));
+        g->p1_name[72] = g->p2_name[72] = '\0';
+        g->p1_open_seq = h->p1_open_seq;
+        g->p2_open_seq = h->p2_open_seq;
+        g->journal_id = h->journal_id;
+        g->journal_seq = h->journal_seq;
+        g->bot = h->bot;
+        g->bot_rng = (uint32_t)now_ns() | 1;
+
+        const char *rx = hg->rx;
+        int k = 0;
+        for (int p = 0; p < 2; p++) {
+            Conn *c = seats[p];
+            if (c == NULL) continue;
+            HandoffSeat *s = &h->seat[p];
+            c->sock = hg->fds[k++];
+            c->session = g;
+            c->have_open = s->have_open;
+            c->proto = s->proto;
+            memcpy(c->name, s->name, sizeof(c->name));
+            memcpy(c->host, s->host, sizeof(c->host));
+            memcpy(c->port, s->port, sizeof(c->port));
+            c->name[72] = c->host[HOSTSIZE - 1] = c->port[PORTSIZE - 1] = '\0';
+            c->rem = s->rem;
+            c->rem_len = s->rem_len;
+            c->accepted_ns = s->accepted_ns;
+            c->rx_bad = s->rx_bad;
+            memcpy(c->rx.data, rx, s->rx_len);
+            c->rx.end = s->rx_len;
+            rx += s->rx_len;
+            timer_init(&c->timer, conn_expired, c);
+
+            __atomic_add_fetch(&conns_live, 1, __ATOMIC_RELAXED);
+            if (!c->have_open) __atomic_add_fetch(&conns_pending, 1, __ATOMIC_RELAXED);
+            if (c->have_open) name_hold(c->name, c);
+
+            seat_take(g, p + 1, c);
+        }
+        if (h->p1_open_seq > open_seq_next) open_seq_next = h->p1_open_seq;
+        if (h->p2_open_seq > open_seq_next) open_seq_next = h->p2_open_seq;
+        g->snap_round++;
+        snap_mark(g);
+        pthread_mutex_unlock(&g->lock);
 
-            continue;
+        if (g->state == AWAITING_SECOND_PLAYER) {
+            pthread_mutex_lock(&reg->lock);
+            list_push(&reg->waiting, g);
+            pthread_mutex_unlock(&reg->lock);
         }
 
-        int idx = (int)pile - 1;
+        // Both players of a sharded game stay on their shard's loop
+        for (int p = 0; p < 2; p++) {
+            if (seats[p] == NULL) continue;
+            handoff_attach(shards ? &loops[reg->id] : &loops[next_loop++ % (unsigned)num_loops], seats[p]);
+        }
+        games++;
+        socks += n;
+        free(hg);
+    }
+    LOG_INFO("[UPGRADE] Took over %d game(s) with %d player socket(s)", games, socks);
+}
 
-        // Quantity check
-        if (qty < 1 || qty > session->board[idx]) {
-            pthread_mutex_unlock(&session->lock);
-            char fbuf[MAX_MESSAGE_LEN + 1];
-            formatFail(fbuf, 33, "Quantity");
-            write(sock, fbuf, strlen(fbuf));
+void *event_loop_thread(void *arg)
+{
+    EventLoop *loop = arg;
+    struct epoll_event events[MAX_EVENTS];
+    metrics_hist_own();
 
-            printf("[GAME %d][P%d] Invalid MOVE -> FAIL %d (%s)\n", session->index, player, 33, "Quantity");
+    // Wake up periodically so a shutdown signal and the deadlines are noticed
+    int timeout = (loop->listener >= 0) ? SHARD_TICK_MS : TIMER_TICK_MS;
 
-            continue;
+    while (active) {
+        int n = epoll_wait(loop->epfd, events, MAX_EVENTS, timeout);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
         }
 
-        // Apply the move
-        session->board[idx] -= (int)qty;
-
-        int sum = 0;
-        for (int i = 0; i < 5; i++) {
-            sum += session->board[i];
+        for (int i = 0; i < n; i++) {
+            // The listener is registered with a NULL pointer
+            if (events[i].data.ptr == NULL) shard_accept(loop);
+            else conn_readable(events[i].data.ptr);
         }
 
-        if (sum == 0) {
-            int winner = player;
-
-            char over_buf[MAX_MESSAGE_LEN + 1];
-            formatOver(over_buf, 0, winner, session->board); // forfeit=0
+        loop_timers(loop);
+        if (loop->listener >= 0 || shards == NULL) shard_rebalance(loop);
+        if (__atomic_load_n(&parking, __ATOMIC_ACQUIRE)) loop_park(loop);
+    }
+    return NULL;
+}
 
-            int p1 = session->p1_s;
-            int p2 = session->p2_s;
+void *uring_loop_thread(void *arg)
+{
+    EventLoop *loop = arg;
+    Uring *r = &loop->ring;
+    cur_loop = loop;
+    metrics_hist_own();
 
-            // Send OVER to both players (if they exist)
-            if (p1 != -1) {
-                write(p1, over_buf, strlen(over_buf));
-            }
-            if (p2 != -1 && p2 != p1) {
-                write(p2, over_buf, strlen(over_buf));
-            }
+    uring_arm_accept(loop);
+    // Connections an upgrade handed over are waiting already
+    uring_adopt_inbox(loop);
 
-            printf("[GAME %d] Normal win by P%d. Sending OVER to both.\n", session->index, winner);
+    while (active) {
+        // Submits everything the last batch queued, then sleeps until the next completion
+        net_flush(loop);
+        int n = uring_submit(r, 1, SHARD_TICK_MS);
+        if (n < 0 && n != -ETIME && n != -EINTR && n != -EBUSY && n != -EAGAIN) {
+            errno = -n;
+            perror("io_uring_enter");
+            break;
+        }
 
-            // Mark game over under the lock
-            session->state = GAME_OVER;
+        uring_reap(loop);
+        uring_adopt_inbox(loop);
+        loop_timers(loop);
+        shard_rebalance(loop);
+        if (__atomic_load_n(&parking, __ATOMIC_ACQUIRE)) loop_park(loop);
+    }
 
-            if (p1 != -1) {
-                shutdown(p1, SHUT_RDWR);
-            }
-            if (p2 != -1 && p2 != p1) {
-                shutdown(p2, SHUT_RDWR);
-            }
+    cur_loop = NULL;
+    return NULL;
+}
 
-            pthread_mutex_unlock(&session->lock);
+// Set up one ring per loop, undoing them all if any fails
+static int start_rings(void)
+{
+    for (int i = 0; i < num_loops; i++) {
+        int err = uring_init(&loops[i].ring, URING_ENTRIES, URING_BUFS, URING_BUF_SIZE);
+        if (err != 0) {
+            while (--i >= 0) uring_exit(&loops[i].ring);
+            LOG_INFO("[MAIN] io_uring unavailable (%s), falling back to the epoll shard engine", strerror(-err));
+            return 1;
+        }
+    }
 
-            // this thread also exits the recv loop cleanly
-            bytes = 0;   // cleanup sees "EOF-ish"
-            break;    
-        } else {
-            // Game continues, swap turn
-            int next = (player == 1) ? 2 : 1;
-            session->state = (next == 1) ? P1_TURN : P2_TURN;
+    // Only the owner of a socket queues output for it, this says who that is
+    struct rlimit rl;
+    net_fds_max = 65536;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) net_fds_max = (int)rl.rlim_cur;
+    if (net_fds_max > (1 << 20)) net_fds_max = 1 << 20;
+    net_fds = calloc(net_fds_max, sizeof(NetFd));
+    if (net_fds == NULL) net_fds_max = 0; // Every output is a plain syscall, still correct
+    return 0;
+}
 
-            char play_buf[MAX_MESSAGE_LEN + 1];
-            formatPlay(play_buf, next, session->board);
+// Start num_loops event loops; with service set each one also gets its own
+// SO_REUSEPORT listener on that port and its own registry (sharded engines)
+int start_event_loops(char *service)
+{
+    if (num_loops <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        num_loops = (cpus > 0) ? (int)cpus : 1;
+    }
 
-            if (session->p1_s != -1) write(session->p1_s, play_buf, strlen(play_buf));
-            if (session->p2_s != -1) write(session->p2_s, play_buf, strlen(play_buf));
+    loops = calloc(num_loops, sizeof(EventLoop));
+    if (loops == NULL) return 1;
 
-            printf("[GAME %d] -> PLAY whose_turn=%d board=%d %d %d %d %d\n", session->index, next, session->board[0], session->board[1], session->board[2], session->board[3], session->board[4]);
+    if (service != NULL) {
+        shards = calloc(num_loops, sizeof(Registry));
+        if (shards == NULL) return 1;
+        num_registries = num_loops;
 
-            pthread_mutex_unlock(&session->lock);
-            continue;
+        // Spread the requested preallocation over the shards
+        int per_shard = (prealloc_games + num_loops - 1) / num_loops;
+        for (int i = 0; i < num_loops; i++) {
+            registry_init(&shards[i], i);
+            if (pool_prealloc(&shards[i], per_shard > 0 ? per_shard : 1)) return 1;
         }
     }
 
-    // Here we handle when the game closes
-    // Either we sigInt, or a player disconnected, or game ends normally
-    //Lock so only one of the two games handles this
-    pthread_mutex_lock(&session->lock);
-    if (session->state == GAME_OVER) {
-        close(sock);
-        if (sock == session->p1_s) {
-            session->p1_s = -1;
-        } else if (sock == session->p2_s) {
-            session->p2_s = -1;
+    if (engine == ENGINE_URING && start_rings()) engine = ENGINE_SHARD;
+
+    for (int i = 0; i < num_loops; i++) {
+        EventLoop *loop = &loops[i];
+        loop->listener = -1;
+        loop->reg = (service != NULL) ? &shards[i] : &registry;
+        pthread_mutex_init(&loop->inbox_lock, NULL);
+        timer_wheel_init(&loop->wheel, now_ms(), TIMER_TICK_MS);
+        loop->wheel_shared = (service == NULL);
+        pthread_mutex_init(&loop->wheel_lock, NULL);
+
+        if (engine == ENGINE_URING) {
+            // The ring accepts and receives, no epoll needed
+            loop->epfd = -1;
+            loop->listener = listener_take(service, 1);
+            if (loop->listener < 0) return 1;
+            continue;
         }
-        pthread_mutex_unlock(&session->lock);
-        return;
-    }
-    //If anyone tried to cancel, cancel me now edge cases in shutdowns
-    //pthread_testcancel();
-    
-    // The first thing we always do in these situations is kill the other thread;
-
-    printf("[GAME %d] Cleanup for socket %d: bytes=%d, state=%s\n", session->index, sock, bytes, state_to_str(session->state));
-
-    if (bytes == 0) {
-        if (session->state == AWAITING_SECOND_PLAYER) {
-            // Means their was only one player in the game
-            // We can just remove the player and do nothing
-            session->state = AWAITING_FIRST_PLAYER;
-
-            if (sock == session->p1_s) {
-                session->p1_s = -1;
-                session->p1_name[0] = '\0';
-                session->p1_t = 0;
-            }
-            
-        } else if (session->state == GAME_START) {
-            // This is the very RARE case where this happens
-            /*
-            player 1 Connects ->
-            player 1 sends name ->
-            <- wait player 1
-            player 2 Connects ->
-            player 1 disconnects ->
-            Game state is in GAME_START but player 1 disconnected
-            move player 2 to player 1, change the GAME_STAT,
-            player 1(2) Sends Name ->
-            <- wait player 1(2)
-            */
-
-            if (sock == session->p1_s) {
-                // move socket / thread
-                session->p1_s = session->p2_s;
-                session->p1_t = session->p2_t;
-
-                // safely move name p2 -> p1
-                memmove(session->p1_name, session->p2_name, sizeof(session->p1_name));
-
-                // make sure it's null-terminated
-                session->p1_name[sizeof(session->p1_name) - 1] = '\0';
 
-                //clear p2_name
-                session->p2_name[0] = '\0';
-            }
-            session->state = AWAITING_SECOND_PLAYER;
+        loop->epfd = epoll_create1(0);
+        if (loop->epfd < 0) {
+            perror("epoll_create1");
+            return 1;
         }
-        else {
-            // Otherwise we need to Forfeit the game because the game started
-            // and the players recieved their names
 
-            printf("[GAME %d] Socket %d disconnected; treating as forfeit.\n", session->index, sock);
+        if (service != NULL) {
+            loop->listener = listener_take(service, 1);
+            if (loop->listener < 0) return 1;
 
-            if (sock == session->p1_s) {
-                // Player 1 disconnected so send player 2 info and cancel thread
-                pthread_cancel(session->p2_t);
-                formatOver(buf, 1, 2, session->board);
-                write(session->p2_s, buf, strlen(buf));
-                close(session->p2_s);
-            } else {
-                //Player 2 disconnected so send player 1 info and cancel thread
-                pthread_cancel(session->p1_t);
-                formatOver(buf, 1, 1, session->board);
-                write(session->p1_s, buf, strlen(buf));
-                close(session->p1_s);
+            int flags = fcntl(loop->listener, F_GETFL, 0);
+            if (flags < 0 || fcntl(loop->listener, F_SETFL, flags | O_NONBLOCK) < 0) {
+                perror("fcntl");
+                return 1;
             }
 
-            //Shut down this Game
-            //gameDestroy(&sessions, session->index);
-            session->state = GAME_OVER;
-        }
-        printf("[%s:%s] got EOF\n", host, port);
-
-    } else if (bytes == -1) {
-        //Read Failed treat as Connection failed for both Players and handle both not for official submission
-        //if (session->p1_s != -1) write(session->p1_s, custom1, strlen(custom1));
-        //if (session->p2_s != -1) write(session->p2_s, custom1, strlen(custom1));
-
-        printf("[GAME %d] Read error on socket %d: %s\n", session->index, sock, strerror(errno));
-
-
-        if (sock == session->p1_s && session->p2_s != -1) {
-            // only if P2 actually existed
-            pthread_cancel(session->p2_t);
-            close(session->p2_s);
-        } else if (sock == session->p2_s && session->p1_s != -1) {
-            pthread_cancel(session->p1_t);
-            close(session->p1_s);
+            struct epoll_event ev;
+            ev.events = EPOLLIN;
+            ev.data.ptr = NULL;
+            if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, loop->listener, &ev) < 0) {
+                perror("epoll_ctl");
+                return 1;
+            }
         }
+    }
 
-        //gameDestroy(&sessions, session->index);
-        session->state = GAME_OVER;
-        printf("[%s:%s] failed to read, sending connection failure: %s\n", host, port, strerror(errno));
-    } else {
-        //if (session->p1_s != -1) write(session->p1_s, custom2, strlen(custom2));
-        //if (session->p2_s != -1) write(session->p2_s, custom2, strlen(custom2));
-        // Not for official submission only for my modified version
-        printf("[GAME %d] Sending SERVER_SHUTDOWN to remaining players.\n", session->index);
+    // The old server had more shards than this one: their queued connections are lost
+    while (num_handed_listeners > 0) close(handed_listeners[--num_handed_listeners]);
+    if (upgrade_fd >= 0) handoff_import();
 
-        if (sock == session->p1_s && session->p2_s != -1) {
-            // only if P2 actually existed
-            pthread_cancel(session->p2_t);
-            close(session->p2_s);
-        } else if (sock == session->p2_s && session->p1_s != -1) {
-            pthread_cancel(session->p1_t);
-            close(session->p1_s);
+    // Only start threads once every listener is bound, a shard never sees a half built array
+    for (int i = 0; i < num_loops; i++) {
+        void *(*run)(void *) = (engine == ENGINE_URING) ? uring_loop_thread : event_loop_thread;
+        if (pthread_create(&loops[i].thread, NULL, run, &loops[i]) != 0) {
+            perror("pthread_create");
+            return 1;
         }
-
-        //gameDestroy(&sessions, session->index);
-        session->state = GAME_OVER;
-        printf("[%s:%s] terminating, sending SERVER SHUTDOWN: %s\n", host, port, strerror(errno));
-    }
-    
-    //Dont need to unlock it because its literally destroyed and never
-    //Used again
-    close(sock);
-    if (sock == session->p1_s) {
-        session->p1_s = -1;
-    } else if (sock == session->p2_s) {
-        session->p2_s = -1;
     }
-    pthread_mutex_unlock(&session->lock);
-    return;
+
+    LOG_INFO("[MAIN] Started %d %s", num_loops, engine == ENGINE_URING ? "io_uring shard(s)" : service != NULL ? "shard(s)" : "event loop(s)");
+    return 0;
 }
 
+// With reuseport every caller gets its own socket on the same port and the kernel
+// spreads new connections across them
 int 
-open_listener(char *service, int queue_size)
+open_listener(char *service, int queue_size, int reuseport)
 {
     struct addrinfo hint, *info_list, *info;
     int error, sock;
@@ -1111,6 +4126,11 @@ open_listener(char *service, int queue_size)
             close(sock);
             continue;
         }
+        if (reuseport && setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes)) < 0) {
+            perror("setsockopt(SO_REUSEPORT)");
+            close(sock);
+            continue;
+        }
 
 
         // bind socket to request port
@@ -1145,138 +4165,314 @@ open_listener(char *service, int queue_size)
     return sock;
 }
 
+static void usage(void)
+{
+    fprintf(stderr, "Usage: ./nimd [-e thread|epoll|shard|uring] [-t loops] [-p games] [-l off|error|info|debug] [-a admin_port] [-o open_timeout] [-i idle_timeout] [-c max_conns] [-g max_games] [-w max_pending] [-j journal] [-s snapshot [-r reattach_window]] [-b pile,pile,...] [-m bot_wait_ms] [-d bot_skill] [PORT]\n");
+}
+
+// -b: the starting size of every pile, comma separated. Returns 0 if s is a usable board
+static int board_parse(const char *s)
+{
+    int board[MAX_PILES] = { 0 };
+    int piles = nim_board_parse(s, board);
+    if (piles == 0) return 1;
+
+    memcpy(board_start, board, sizeof(board_start));
+    board_piles = piles;
+    static const int std_board[STD_PILES] = { 1, 3, 5, 7, 9 };
+    board_std = piles == STD_PILES && memcmp(board, std_board, sizeof(std_board)) == 0;
+    return 0;
+}
+
 int
 main(int argc, char** argv) 
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: ./nimd [PORT]\n");
+    int opt;
+    int level = LOG_LEVEL_INFO;
+    char *admin_port = NULL;
+    char *journal_path = NULL;
+    char *snapshot_path = NULL;
+    int handed_off = 0;
+    main_tid = pthread_self();
+    while ((opt = getopt(argc, argv, "e:t:p:l:a:o:i:c:g:w:j:s:r:u:b:m:d:")) != -1) {
+        switch (opt) {
+            case 'e':
+                if (strcmp(optarg, "thread") == 0) engine = ENGINE_THREAD;
+                else if (strcmp(optarg, "epoll") == 0) engine = ENGINE_EPOLL;
+                else if (strcmp(optarg, "shard") == 0) engine = ENGINE_SHARD;
+                else if (strcmp(optarg, "uring") == 0) engine = ENGINE_URING;
+                else {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 't':
+                num_loops = atoi(optarg);
+                break;
+            case 'p':
+                prealloc_games = atoi(optarg);
+                break;
+            case 'l':
+                level = log_parse_level(optarg);
+                if (level < 0) {
+                    usage();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'a':
+                admin_port = optarg;
+                break;
+            case 'o':
+                open_timeout_ms = atoi(optarg) * 1000;
+                break;
+            case 'i':
+                idle_timeout_ms = atoi(optarg) * 1000;
+                break;
+            case 'c':
+                limit_conns = atoi(optarg);
+                break;
+            case 'g':
+                limit_games = atoi(optarg);
+                break;
+            case 'w':
+                limit_pending = atoi(optarg);
+                break;
+            case 'j':
+                journal_path = optarg;
+                break;
+            case 's':
+                snapshot_path = optarg;
+                break;
+            case 'r':
+                resume_window_ms = atoi(optarg) * 1000;
+                break;
+            case 'u':
+                upgrade_fd = atoi(optarg);
+                break;
+            case 'b':
+                if (board_parse(optarg)) {
+                    fprintf(stderr, "-b takes 1 to %d pile sizes from 1 to %d, like 1,3,5,7,9\n", MAX_PILES, MAX_PILE_SIZE);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'm':
+                bot_wait_ms = atoi(optarg);
+                break;
+            case 'd':
+                bot_skill = atoi(optarg);
+                if (bot_skill < 0 || bot_skill > 100) {
+                    fprintf(stderr, "-d takes a skill from 0 to 100\n");
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                usage();
+                return EXIT_FAILURE;
+        }
+    }
+
+    if (optind != argc - 1 || (resume_window_ms > 0 && snapshot_path == NULL)) {
+        usage();
         return EXIT_FAILURE;
     }
+    // Games come over from the old server as they are, there is nothing to restore
+    if (upgrade_fd >= 0) resume_window_ms = 0;
 
     struct sockaddr_storage remote_host;
     socklen_t remote_host_len;
 
-    char *PORT = argv[1];
+    char *PORT = argv[optind];
+
+    if (log_start(level)) {
+        fprintf(stderr, "Failed to start logger.\n");
+        return EXIT_FAILURE;
+    }
+    if (!board_std) {
+        char text[BOARD_TEXT_LEN];
+        LOG_INFO("Games start on the board %s", board_text(text, board_start));
+    }
+    if (bot_wait_ms > 0) LOG_INFO("Players alone for %d ms play the bot (skill %d)", bot_wait_ms, bot_skill);
 
     signal(SIGPIPE, SIG_IGN);
  
     //This allows us to have a graceful shutdown from all our threads if we do a control C
     install_handlers();
-    pthread_mutex_init(&registry_lock, NULL);
-
-    //Add our first game
-    sessions = malloc(max_games * sizeof(Game *));
-    if (addGame(&sessions)) {
-        fprintf(stderr, "Failed to initalize first game session.");
+    // Before a takeover, which claims the names of the players it is handed
+    if (name_registry_init()) {
+        fprintf(stderr, "Failed to initalize name registry.\n");
         return EXIT_FAILURE;
     }
+    if (upgrade_fd >= 0 && handoff_accept(upgrade_fd)) {
+        fprintf(stderr, "Failed to take over from the running server.\n");
+        return EXIT_FAILURE;
+    }
+    if (journal_path != NULL && journal_open(journal_path, board_piles, board_start)) {
+        fprintf(stderr, "Failed to open journal.\n");
+        return EXIT_FAILURE;
+    }
+    if (snapshot_path != NULL) {
+        if (snapshot_open(snapshot_path, resume_window_ms > 0)) {
+            fprintf(stderr, "Failed to open snapshot.\n");
+            return EXIT_FAILURE;
+        }
+        if (resume_window_ms > 0) {
+            resume_until = now_ms() + resume_window_ms;
+            LOG_INFO("[RESTORE] Players of %s have %d s to reattach", snapshot_path, resume_window_ms / 1000);
+        }
+        if (pthread_create(&snapshot_tid, NULL, snapshot_thread, NULL) != 0) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
+    }
+    registry_init(&registry, 0);
 
-    int listener = open_listener(PORT, QUEUE_SIZE);
-    if (listener < 0) exit(EXIT_FAILURE);
-
-    printf("Listening for incoming connections on %s\n", PORT);
+    if (engine == ENGINE_SHARD || engine == ENGINE_URING) {
+        // Every shard accepts, matches and plays on its own; main only waits for a signal
+        if (start_event_loops(PORT)) {
+            fprintf(stderr, "Failed to start shards.\n");
+            return EXIT_FAILURE;
+        }
+        if (metrics_start(admin_port, pool_gauges)) {
+            fprintf(stderr, "Failed to start metrics.\n");
+            return EXIT_FAILURE;
+        }
+        LOG_INFO("Listening for incoming connections on %s (%s engine)", PORT, engine == ENGINE_URING ? "uring" : "shard");
+
+        struct timespec tick = { 0, SHARD_TICK_MS * 1000000L };
+        while (active) {
+            nanosleep(&tick, NULL);
+            if (upgrade_requested) {
+                upgrade_requested = 0;
+                if (upgrade(argv, -1, admin_port) == 0) {
+                    handed_off = 1;
+                    break;
+                }
+            }
+        }
+        if (handed_off) upgrade_finish();
+        else LOG_INFO("[SHUTDOWN]|Shut down server from signal.");
+    } else {
+        //Preallocate the games the first wave of players will need
+        if (pool_prealloc(&registry, prealloc_games > 0 ? prealloc_games : 1)) {
+            fprintf(stderr, "Failed to initalize game pool.\n");
+            return EXIT_FAILURE;
+        }
 
-    while (active) {
-        remote_host_len = sizeof(remote_host);
-        int sock = accept(listener, (struct sockaddr *)&remote_host, &remote_host_len);
+        int listener = listener_take(PORT, 0);
+        if (listener < 0) exit(EXIT_FAILURE);
 
-        if (sock < 0) {
-            perror("accept");
-            continue;
+        if (engine == ENGINE_EPOLL && start_event_loops(NULL)) {
+            fprintf(stderr, "Failed to start event loops.\n");
+            return EXIT_FAILURE;
         }
 
-        pthread_mutex_lock(&registry_lock);
-        Game *session = sessions[cur_game_index];
-        
-        printf("[MAIN] Accepted socket %d; attached to game %d (state=%s)\n", sock, session->index, state_to_str(session->state));
-        
-        pthread_mutex_unlock(&registry_lock);
-
-        pthread_mutex_lock(&session->lock);
+        timer_wheel_init(&conn_wheel, now_ms(), TIMER_TICK_MS);
+        if (engine == ENGINE_THREAD && pthread_create(&conn_timer_tid, NULL, conn_timer_thread, NULL) != 0) {
+            perror("pthread_create");
+            return EXIT_FAILURE;
+        }
 
-        if (session->state == P1_TURN || session->state == P2_TURN || session->state == GAME_START || session->state == GAME_OVER) {
-            
-            printf("[MAIN] Current front game %d is busy (state=%s), creating/reusing new game\n", session->index, state_to_str(session->state));
+        if (metrics_start(admin_port, pool_gauges)) {
+            fprintf(stderr, "Failed to start metrics.\n");
+            return EXIT_FAILURE;
+        }
+        LOG_INFO("Listening for incoming connections on %s (%s engine)", PORT, engine == ENGINE_EPOLL ? "epoll" : "thread");
+
+        while (active) {
+            if (upgrade_requested) {
+                upgrade_requested = 0;
+                if (upgrade(argv, listener, admin_port) == 0) {
+                    handed_off = 1;
+                    break;
+                }
+            }
 
-            pthread_mutex_unlock(&session->lock);
+            remote_host_len = sizeof(remote_host);
+            int sock = accept(listener, (struct sockaddr *)&remote_host, &remote_host_len);
 
-            //If adding a game fails
-            if (addGame(&sessions)) {
-                //Send Close to Socket and Ask it to Reconnect
-                write(sock, custom1, strlen(custom1));
-                close(sock);
+            if (sock < 0) {
+                if (errno != EINTR) perror("accept");
                 continue;
-            };
-
-            // Use the newly created game or reused game
-            pthread_mutex_lock(&registry_lock);
-            session = sessions[cur_game_index];
-            
-            printf("[MAIN] Using game %d for new connection\n", session->index);
-
-            pthread_mutex_unlock(&registry_lock);
+            }
 
-            pthread_mutex_lock(&session->lock);
-        }
+            // Build connection state and seat it in a game
+            int player;
+            Conn *args = accept_conn(&registry, sock, &remote_host, remote_host_len, &player);
+            if (args == NULL) continue;
+            Game *session = args->session;
+
+            int failed;
+            if (engine == ENGINE_EPOLL) {
+                // No thread per player, the socket just joins one of the loops (round robin)
+                static unsigned next_loop = 0;
+                failed = register_conn(&loops[next_loop++ % (unsigned)num_loops], args);
+            } else {
+                pthread_t t;
+                failed = pthread_create(&t, NULL, connection_thread, args) != 0;
+                if (failed) {
+                    perror("pthread_create");
+                } else {
+                    pthread_detach(t);
+                    pthread_mutex_lock(&session->lock);
+                    if (player == 1) session->p1_t = t;
+                    else session->p2_t = t;
+                    pthread_mutex_unlock(&session->lock);
+                }
+            }
 
-        // Build thread args
-        ConnArgs *args = malloc(sizeof(ConnArgs));
-        if (args == NULL) {
-            pthread_mutex_unlock(&session->lock);
-            write(sock, custom1, strlen(custom1));
-            close(sock);
-            continue;
+            if (failed) abort_conn(args);
         }
 
-        args->sock = sock;
-        args->rem_len = remote_host_len;
-        memcpy(&args->rem, &remote_host, remote_host_len);
-        args->session = session;
+        // The new server accepts on its copy of the listener from now on
+        close(listener);
+        if (handed_off) upgrade_finish();
+        else LOG_INFO("[SHUTDOWN]|Shut down server from signal.");
+        if (engine == ENGINE_THREAD) pthread_join(conn_timer_tid, NULL);
+    }
 
-        if (session->state == AWAITING_FIRST_PLAYER) {
-            if (pthread_create(&session->p1_t, NULL, connection_thread, args) != 0) {
-                perror("pthread_create");
-                free(args);
-                write(sock, custom1, strlen(custom1));
-                close(sock);
-                pthread_mutex_unlock(&session->lock);
-                continue;
+    metrics_stop();
+
+    // Loops notice active == 0 within one epoll_wait timeout
+    if (engine != ENGINE_THREAD) {
+        for (int i = 0; i < num_loops; i++) {
+            pthread_join(loops[i].thread, NULL);
+            if (loops[i].epfd >= 0) close(loops[i].epfd);
+            if (loops[i].listener >= 0) close(loops[i].listener);
+            if (engine == ENGINE_URING) uring_exit(&loops[i].ring);
+            free(loops[i].ops);
+            while (loops[i].send_free != NULL) {
+                SendBuf *sb = loops[i].send_free;
+                loops[i].send_free = sb->next;
+                free(sb);
             }
-            pthread_detach(session->p1_t);
-            session->p1_s = sock;
-            session->state = AWAITING_SECOND_PLAYER;
-        } else if (session->state == AWAITING_SECOND_PLAYER) {
-            if (pthread_create(&session->p2_t, NULL, connection_thread, args) != 0) {
-                perror("pthread_create");
-                free(args);
-                write(sock, custom1, strlen(custom1));
-                close(sock);
-                pthread_mutex_unlock(&session->lock);
-                continue;
-            }
-            pthread_detach(session->p2_t);
-            // Game is ready to start
-            session->p2_s = sock;
-            session->state = GAME_START;
-        } else {
-            // Should not happen but just in case
-            free(args);
-            write(sock, custom1, strlen(custom1));
-            close(sock);
         }
-        pthread_mutex_unlock(&session->lock);
+        free(loops);
+        free(net_fds);
     }
 
-    fprintf(stdout, "[SHUTDOWN]|Shut down server from signal.\n");
-    close(listener);
+    // The writer walks the pools, so it stops before they go
+    if (snapshot_on) {
+        pthread_join(snapshot_tid, NULL);
+        snapshot_close();
+    }
 
-    for (int i = 0; i <= cur_game_index; i++) {
-        gameDestroyOne(i);
+    int in_use = 0, capacity = 0;
+    for (int i = 0; i < num_registries; i++) {
+        Registry *reg = shards ? &shards[i] : &registry;
+        int u, cap;
+        pool_stats(reg, &u, &cap);
+        pool_destroy(reg);
+        in_use += u;
+        capacity += cap;
     }
-    free(sessions);
+    free(shards);
 
-    printf("[MAIN] Server shutdown complete. Freed %d game(s).\n", cur_game_index + 1);
+    // Every loop has stopped, so nothing is appended any more
+    journal_close();
+
+    LOG_INFO("[MAIN] Server shutdown complete. Freed %d game(s), %d in use.", capacity, in_use);
+    log_stop();
 
     return EXIT_SUCCESS;
 
-}
\ No newline at end of file
+}
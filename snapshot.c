@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "snapshot.h"
+
+#define SNAPSHOT_MIN_ENTRIES 4096 // Smallest table, a power of two
+
+// One mapped table: a header, then capacity entries
+typedef struct {
+    SnapHeader *h;
+    SnapEntry *e;
+    size_t len;
+    unsigned mask;
+    unsigned used; // Live and deleted, what probes have to walk past
+} Table;
+
+int snapshot_on = 0;
+
+static char *snap_path;
+static char *snap_tmp; // New tables are built here and renamed over snap_path on commit
+static Table cur; // What the writer fills
+static int cur_fd = -1;
+static int cur_fresh; // cur is still at snap_tmp
+static Table old; // Previous run's table while restoring, read only
+
+static unsigned hash_name(const char *name)
+{
+    unsigned h = 2166136261u;
+    for (; *name; name++) h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+static uint64_t wall_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static size_t table_len(unsigned capacity)
+{
+    return sizeof(SnapHeader) + (size_t)capacity * sizeof(SnapEntry);
+}
+
+static void table_unmap(Table *t)
+{
+    if (t->h != NULL) munmap(t->h, t->len);
+    memset(t, 0, sizeof(*t));
+}
+
+// An empty table in a new file at snap_tmp; the file is sparse until entries are written
+static int table_create(unsigned capacity)
+{
+    int fd = open(snap_tmp, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        perror(snap_tmp);
+        return 1;
+    }
+    size_t len = table_len(capacity);
+    if (ftruncate(fd, (off_t)len) < 0) {
+        perror(snap_tmp);
+        close(fd);
+        return 1;
+    }
+    void *mem = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        close(fd);
+        return 1;
+    }
+
+    table_unmap(&cur);
+    if (cur_fd >= 0) close(cur_fd);
+    cur_fd = fd;
+    cur.h = mem;
+    cur.e = (SnapEntry *)((char *)mem + sizeof(SnapHeader));
+    cur.len = len;
+    cur.mask = capacity - 1;
+    cur.used = 0;
+
+    memcpy(cur.h->magic, SNAPSHOT_MAGIC, sizeof(cur.h->magic));
+    cur.h->version = SNAPSHOT_VERSION;
+    cur.h->entry_size = sizeof(SnapEntry);
+    cur.h->capacity = capacity;
+    cur.h->live = 0;
+    cur.h->written_ms = wall_ms();
+    cur_fresh = 1;
+    return 0;
+}
+
+// Map the previous run's file, if there is a usable one
+static void table_load_old(void)
+{
+    int fd = open(snap_path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "%s: no snapshot to restore\n", snap_path);
+        return;
+    }
+    struct stat st;
+    SnapHeader h;
+    if (fstat(fd, &st) < 0 || pread(fd, &h, sizeof(h), 0) != (ssize_t)sizeof(h) ||
+        memcmp(h.magic, SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 || h.version != SNAPSHOT_VERSION ||
+        h.entry_size != sizeof(SnapEntry) || h.capacity == 0 || (h.capacity & (h.capacity - 1)) != 0 ||
+        (size_t)st.st_size < table_len(h.capacity)) {
+        fprintf(stderr, "%s: not a usable nimd snapshot, nothing restored\n", snap_path);
+        close(fd);
+        return;
+    }
+
+    size_t len = table_len(h.capacity);
+    void *mem = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mem == MAP_FAILED) {
+        perror("mmap");
+        return;
+    }
+    old.h = mem;
+    old.e = (SnapEntry *)((char *)mem + sizeof(SnapHeader));
+    old.len = len;
+    old.mask = h.capacity - 1;
+}
+
+int snapshot_open(const char *path, int restore)
+{
+    snap_path = strdup(path);
+    snap_tmp = malloc(strlen(path) + 5);
+    if (snap_path == NULL || snap_tmp == NULL) return 1;
+    sprintf(snap_tmp, "%s.tmp", path);
+
+    // The old file stays mapped after the new one is renamed over it
+    if (restore) table_load_old();
+    if (table_create(SNAPSHOT_MIN_ENTRIES)) return 1;
+    snapshot_commit();
+    snapshot_on = 1;
+    return 0;
+}
+
+void snapshot_close(void)
+{
+    if (!snapshot_on) return;
+    snapshot_commit();
+    snapshot_on = 0;
+    table_unmap(&cur);
+    table_unmap(&old);
+    close(cur_fd);
+    cur_fd = -1;
+    free(snap_path);
+    free(snap_tmp);
+}
+
+// The sequence number brackets every change, so a writer that dies halfway leaves it odd
+static void entry_begin(SnapEntry *e)
+{
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void entry_end(SnapEntry *e)
+{
+    __atomic_store_n(&e->seq, e->seq + 1, __ATOMIC_RELEASE);
+}
+
+int snapshot_full(void)
+{
+    // Keep probes short: room for both players of one more game under three quarters full
+    return cur.used + 2 > (cur.mask + 1) / 4 * 3;
+}
+
+int snapshot_put(int *slot, const SnapEntry *src)
+{
+    unsigned i = (unsigned)*slot;
+    if (*slot < 0) {
+        if (cur.used + 1 > cur.mask) return -1;
+        i = hash_name(src->name) & cur.mask;
+        while (cur.e[i].state == SNAP_LIVE) i = (i + 1) & cur.mask;
+        if (cur.e[i].state == SNAP_EMPTY) cur.used++;
+        cur.h->live++;
+        *slot = (int)i;
+    }
+
+    SnapEntry *e = &cur.e[i];
+    entry_begin(e);
+    // Everything but seq, which stays odd until entry_end
+    memcpy((char *)e + sizeof(e->seq), (const char *)src + sizeof(src->seq), sizeof(*e) - sizeof(e->seq));
+    e->state = SNAP_LIVE;
+    entry_end(e);
+    return 0;
+}
+
+void snapshot_del(int *slot)
+{
+    if (*slot < 0) return;
+    SnapEntry *e = &cur.e[*slot];
+    entry_begin(e);
+    e->state = SNAP_DELETED;
+    entry_end(e);
+    cur.h->live--;
+    *slot = -1;
+}
+
+int snapshot_grow(void)
+{
+    unsigned capacity = SNAPSHOT_MIN_ENTRIES;
+    while (capacity / 4 < cur.h->live + 2) capacity *= 2;
+    return table_create(capacity);
+}
+
+void snapshot_commit(void)
+{
+    __atomic_store_n(&cur.h->written_ms, wall_ms(), __ATOMIC_RELEASE);
+    if (cur_fresh) {
+        // Whole before anyone can find it under the real name
+        msync(cur.h, cur.len, MS_SYNC);
+        if (rename(snap_tmp, snap_path) < 0) perror(snap_path);
+        cur_fresh = 0;
+    } else {
+        msync(cur.h, cur.len, MS_ASYNC);
+    }
+}
+
+int snapshot_find(const char *name, SnapEntry *out)
+{
+    if (old.h == NULL) return 1;
+
+    // Names are unique among players, but a crash between two passes can leave a finished
+    // game next to the player's next one; the newest game wins
+    int found = 1;
+    unsigned i = hash_name(name) & old.mask;
+    for (unsigned n = 0; n <= old.mask && old.e[i].state != SNAP_EMPTY; n++, i = (i + 1) & old.mask) {
+        const SnapEntry *e = &old.e[i];
+        if (e->state != SNAP_LIVE || (e->seq & 1) || strncmp(e->name, name, sizeof(e->name)) != 0) continue;
+        if (e->seat < 1 || e->seat > 2 || e->turn < 1 || e->turn > 2) continue;
+        if (found == 0 && e->game < out->game) continue;
+        *out = *e;
+        out->name[sizeof(out->name) - 1] = '\0';
+        out->opponent[sizeof(out->opponent) - 1] = '\0';
+        found = 0;
+    }
+    return found;
+}
+
+void snapshot_release(void)
+{
+    table_unmap(&old);
+}
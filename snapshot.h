@@ -0,0 +1,77 @@
+#ifndef NIMD_SNAPSHOT_H
+#define NIMD_SNAPSHOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Memory-mapped snapshot of the games in play, for restarting after a crash
+// The file is an open-addressed hash table keyed by player name, one entry per seated player,
+// each holding the whole game. One writer thread copies the games that changed since its last
+// pass into the mapping; the kernel writes the pages back even if the process dies. A restart
+// maps the old file and looks players up by name as they reconnect, so it costs the same
+// however many games were live
+
+#define SNAPSHOT_MAGIC   "NIMSNAP1" // First 8 bytes of a snapshot file
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_PILES   10 // Most piles an entry holds
+
+enum {
+    SNAP_EMPTY = 0, // Never used, ends a probe
+    SNAP_LIVE,
+    SNAP_DELETED, // Used before, probes go past it
+};
+
+typedef struct {
+    uint32_t seq; // Odd while the writer is changing the entry, such an entry is skipped
+    uint8_t state; // SNAP_*
+    uint8_t seat; // 1 or 2: the player this entry is for
+    uint8_t turn; // 1 or 2: who moves next
+    uint8_t piles; // Piles on the board, the rest of board is unused
+    uint8_t board[SNAPSHOT_PILES];
+    uint64_t game; // Key shared by the two entries of one game
+    uint64_t journal_id; // 0 unless the game was journaled
+    uint32_t journal_seq;
+    char name[73];
+    char opponent[73];
+    uint8_t bot; // The opponent is the server's bot, which has no entry of its own
+    char pad[1];
+} SnapEntry;
+
+typedef char snap_entry_is_192_bytes[sizeof(SnapEntry) == 192 ? 1 : -1];
+typedef char snap_seq_first[offsetof(SnapEntry, seq) == 0 ? 1 : -1]; // snapshot_put copies what follows it
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint32_t capacity; // Entries, a power of two
+    uint32_t live; // SNAP_LIVE entries
+    uint64_t written_ms; // Wall clock at the end of the last pass
+    char pad[32];
+} SnapHeader;
+
+extern int snapshot_on;
+
+// Create a fresh snapshot at path. With restore, whatever path held before stays mapped for
+// snapshot_find until snapshot_release. Returns 0 on success
+int snapshot_open(const char *path, int restore);
+void snapshot_close(void);
+
+// Writer side, all from one thread. *slot is the entry's index, -1 for none
+// snapshot_put returns -1 when the table has no room; check snapshot_full first
+int snapshot_put(int *slot, const SnapEntry *e);
+void snapshot_del(int *slot);
+int snapshot_full(void);
+
+// Start over in an empty table sized for what is live now, in a new file that replaces the
+// old one at the next commit. Every slot handed out so far is void; put the entries again
+int snapshot_grow(void);
+
+// End of a pass: stamp the header and schedule the write-back
+void snapshot_commit(void);
+
+// Restore side: the saved entry for name from the previous run; 0 when found
+int snapshot_find(const char *name, SnapEntry *out);
+void snapshot_release(void);
+
+#endif
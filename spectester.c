@@ -2,27 +2,18 @@
 #include <arpa/inet.h>
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <netdb.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
 #include <unistd.h>
 
-#define MAX_RAW   256
-#define MAX_FIELDS 8
-
-typedef struct {
-    char raw[MAX_RAW];      // full frame "0|DD|....|"
-    int  raw_len;
-
-    int  len;               // payload length (DD)
-    char type[5];           // 4 chars + '\0'
-
-    char work[MAX_RAW];     // mutable payload copy
-    char *fields[MAX_FIELDS];
-    int field_count;
-} NgpMsg;
+#include "ngp_client.h"
 
 static int g_pass = 0;
 static int g_fail = 0;
@@ -33,56 +24,57 @@ static int g_fail = 0;
         else { g_fail++; fprintf(stderr, "FAIL: " fmt "\n", ##__VA_ARGS__); } \
     } while (0)
 
-static ssize_t read_exact(int fd, void *buf, size_t n) {
-    size_t got = 0;
-    while (got < n) {
-        ssize_t r = read(fd, (char*)buf + got, n - got);
-        if (r == 0) return 0;            // EOF
-        if (r < 0) {
-            if (errno == EINTR) continue;
-            return -1;
-        }
-        got += (size_t)r;
+// nimd binary for the tests that need a server of their own (a journal, a restart, an
+// option); without one they are skipped
+static const char *g_nimd = NULL;
+
+// Start g_nimd with argv args (PORT last) and wait until it accepts on port; returns its pid or -1
+static pid_t spawn_nimd(const char *host, const char *port, char *const args[]) {
+    pid_t pid = fork();
+    if (pid < 0) return -1;
+    if (pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        if (null >= 0) dup2(null, STDOUT_FILENO);
+        execv(g_nimd, args);
+        _exit(127);
     }
-    return (ssize_t)got;
-}
 
-static ssize_t write_all(int fd, const void *buf, size_t n) {
-    size_t sent = 0;
-    while (sent < n) {
-        ssize_t w = write(fd, (const char*)buf + sent, n - sent);
-        if (w < 0) {
-            if (errno == EINTR) continue;
-            return -1;
+    struct timespec nap = { 0, 100000000 };
+    for (int i = 0; i < 50; i++) {
+        int fd = connect_tcp(host, port);
+        if (fd >= 0) {
+            // The probe took a seat; let the server clear it before the test's players arrive
+            close(fd);
+            nanosleep(&nap, NULL);
+            return pid;
         }
-        sent += (size_t)w;
+        nanosleep(&nap, NULL);
     }
-    return (ssize_t)sent;
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
 }
 
-static int connect_tcp(const char *host, const char *port) {
-    struct addrinfo hints, *res = NULL, *p = NULL;
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family   = AF_UNSPEC;
-    hints.ai_socktype = SOCK_STREAM;
-
-    int err = getaddrinfo(host, port, &hints, &res);
-    if (err != 0) {
-        fprintf(stderr, "getaddrinfo: %s\n", gai_strerror(err));
-        return -1;
-    }
+// SIGTERM lets the server shut down cleanly, SIGKILL plays a crash
+static void stop_nimd(pid_t pid, int sig) {
+    kill(pid, sig);
+    waitpid(pid, NULL, 0);
+}
 
-    int fd = -1;
-    for (p = res; p; p = p->ai_next) {
-        fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (fd < 0) continue;
-        if (connect(fd, p->ai_addr, p->ai_addrlen) == 0) break;
-        close(fd);
-        fd = -1;
+// Runs a tool that lives next to g_nimd on arg and keeps up to cap - 1 bytes of its stdout
+static void run_tool(const char *tool, const char *arg, char *out, size_t cap) {
+    const char *slash = strrchr(g_nimd, '/');
+    int dir = slash ? (int)(slash - g_nimd + 1) : 0;
+    char cmd[1024];
+    snprintf(cmd, sizeof(cmd), "%.*s%s %s", dir, g_nimd, tool, arg);
+
+    size_t n = 0;
+    FILE *f = popen(cmd, "r");
+    if (f != NULL) {
+        n = fread(out, 1, cap - 1, f);
+        pclose(f);
     }
-
-    freeaddrinfo(res);
-    return fd;
+    out[n] = '\0';
 }
 
 static int count_char(const char *s, char c) {
@@ -91,71 +83,6 @@ static int count_char(const char *s, char c) {
     return n;
 }
 
-// Strict recv of server frame: requires header "0|DD|" (two digits!)
-static int ngp_recv(int fd, NgpMsg *m) {
-    memset(m, 0, sizeof(*m));
-
-    char hdr[5];
-    ssize_t r = read_exact(fd, hdr, sizeof(hdr));
-    if (r == 0) return 0;     // EOF
-    if (r < 0) return -1;
-
-    if (!(hdr[0] == '0' && hdr[1] == '|' && isdigit((unsigned char)hdr[2]) &&
-          isdigit((unsigned char)hdr[3]) && hdr[4] == '|')) {
-        return -2; // bad frame header
-    }
-
-    int len = (hdr[2] - '0') * 10 + (hdr[3] - '0');
-    if (len <= 0 || len >= (MAX_RAW - 6)) return -2;
-
-    char payload[MAX_RAW];
-    r = read_exact(fd, payload, (size_t)len);
-    if (r == 0) return 0;
-    if (r < 0) return -1;
-
-    if (payload[len - 1] != '|') return -2;
-
-    // Save raw frame (bar counting happens on THIS, not on the tokenized work buffer)
-    memcpy(m->raw, hdr, 5);
-    memcpy(m->raw + 5, payload, (size_t)len);
-    m->raw_len = 5 + len;
-    m->raw[m->raw_len] = '\0';
-
-    m->len = len;
-
-    // Copy payload into mutable work buffer and parse fields INCLUDING empty ones
-    memcpy(m->work, payload, (size_t)len);
-    m->work[len] = '\0';
-
-    // type must be 4 chars then '|'
-    if ((int)strlen(m->work) < 5) return -2;
-    if (m->work[4] != '|') return -2;
-    memcpy(m->type, m->work, 4);
-    m->type[4] = '\0';
-    m->work[4] = '\0';
-
-    // Fields start after "TYPE|"
-    char *start = m->work + 5;
-    int nf = 0;
-
-    // Scan until we hit the '\0' we placed at end. Every '|' becomes '\0' and emits a field.
-    for (char *p = start; *p; p++) {
-        if (*p == '|') {
-            if (nf >= MAX_FIELDS) return -2;
-            *p = '\0';
-            m->fields[nf++] = start;
-            start = p + 1;
-        }
-    }
-
-    // Special case: payload could be "OVER|...||" where the last field is empty.
-    // That empty field is represented by a final '|' which is inside the string before our '\0'.
-    // The loop above *will* capture it because the second-to-last character is '|'.
-    m->field_count = nf;
-
-    return 1;
-}
-
 static int expected_bars_for_type(const char *type) {
     if (strcmp(type, "WAIT") == 0) return 3; // 0|DD|WAIT|
     if (strcmp(type, "NAME") == 0) return 5; // +2 fields
@@ -165,29 +92,6 @@ static int expected_bars_for_type(const char *type) {
     return -1;
 }
 
-static void send_raw(int fd, const char *s) {
-    (void)write_all(fd, s, strlen(s));
-}
-
-static void send_payload(int fd, const char *payload) {
-    size_t len = strlen(payload);
-    char frame[MAX_RAW];
-    snprintf(frame, sizeof(frame), "0|%02zu|%s", len, payload);
-    send_raw(fd, frame);
-}
-
-static void send_open(int fd, const char *name) {
-    char payload[MAX_RAW];
-    snprintf(payload, sizeof(payload), "OPEN|%s|", name);
-    send_payload(fd, payload);
-}
-
-static void send_move(int fd, int pile, int qty) {
-    char payload[MAX_RAW];
-    snprintf(payload, sizeof(payload), "MOVE|%d|%d|", pile, qty);
-    send_payload(fd, payload);
-}
-
 static void expect_msg(int fd, const char *type, int fields) {
     NgpMsg m;
     int rc = ngp_recv(fd, &m);
@@ -230,13 +134,59 @@ static void expect_close(int fd) {
     CHECK(rc == 0, "expected server to close, but got message (raw=%s)", m.raw);
 }
 
+static const char *bin_type_name(int type) {
+    static const char *names[] = { "?", "OPEN", "MOVE", "WAIT", "NAME", "PLAY", "OVER", "FAIL" };
+    return type > 0 && type <= NGP_BIN_FAIL ? names[type] : "?";
+}
+
+// Binary frame of type with argument a; m gets the frame for checks of its own
+static void expect_bin(int fd, int type, int a, NgpBinMsg *m) {
+    NgpBinMsg local;
+    if (m == NULL) m = &local;
+    memset(m, 0, sizeof(*m));
+    int rc = ngp_recv_bin(fd, m);
+    CHECK(rc == 1, "expected binary %s but recv failed (rc=%d)", bin_type_name(type), rc);
+    if (rc != 1) return;
+
+    CHECK(m->type == type, "expected binary %s got %s", bin_type_name(type), bin_type_name(m->type));
+    CHECK(m->a == a, "binary %s must have a=%d, got %d", bin_type_name(m->type), a, m->a);
+}
+
+// Binary PLAY or OVER with the board of piles bytes, the rest of the body zero but the flag
+static void expect_bin_board(int fd, int type, int a, const int *board, int piles, int flag) {
+    NgpBinMsg m;
+    expect_bin(fd, type, a, &m);
+    if (m.type != type) return;
+
+    CHECK(m.b == piles, "binary %s must have b=%d piles, got %d", bin_type_name(type), piles, m.b);
+    int same = 1;
+    for (int i = 0; i < NGP_BIN_PILES; i++) {
+        if (m.body[i] != (i < piles ? board[i] : 0)) same = 0;
+    }
+    CHECK(same, "binary %s board differs from the expected one", bin_type_name(type));
+    CHECK(m.body[NGP_BIN_PILES] == flag && m.body[NGP_BIN_PILES + 1] == 0,
+          "binary %s must end in %d, 0 got %d, %d", bin_type_name(type), flag,
+          m.body[NGP_BIN_PILES], m.body[NGP_BIN_PILES + 1]);
+}
+
+static void expect_bin_close(int fd) {
+    NgpBinMsg m;
+    int rc = ngp_recv_bin(fd, &m);
+    CHECK(rc == 0, "expected server to close, but got binary %s (rc=%d)", bin_type_name(m.type), rc);
+}
+
 int main(int argc, char **argv) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <host> <port>\n", argv[0]);
+    if (argc != 3 && argc != 4) {
+        fprintf(stderr, "Usage: %s <host> <port> [nimd]\n", argv[0]);
         return 2;
     }
     const char *host = argv[1];
     const char *port = argv[2];
+    if (argc == 4) g_nimd = argv[3];
+
+    // Servers the tester starts itself listen on the next port
+    char own_port[16];
+    snprintf(own_port, sizeof(own_port), "%d", atoi(port) + 1);
 
     printf("NGP Spec Tester -> host=%s port=%s\n\n", host, port);
 
@@ -450,6 +400,460 @@ int main(int argc, char **argv) {
         printf("\n");
     }
 
+    // [TEST] spectator: WAIT and the board, every PLAY, the OVER, then close
+    {
+        printf("[TEST] spectator: VIEW by name gets WAIT, PLAY, each PLAY and the OVER, then close\n");
+
+        int a = connect_tcp(host, port);
+        int b = connect_tcp(host, port);
+        CHECK(a >= 0 && b >= 0, "connect failed a=%d b=%d", a, b);
+
+        if (a >= 0 && b >= 0) {
+            send_open(a, "WatchedA");
+            expect_msg(a, "WAIT", 0);
+            send_open(b, "WatchedB");
+            expect_msg(b, "WAIT", 0);
+            expect_msg(a, "NAME", 2);
+            expect_msg(b, "NAME", 2);
+            expect_msg(a, "PLAY", 2);
+            expect_msg(b, "PLAY", 2);
+
+            int v = connect_tcp(host, port);
+            CHECK(v >= 0, "connect spectator failed");
+            if (v >= 0) {
+                send_view(v, "WatchedB");
+                expect_msg(v, "WAIT", 0);
+                expect_msg(v, "PLAY", 2);
+
+                // Spectators only listen
+                int w = connect_tcp(host, port);
+                CHECK(w >= 0, "connect second spectator failed");
+                if (w >= 0) {
+                    send_view(w, "WatchedA");
+                    expect_msg(w, "WAIT", 0);
+                    expect_msg(w, "PLAY", 2);
+                    send_move(w, 1, 1);
+                    expect_fail(w, "24");
+                    expect_close(w);
+                    close(w);
+                }
+
+                send_move(a, 1, 1);
+                expect_msg(a, "PLAY", 2);
+                expect_msg(b, "PLAY", 2);
+                expect_msg(v, "PLAY", 2);
+
+                close(b);
+                expect_msg(a, "OVER", 3);
+                expect_msg(v, "OVER", 3);
+                expect_close(a);
+                expect_close(v);
+                close(v);
+            }
+            close(a);
+        }
+        printf("\n");
+    }
+
+    // [TEST] VIEW of a game nobody plays
+    {
+        printf("[TEST] VIEW of an unknown player should FAIL 24 Not Playing and close\n");
+        int fd = connect_tcp(host, port);
+        CHECK(fd >= 0, "connect failed");
+        if (fd >= 0) {
+            send_view(fd, "NobodyHere");
+            expect_fail(fd, "24");
+            expect_close(fd);
+            close(fd);
+        }
+        printf("\n");
+    }
+
+    // [TEST] bot: OPEN|name|BOT| starts at once against nimd-bot, which answers every MOVE
+    {
+        printf("[TEST] bot: OPEN with BOT gets WAIT, NAME nimd-bot, PLAY, a PLAY back for each MOVE and OVER\n");
+        int fd = connect_tcp(host, port);
+        CHECK(fd >= 0, "connect failed");
+        if (fd >= 0) {
+            send_payload(fd, "OPEN|BotPlayer|BOT|");
+            expect_msg(fd, "WAIT", 0);
+
+            NgpMsg m;
+            int rc = ngp_recv(fd, &m);
+            CHECK(rc == 1 && strcmp(m.type, "NAME") == 0 && m.field_count == 2 &&
+                  strcmp(m.fields[0], "1") == 0 && strcmp(m.fields[1], "nimd-bot") == 0,
+                  "expected NAME|1|nimd-bot| (rc=%d raw=%s)", rc, m.raw);
+
+            // Take one from the first pile left on each turn until the game ends
+            int replies = 0, over = 0;
+            rc = ngp_recv(fd, &m);
+            for (int turns = 0; rc == 1 && turns < 64; turns++) {
+                if (strcmp(m.type, "OVER") == 0) {
+                    over = 1;
+                    break;
+                }
+                CHECK(strcmp(m.type, "PLAY") == 0 && m.field_count == 2 && strcmp(m.fields[0], "1") == 0,
+                      "expected PLAY|1|...| (raw=%s)", m.raw);
+                if (strcmp(m.type, "PLAY") != 0 || m.field_count != 2) break;
+
+                int pile = 1;
+                for (const char *p = m.fields[1]; *p == '0' && p[1] == ' '; p += 2) pile++;
+                send_move(fd, pile, 1);
+                expect_msg(fd, "PLAY", 2);
+                rc = ngp_recv(fd, &m);
+                if (rc == 1 && strcmp(m.type, "PLAY") == 0) replies++;
+            }
+            CHECK(replies > 0, "the bot never answered a MOVE");
+            CHECK(over && m.field_count == 3, "expected OVER|winner|board|| (rc=%d raw=%s)", rc, m.raw);
+            expect_close(fd);
+            close(fd);
+        }
+        printf("\n");
+    }
+
+    // [TEST] OPEN with a third field other than BOT
+    {
+        printf("[TEST] OPEN|x|FOO| should FAIL 10 Invalid and close\n");
+        int fd = connect_tcp(host, port);
+        CHECK(fd >= 0, "connect failed");
+        if (fd >= 0) {
+            send_payload(fd, "OPEN|x|FOO|");
+            expect_fail(fd, "10");
+            expect_close(fd);
+            close(fd);
+        }
+        printf("\n");
+    }
+
+    // [TEST] binary: a whole game in binary frames, FAIL 32 for pile 0
+    {
+        printf("[TEST] binary: WAIT, NAME, PLAY, FAIL 32 for pile 0, each PLAY and OVER, then close\n");
+
+        int p1 = connect_tcp(host, port);
+        int p2 = connect_tcp(host, port);
+        CHECK(p1 >= 0 && p2 >= 0, "connect failed p1=%d p2=%d", p1, p2);
+
+        if (p1 >= 0 && p2 >= 0) {
+            int board[] = { 1, 3, 5, 7, 9 };
+            NgpBinMsg m;
+
+            send_bin_open(p1, "AliceB", 0);
+            expect_bin(p1, NGP_BIN_WAIT, 0, NULL);
+            send_bin_open(p2, "BobB", 0);
+            expect_bin(p2, NGP_BIN_WAIT, 0, NULL);
+
+            expect_bin(p1, NGP_BIN_NAME, 1, &m);
+            CHECK(m.b == 4 && memcmp(m.body, "BobB", 4) == 0 && m.body[4] == 0,
+                  "binary NAME for P1 must name BobB");
+            expect_bin(p2, NGP_BIN_NAME, 2, &m);
+            CHECK(m.b == 6 && memcmp(m.body, "AliceB", 6) == 0 && m.body[6] == 0,
+                  "binary NAME for P2 must name AliceB");
+            expect_bin_board(p1, NGP_BIN_PLAY, 1, board, 5, 0);
+            expect_bin_board(p2, NGP_BIN_PLAY, 1, board, 5, 0);
+
+            // Piles count from 1, and the mistake does not end the game
+            send_bin_move(p1, 0, 1);
+            expect_bin(p1, NGP_BIN_FAIL, 32, NULL);
+
+            // Same game as the text one: P1 wins
+            static const int moves[][2] = { { 1, 1 }, { 2, 3 }, { 3, 5 }, { 4, 7 } };
+            for (int i = 0; i < 4; i++) {
+                send_bin_move(i % 2 ? p2 : p1, moves[i][0], moves[i][1]);
+                board[moves[i][0] - 1] -= moves[i][1];
+                expect_bin_board(p1, NGP_BIN_PLAY, i % 2 ? 1 : 2, board, 5, 0);
+                expect_bin_board(p2, NGP_BIN_PLAY, i % 2 ? 1 : 2, board, 5, 0);
+            }
+            send_bin_move(p1, 5, 9);
+            board[4] = 0;
+            expect_bin_board(p1, NGP_BIN_OVER, 1, board, 5, 0);
+            expect_bin_board(p2, NGP_BIN_OVER, 1, board, 5, 0);
+
+            expect_bin_close(p1);
+            expect_bin_close(p2);
+            close(p1);
+            close(p2);
+        }
+        printf("\n");
+    }
+
+    // [TEST] mixed: each side of one game gets frames in the protocol it opened with
+    {
+        printf("[TEST] mixed: binary P1 against text P2, each gets its own protocol through OVER\n");
+
+        int p1 = connect_tcp(host, port);
+        int p2 = connect_tcp(host, port);
+        CHECK(p1 >= 0 && p2 >= 0, "connect failed p1=%d p2=%d", p1, p2);
+
+        if (p1 >= 0 && p2 >= 0) {
+            int board[] = { 1, 3, 5, 7, 9 };
+
+            send_bin_open(p1, "MixedB", 0);
+            expect_bin(p1, NGP_BIN_WAIT, 0, NULL);
+            send_open(p2, "MixedT");
+            expect_msg(p2, "WAIT", 0);
+
+            expect_bin(p1, NGP_BIN_NAME, 1, NULL);
+            expect_msg(p2, "NAME", 2);
+            expect_bin_board(p1, NGP_BIN_PLAY, 1, board, 5, 0);
+            expect_msg(p2, "PLAY", 2);
+
+            static const int moves[][2] = { { 1, 1 }, { 2, 3 }, { 3, 5 }, { 4, 7 } };
+            for (int i = 0; i < 4; i++) {
+                if (i % 2) send_move(p2, moves[i][0], moves[i][1]);
+                else send_bin_move(p1, moves[i][0], moves[i][1]);
+                board[moves[i][0] - 1] -= moves[i][1];
+                expect_bin_board(p1, NGP_BIN_PLAY, i % 2 ? 1 : 2, board, 5, 0);
+                expect_msg(p2, "PLAY", 2);
+            }
+            send_bin_move(p1, 5, 9);
+            board[4] = 0;
+            expect_bin_board(p1, NGP_BIN_OVER, 1, board, 5, 0);
+            expect_msg(p2, "OVER", 3);
+
+            expect_bin_close(p1);
+            expect_close(p2);
+            close(p1);
+            close(p2);
+        }
+        printf("\n");
+    }
+
+    // [TEST] binary: a frame of unknown type ends the game like a disconnect
+    {
+        printf("[TEST] binary: unknown type should FAIL 10 Invalid and close, opponent gets a forfeit OVER\n");
+
+        int a = connect_tcp(host, port);
+        int b = connect_tcp(host, port);
+        CHECK(a >= 0 && b >= 0, "connect failed a=%d b=%d", a, b);
+
+        if (a >= 0 && b >= 0) {
+            int board[] = { 1, 3, 5, 7, 9 };
+
+            send_bin_open(a, "UnknownA", 0);
+            expect_bin(a, NGP_BIN_WAIT, 0, NULL);
+            send_open(b, "UnknownB");
+            expect_msg(b, "WAIT", 0);
+            expect_bin(a, NGP_BIN_NAME, 1, NULL);
+            expect_msg(b, "NAME", 2);
+            expect_bin_board(a, NGP_BIN_PLAY, 1, board, 5, 0);
+            expect_msg(b, "PLAY", 2);
+
+            send_raw(a, "1\x09\x01\x01");
+            expect_bin(a, NGP_BIN_FAIL, 10, NULL);
+            expect_bin_close(a);
+
+            NgpMsg m;
+            int rc = ngp_recv(b, &m);
+            CHECK(rc == 1, "expected OVER after forfeit but recv failed rc=%d", rc);
+            if (rc == 1) {
+                CHECK(strcmp(m.type, "OVER") == 0, "expected OVER got %s (raw=%s)", m.type, m.raw);
+                CHECK(m.field_count == 3 && strcmp(m.fields[0], "2") == 0 && strcmp(m.fields[2], "Forfeit") == 0,
+                      "expected OVER|2|...|Forfeit| (raw=%s)", m.raw);
+            }
+            expect_close(b);
+            close(a);
+            close(b);
+        }
+        printf("\n");
+    }
+
+    // [TEST] journal round trip: a game played with -j reads back through nimjournal
+    if (g_nimd != NULL) {
+        printf("[TEST] journal round trip: START, MOVE and forfeit OVER read back by nimjournal\n");
+
+        char path[] = "/tmp/spec_journal_XXXXXX";
+        int tmp = mkstemp(path);
+        if (tmp >= 0) close(tmp);
+        unlink(path);
+
+        char *args[] = { (char *)g_nimd, "-e", "epoll", "-j", path, own_port, NULL };
+        pid_t pid = spawn_nimd(host, own_port, args);
+        CHECK(pid > 0, "could not start %s -j %s %s", g_nimd, path, own_port);
+
+        if (pid > 0) {
+            int a = connect_tcp(host, own_port);
+            int b = connect_tcp(host, own_port);
+            CHECK(a >= 0 && b >= 0, "connect failed a=%d b=%d", a, b);
+            if (a >= 0 && b >= 0) {
+                send_open(a, "JrnA");
+                expect_msg(a, "WAIT", 0);
+                send_open(b, "JrnB");
+                expect_msg(b, "WAIT", 0);
+                expect_msg(a, "NAME", 2);
+                expect_msg(b, "NAME", 2);
+                expect_msg(a, "PLAY", 2);
+                expect_msg(b, "PLAY", 2);
+
+                send_move(a, 1, 1);
+                expect_msg(a, "PLAY", 2);
+                expect_msg(b, "PLAY", 2);
+
+                close(b);
+                expect_msg(a, "OVER", 3);
+                expect_close(a);
+            }
+            if (a >= 0) close(a);
+            stop_nimd(pid, SIGTERM);
+
+            char out[4096];
+            run_tool("nimjournal", path, out, sizeof(out));
+            CHECK(strstr(out, "RUN ") != NULL, "nimjournal shows no RUN record:\n%s", out);
+            CHECK(strstr(out, "START 'JrnA' vs 'JrnB'") != NULL, "nimjournal shows no START:\n%s", out);
+            CHECK(strstr(out, "MOVE P1 pile 1 qty 1 -> 0 3 5 7 9") != NULL, "nimjournal shows no MOVE:\n%s", out);
+            CHECK(strstr(out, "OVER P1 wins by forfeit") != NULL, "nimjournal shows no forfeit OVER:\n%s", out);
+        }
+        unlink(path);
+        printf("\n");
+    }
+
+    // [TEST] snapshot reattach: a game killed mid play resumes within the -r window
+    if (g_nimd != NULL) {
+        printf("[TEST] snapshot reattach: after kill -9, both players OPEN again and get the saved board\n");
+
+        char path[] = "/tmp/spec_snapshot_XXXXXX";
+        int tmp = mkstemp(path);
+        if (tmp >= 0) close(tmp);
+        unlink(path);
+
+        char *args[] = { (char *)g_nimd, "-e", "epoll", "-s", path, "-r", "10", own_port, NULL };
+        pid_t pid = spawn_nimd(host, own_port, args);
+        CHECK(pid > 0, "could not start %s -s %s %s", g_nimd, path, own_port);
+
+        if (pid > 0) {
+            int a = connect_tcp(host, own_port);
+            int b = connect_tcp(host, own_port);
+            CHECK(a >= 0 && b >= 0, "connect failed a=%d b=%d", a, b);
+            if (a >= 0 && b >= 0) {
+                send_open(a, "SnapA");
+                expect_msg(a, "WAIT", 0);
+                send_open(b, "SnapB");
+                expect_msg(b, "WAIT", 0);
+                expect_msg(a, "NAME", 2);
+                expect_msg(b, "NAME", 2);
+                expect_msg(a, "PLAY", 2);
+                expect_msg(b, "PLAY", 2);
+
+                send_move(a, 1, 1);
+                expect_msg(a, "PLAY", 2);
+                expect_msg(b, "PLAY", 2);
+            }
+
+            // Long enough for the writer's 100ms pass to save the move; the crash comes
+            // before the players hang up, which would forfeit the game
+            struct timespec nap = { 0, 500000000 };
+            nanosleep(&nap, NULL);
+            stop_nimd(pid, SIGKILL);
+            if (a >= 0) close(a);
+            if (b >= 0) close(b);
+        }
+
+        pid = pid > 0 ? spawn_nimd(host, own_port, args) : -1;
+        CHECK(pid > 0, "could not restart %s -s %s -r 10 %s", g_nimd, path, own_port);
+
+        if (pid > 0) {
+            int a = connect_tcp(host, own_port);
+            int b = connect_tcp(host, own_port);
+            CHECK(a >= 0 && b >= 0, "connect failed a=%d b=%d", a, b);
+            if (a >= 0 && b >= 0) {
+                send_open(a, "SnapA");
+                expect_msg(a, "WAIT", 0);
+                send_open(b, "SnapB");
+                expect_msg(b, "WAIT", 0);
+                expect_msg(a, "NAME", 2);
+                expect_msg(b, "NAME", 2);
+
+                int fds[2] = { a, b };
+                for (int i = 0; i < 2; i++) {
+                    NgpMsg m;
+                    int rc = ngp_recv(fds[i], &m);
+                    CHECK(rc == 1, "expected resumed PLAY but recv failed rc=%d", rc);
+                    if (rc == 1) {
+                        CHECK(strcmp(m.type, "PLAY") == 0 && m.field_count == 2, "expected PLAY got %s (raw=%s)", m.type, m.raw);
+                        if (m.field_count == 2) {
+                            CHECK(strcmp(m.fields[0], "2") == 0, "resumed game must be P2's turn, got '%s' (raw=%s)", m.fields[0], m.raw);
+                            CHECK(strcmp(m.fields[1], "0 3 5 7 9") == 0, "resumed board must be the saved one, got '%s' (raw=%s)", m.fields[1], m.raw);
+                        }
+                    }
+                }
+
+                // And the game goes on
+                send_move(b, 2, 3);
+                expect_msg(a, "PLAY", 2);
+                expect_msg(b, "PLAY", 2);
+            }
+            if (a >= 0) close(a);
+            if (b >= 0) close(b);
+            stop_nimd(pid, SIGTERM);
+        }
+
+        char tmp_path[64];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+        unlink(path);
+        unlink(tmp_path);
+        printf("\n");
+    }
+
+    // [TEST] -b board: games start on it, its piles bound MOVE, and the journal keeps its size
+    if (g_nimd != NULL) {
+        printf("[TEST] -b 2,4,6: PLAY carries the board, pile 4 is FAIL 32, nimjournal prints 3 piles\n");
+
+        char path[] = "/tmp/spec_board_XXXXXX";
+        int tmp = mkstemp(path);
+        if (tmp >= 0) close(tmp);
+        unlink(path);
+
+        char *args[] = { (char *)g_nimd, "-e", "epoll", "-b", "2,4,6", "-j", path, own_port, NULL };
+        pid_t pid = spawn_nimd(host, own_port, args);
+        CHECK(pid > 0, "could not start %s -b 2,4,6 %s", g_nimd, own_port);
+
+        if (pid > 0) {
+            int a = connect_tcp(host, own_port);
+            int b = connect_tcp(host, own_port);
+            CHECK(a >= 0 && b >= 0, "connect failed a=%d b=%d", a, b);
+            if (a >= 0 && b >= 0) {
+                send_open(a, "BoardA");
+                expect_msg(a, "WAIT", 0);
+                send_open(b, "BoardB");
+                expect_msg(b, "WAIT", 0);
+                expect_msg(a, "NAME", 2);
+                expect_msg(b, "NAME", 2);
+
+                int fds[2] = { a, b };
+                for (int i = 0; i < 2; i++) {
+                    NgpMsg m;
+                    int rc = ngp_recv(fds[i], &m);
+                    CHECK(rc == 1, "expected PLAY but recv failed rc=%d", rc);
+                    if (rc == 1) {
+                        CHECK(strcmp(m.type, "PLAY") == 0 && m.field_count == 2, "expected PLAY got %s (raw=%s)", m.type, m.raw);
+                        if (m.field_count == 2) {
+                            CHECK(strcmp(m.fields[1], "2 4 6") == 0, "board must be 2 4 6, got '%s' (raw=%s)", m.fields[1], m.raw);
+                        }
+                    }
+                }
+
+                send_move(a, 4, 1);
+                expect_fail(a, "32");
+
+                send_move(a, 1, 1);
+                expect_msg(a, "PLAY", 2);
+                expect_msg(b, "PLAY", 2);
+
+                close(b);
+                expect_msg(a, "OVER", 3);
+                expect_close(a);
+            }
+            if (a >= 0) close(a);
+            stop_nimd(pid, SIGTERM);
+
+            char out[4096];
+            run_tool("nimjournal", path, out, sizeof(out));
+            CHECK(strstr(out, "board 2 4 6") != NULL, "nimjournal shows no board on RUN:\n%s", out);
+            CHECK(strstr(out, "MOVE P1 pile 1 qty 1 -> 1 4 6\n") != NULL, "nimjournal shows no 3 pile MOVE:\n%s", out);
+        }
+        unlink(path);
+        printf("\n");
+    }
+
     printf("PASS=%d  FAIL=%d\n", g_pass, g_fail);
     return (g_fail == 0) ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,104 @@
+#include <string.h>
+#include "timer.h"
+
+#define TIMER_MAX_TICKS ((1ULL << (TIMER_SLOT_BITS * TIMER_LEVELS)) - 1)
+
+void timer_wheel_init(TimerWheel *w, long long now_ms, int tick_ms)
+{
+    memset(w, 0, sizeof(*w));
+    w->start_ms = now_ms;
+    w->tick_ms = tick_ms > 0 ? tick_ms : 1;
+}
+
+static void link_slot(Timer **head, Timer *t)
+{
+    t->next = *head;
+    if (t->next != NULL) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+}
+
+static void unlink_slot(Timer *t)
+{
+    *t->pprev = t->next;
+    if (t->next != NULL) t->next->pprev = t->pprev;
+    t->next = NULL;
+    t->pprev = NULL;
+}
+
+// The lowest level whose span covers the time left; higher levels get coarser slots that
+// cascade down before the timer is due
+static void place(TimerWheel *w, Timer *t)
+{
+    unsigned long long delta = t->expires - w->now;
+    if (delta > TIMER_MAX_TICKS) {
+        t->expires = w->now + TIMER_MAX_TICKS;
+        delta = TIMER_MAX_TICKS;
+    }
+
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && delta >= (1ULL << (TIMER_SLOT_BITS * (level + 1)))) level++;
+    unsigned slot = (unsigned)(t->expires >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1);
+    link_slot(&w->slots[level][slot], t);
+}
+
+void timer_arm(TimerWheel *w, Timer *t, long long when_ms)
+{
+    if (timer_armed(t)) unlink_slot(t);
+    else w->count++;
+
+    long long rel = when_ms - w->start_ms;
+    unsigned long long tick = rel <= 0 ? 0 : (unsigned long long)((rel + w->tick_ms - 1) / w->tick_ms);
+    t->expires = tick > w->now ? tick : w->now + 1;
+    place(w, t);
+}
+
+void timer_cancel(TimerWheel *w, Timer *t)
+{
+    if (!timer_armed(t)) return;
+    unlink_slot(t);
+    w->count--;
+}
+
+// Move every timer of one slot to where it belongs now
+static void cascade(TimerWheel *w, int level, unsigned slot)
+{
+    Timer *list = w->slots[level][slot];
+    w->slots[level][slot] = NULL;
+    while (list != NULL) {
+        Timer *t = list;
+        list = t->next;
+        place(w, t);
+    }
+}
+
+void timer_advance(TimerWheel *w, long long now_ms)
+{
+    long long rel = now_ms - w->start_ms;
+    if (rel < 0) return;
+    unsigned long long target = (unsigned long long)(rel / w->tick_ms);
+
+    while (w->now < target) {
+        // Nothing to cascade or fire, the wheel can jump straight there
+        if (w->count == 0) {
+            w->now = target;
+            return;
+        }
+        w->now++;
+
+        // Coarsest first, so its timers can still land in the finer slots due this tick
+        for (int level = TIMER_LEVELS - 1; level > 0; level--) {
+            unsigned long long mask = (1ULL << (TIMER_SLOT_BITS * level)) - 1;
+            if ((w->now & mask) == 0) cascade(w, level, (unsigned)(w->now >> (TIMER_SLOT_BITS * level)) & (TIMER_SLOTS - 1));
+        }
+
+        // Taken one at a time, a callback may cancel the next one
+        Timer **head = &w->slots[0][w->now & (TIMER_SLOTS - 1)];
+        while (*head != NULL) {
+            Timer *t = *head;
+            unlink_slot(t);
+            w->count--;
+            t->fn(t);
+        }
+    }
+}
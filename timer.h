@@ -0,0 +1,55 @@
+#ifndef NIMD_TIMER_H
+#define NIMD_TIMER_H
+
+// Hierarchical timer wheel for connection deadlines
+// TIMER_LEVELS wheels of TIMER_SLOTS slots each: level 0 holds timers due within
+// TIMER_SLOTS ticks, level 1 within TIMER_SLOTS^2 and so on; timers cascade down a level
+// as their slot comes around. Arm and cancel are O(1) list operations. A wheel is not
+// locked, whoever owns it arms, cancels and advances it from one thread (or under one lock)
+
+#define TIMER_SLOT_BITS 8
+#define TIMER_SLOTS     (1 << TIMER_SLOT_BITS)
+#define TIMER_LEVELS    4 // 2^32 ticks, years at any sensible tick
+
+typedef struct Timer {
+    struct Timer *next;
+    struct Timer **pprev; // Link pointing at us, NULL while not armed
+    unsigned long long expires; // Tick
+    void (*fn)(struct Timer *t); // Runs from timer_advance, the timer is already disarmed
+    void *data;
+} Timer;
+
+typedef struct {
+    Timer *slots[TIMER_LEVELS][TIMER_SLOTS];
+    unsigned long long now; // Last tick processed
+    long long start_ms; // Time of tick 0
+    int tick_ms;
+    int count; // Armed timers
+} TimerWheel;
+
+void timer_wheel_init(TimerWheel *w, long long now_ms, int tick_ms);
+
+static inline void timer_init(Timer *t, void (*fn)(Timer *t), void *data)
+{
+    t->next = NULL;
+    t->pprev = NULL;
+    t->expires = 0;
+    t->fn = fn;
+    t->data = data;
+}
+
+static inline int timer_armed(const Timer *t)
+{
+    return t->pprev != NULL;
+}
+
+// (Re)arm t to fire at when_ms, rounded up to a tick and never earlier than the next one
+void timer_arm(TimerWheel *w, Timer *t, long long when_ms);
+
+// Safe on a timer that is not armed
+void timer_cancel(TimerWheel *w, Timer *t);
+
+// Fire every timer due by now_ms; callbacks may arm or cancel any timer, themselves included
+void timer_advance(TimerWheel *w, long long now_ms);
+
+#endif
@@ -0,0 +1,315 @@
+#define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // syscall, MAP_ANONYMOUS, MAP_POPULATE
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "uring.h"
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags, void *arg, size_t argsz)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz);
+}
+
+static int sys_register(int fd, unsigned op, void *arg, unsigned nr)
+{
+    return (int)syscall(__NR_io_uring_register, fd, op, arg, nr);
+}
+
+// Every opcode the server issues must be known to this kernel
+static int probe_ops(int fd)
+{
+    static const int needed[] = {
+        IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND, IORING_OP_SHUTDOWN, IORING_OP_CLOSE,
+        IORING_OP_ASYNC_CANCEL,
+    };
+    size_t len = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, len);
+    if (probe == NULL) return -ENOMEM;
+
+    int ret = 0;
+    if (sys_register(fd, IORING_REGISTER_PROBE, probe, 256) < 0) {
+        ret = -errno;
+    } else {
+        for (size_t i = 0; i < sizeof(needed) / sizeof(needed[0]); i++) {
+            int op = needed[i];
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) {
+                ret = -EOPNOTSUPP;
+                break;
+            }
+        }
+    }
+    free(probe);
+    return ret;
+}
+
+static void unmap_rings(Uring *r)
+{
+    if (r->sqes != NULL && r->sqes != MAP_FAILED) munmap(r->sqes, r->sqes_sz);
+    if (r->cq_ring != NULL && r->cq_ring != MAP_FAILED && r->cq_ring != r->sq_ring) munmap(r->cq_ring, r->cq_ring_sz);
+    if (r->sq_ring != NULL && r->sq_ring != MAP_FAILED) munmap(r->sq_ring, r->sq_ring_sz);
+}
+
+// Register buf_count buffers of buf_size bytes as group URING_BUF_GROUP
+static int setup_buffers(Uring *r, unsigned buf_count, unsigned buf_size)
+{
+    r->buf_count = buf_count;
+    r->buf_size = buf_size;
+    r->br_sz = buf_count * sizeof(struct io_uring_buf);
+
+    r->br = mmap(NULL, r->br_sz, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+    if (r->br == MAP_FAILED) {
+        r->br = NULL;
+        return -errno;
+    }
+    r->bufs = malloc((size_t)buf_count * buf_size);
+    if (r->bufs == NULL) return -ENOMEM;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (unsigned long long)(size_t)r->br;
+    reg.ring_entries = buf_count;
+    reg.bgid = URING_BUF_GROUP;
+    if (sys_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) return -errno;
+
+    for (unsigned bid = 0; bid < buf_count; bid++) {
+        struct io_uring_buf *b = &r->br->bufs[bid];
+        b->addr = (unsigned long long)(size_t)uring_buf(r, bid);
+        b->len = buf_size;
+        b->bid = (unsigned short)bid;
+    }
+    r->br_tail = (unsigned short)buf_count;
+    __atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+    return 0;
+}
+
+// The probes' own completions. A probe that fails leaves its request armed, uring_exit
+// cancels it with the ring
+#define PROBE_DATA   1
+#define PROBE_CANCEL 2
+
+// Next completion, waiting up to a second for it. Returns 0, or -ETIME
+static int probe_cqe(Uring *r, struct io_uring_cqe *out)
+{
+    for (int i = 0; i < 100; i++) {
+        struct io_uring_cqe *cqe = uring_peek_cqe(r);
+        if (cqe != NULL) {
+            *out = *cqe;
+            uring_cqe_seen(r);
+            if (out->flags & IORING_CQE_F_BUFFER) uring_buf_recycle(r, out->flags >> IORING_CQE_BUFFER_SHIFT);
+            return 0;
+        }
+        int n = uring_submit(r, 1, 10);
+        if (n < 0 && n != -ETIME && n != -EINTR) return n;
+    }
+    return -ETIME;
+}
+
+// The request the probe just armed must complete and stay armed; a kernel that knows the
+// opcode but not its multishot flag fails it with -EINVAL, or runs it once. Returns 0 with
+// its result in res, or -errno
+static int probe_armed(Uring *r, int *res)
+{
+    struct io_uring_cqe cqe;
+    int ret = probe_cqe(r, &cqe);
+    if (ret != 0) return ret;
+    *res = cqe.res;
+    if (cqe.res < 0) return cqe.res;
+    return (cqe.flags & IORING_CQE_F_MORE) ? 0 : -EOPNOTSUPP;
+}
+
+// Cancel the armed request and see its last completion, so the ring starts out empty
+static int probe_disarm(Uring *r)
+{
+    struct io_uring_sqe *sqe = uring_get_sqe(r);
+    if (sqe == NULL) return -EBUSY;
+    uring_prep_rw(sqe, IORING_OP_ASYNC_CANCEL, -1, (void *)(size_t)PROBE_DATA, 0, PROBE_CANCEL);
+
+    int armed = 1, cancel = 1;
+    while (armed || cancel) {
+        struct io_uring_cqe cqe;
+        int ret = probe_cqe(r, &cqe);
+        if (ret != 0) return ret;
+        if (cqe.user_data == PROBE_CANCEL) cancel = 0;
+        else if (!(cqe.flags & IORING_CQE_F_MORE)) armed = 0;
+    }
+    return 0;
+}
+
+// Multishot recv into the provided buffers (6.0): one byte through a socketpair
+static int probe_recv_multishot(Uring *r)
+{
+    int sv[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0) return -errno;
+
+    int res = 0;
+    uring_prep_recv_multishot(uring_get_sqe(r), sv[0], PROBE_DATA);
+    int ret = uring_submit(r, 0, 0);
+    if (ret >= 0) ret = write(sv[1], "x", 1) == 1 ? 0 : -errno;
+    if (ret == 0) ret = probe_armed(r, &res);
+    if (ret == 0 && res != 1) ret = -EOPNOTSUPP;
+    if (ret == 0) ret = probe_disarm(r);
+    close(sv[0]);
+    close(sv[1]);
+    return ret;
+}
+
+// Multishot accept (5.19): one connection to a loopback listener
+static int probe_accept_multishot(Uring *r)
+{
+    struct sockaddr_in addr;
+    socklen_t addr_len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0) return -errno;
+    int client = -1, res = -1, ret = 0;
+    if (bind(listener, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(listener, 1) < 0 ||
+        getsockname(listener, (struct sockaddr *)&addr, &addr_len) < 0) {
+        ret = -errno;
+    } else {
+        uring_prep_accept_multishot(uring_get_sqe(r), listener, PROBE_DATA);
+        ret = uring_submit(r, 0, 0);
+        if (ret >= 0) {
+            client = socket(AF_INET, SOCK_STREAM, 0);
+            ret = (client >= 0 && connect(client, (struct sockaddr *)&addr, sizeof(addr)) == 0) ? 0 : -errno;
+        }
+        if (ret == 0) ret = probe_armed(r, &res);
+        if (res >= 0) close(res);
+        if (ret == 0) ret = probe_disarm(r);
+    }
+    if (client >= 0) close(client);
+    close(listener);
+    return ret;
+}
+
+int uring_init(Uring *r, unsigned entries, unsigned buf_count, unsigned buf_size)
+{
+    memset(r, 0, sizeof(*r));
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    // Completions can wait until the owning thread next enters the kernel, no IPI needed
+    p.flags = IORING_SETUP_COOP_TASKRUN;
+
+    r->fd = sys_setup(entries, &p);
+    if (r->fd < 0) return -errno;
+
+    int ret = -EOPNOTSUPP;
+    // Single mmap and the ext_arg timeout are 5.4 / 5.11 era, everything we need is newer still
+    if (!(p.features & IORING_FEAT_SINGLE_MMAP) || !(p.features & IORING_FEAT_EXT_ARG)) goto fail;
+    if ((ret = probe_ops(r->fd)) != 0) goto fail;
+
+    r->sq_ring_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (r->cq_ring_sz > r->sq_ring_sz) r->sq_ring_sz = r->cq_ring_sz;
+    r->cq_ring_sz = r->sq_ring_sz;
+
+    r->sq_ring = mmap(NULL, r->sq_ring_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (r->sq_ring == MAP_FAILED) {
+        ret = -errno;
+        goto fail;
+    }
+    r->cq_ring = r->sq_ring;
+
+    r->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_sz, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED) {
+        ret = -errno;
+        goto fail;
+    }
+
+    char *sq = r->sq_ring;
+    r->sq_head = (unsigned *)(sq + p.sq_off.head);
+    r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    r->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+    r->sq_entries = p.sq_entries;
+    r->sq_array = (unsigned *)(sq + p.sq_off.array);
+    r->sqe_tail = *r->sq_tail;
+
+    char *cq = r->cq_ring;
+    r->cq_head = (unsigned *)(cq + p.cq_off.head);
+    r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    r->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    // SQ slot i always holds SQE i, so the index array is filled once
+    for (unsigned i = 0; i < r->sq_entries; i++) r->sq_array[i] = i;
+
+    if ((ret = setup_buffers(r, buf_count, buf_size)) != 0) goto fail;
+    // Knowing the opcodes is not enough: kernels before 6.0 take multishot requests apart
+    // only when they run, so try each one the server arms before it relies on them
+    if ((ret = probe_accept_multishot(r)) != 0 || (ret = probe_recv_multishot(r)) != 0) goto fail;
+    return 0;
+
+fail:
+    uring_exit(r);
+    return ret;
+}
+
+void uring_exit(Uring *r)
+{
+    unmap_rings(r);
+    if (r->br != NULL) munmap(r->br, r->br_sz);
+    free(r->bufs);
+    if (r->fd >= 0) close(r->fd);
+    memset(r, 0, sizeof(*r));
+    r->fd = -1;
+}
+
+struct io_uring_sqe *uring_get_sqe(Uring *r)
+{
+    unsigned head = __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+    if (r->sqe_tail - head >= r->sq_entries) return NULL;
+
+    struct io_uring_sqe *sqe = &r->sqes[r->sqe_tail & r->sq_mask];
+    r->sqe_tail++;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_submit(Uring *r, int wait, int timeout_ms)
+{
+    // Count from the kernel's head, SQEs it left behind last time still need submitting
+    __atomic_store_n(r->sq_tail, r->sqe_tail, __ATOMIC_RELEASE);
+    unsigned to_submit = r->sqe_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+
+    if (!wait) {
+        if (to_submit == 0) return 0;
+        int n = sys_enter(r->fd, to_submit, 0, 0, NULL, 0);
+        return n < 0 ? -errno : n;
+    }
+
+    struct __kernel_timespec ts;
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (long long)(timeout_ms % 1000) * 1000000;
+
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (unsigned long long)(size_t)&ts;
+
+    int n = sys_enter(r->fd, to_submit, 1, IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    return n < 0 ? -errno : n;
+}
+
+void uring_buf_recycle(Uring *r, unsigned bid)
+{
+    struct io_uring_buf *b = &r->br->bufs[r->br_tail & (r->buf_count - 1)];
+    b->addr = (unsigned long long)(size_t)uring_buf(r, bid);
+    b->len = r->buf_size;
+    b->bid = (unsigned short)bid;
+    r->br_tail++;
+    __atomic_store_n(&r->br->tail, r->br_tail, __ATOMIC_RELEASE);
+}
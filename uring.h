@@ -0,0 +1,129 @@
+#ifndef NIMD_URING_H
+#define NIMD_URING_H
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+// Minimal io_uring ring on top of the raw syscalls (no liburing)
+// One ring belongs to one thread: SQEs are filled in place and published by uring_submit,
+// completions are read in place and released with uring_cqe_seen. Received bytes land in
+// a provided buffer ring, so a multishot recv posts no buffer of its own per connection
+
+typedef struct {
+    int fd;
+
+    // Submission queue
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sqe_tail; // SQEs handed out, published to *sq_tail on submit
+
+    // Completion queue
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *sq_ring;
+    size_t sq_ring_sz;
+    void *cq_ring;
+    size_t cq_ring_sz;
+    size_t sqes_sz;
+
+    // Provided receive buffers (group URING_BUF_GROUP)
+    struct io_uring_buf_ring *br;
+    size_t br_sz;
+    char *bufs;
+    unsigned buf_count; // Power of two
+    unsigned buf_size;
+    unsigned short br_tail;
+} Uring;
+
+#define URING_BUF_GROUP 0
+
+// Returns 0, or -errno when the kernel lacks io_uring or one of the features we use
+int uring_init(Uring *r, unsigned entries, unsigned buf_count, unsigned buf_size);
+void uring_exit(Uring *r);
+
+// Next free SQE, zeroed; NULL when the submission queue is full
+struct io_uring_sqe *uring_get_sqe(Uring *r);
+
+// SQEs handed out but not yet submitted
+static inline unsigned uring_sq_pending(Uring *r)
+{
+    return r->sqe_tail - *r->sq_tail;
+}
+
+// Submit pending SQEs, and when wait is set sleep until a completion or timeout_ms
+// Returns the number submitted or -errno (-ETIME and -EINTR are normal wake-ups)
+int uring_submit(Uring *r, int wait, int timeout_ms);
+
+// Oldest unseen completion, NULL when there is none
+static inline struct io_uring_cqe *uring_peek_cqe(Uring *r)
+{
+    unsigned head = *r->cq_head;
+    if (head == __atomic_load_n(r->cq_tail, __ATOMIC_ACQUIRE)) return NULL;
+    return &r->cqes[head & r->cq_mask];
+}
+
+static inline void uring_cqe_seen(Uring *r)
+{
+    __atomic_store_n(r->cq_head, *r->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+// Provided buffer a completion's bytes were received into
+static inline char *uring_buf(Uring *r, unsigned bid)
+{
+    return r->bufs + (size_t)bid * r->buf_size;
+}
+
+// Hand a provided buffer back to the kernel once its bytes were consumed
+void uring_buf_recycle(Uring *r, unsigned bid);
+
+static inline void uring_prep_rw(struct io_uring_sqe *sqe, int op, int fd, const void *addr, unsigned len, unsigned long long data)
+{
+    sqe->opcode = (unsigned char)op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long long)(size_t)addr;
+    sqe->len = len;
+    sqe->user_data = data;
+}
+
+// Keeps accepting on listener until cancelled, one completion per connection
+static inline void uring_prep_accept_multishot(struct io_uring_sqe *sqe, int listener, unsigned long long data)
+{
+    uring_prep_rw(sqe, IORING_OP_ACCEPT, listener, NULL, 0, data);
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+}
+
+// Keeps receiving into provided buffers until EOF, an error, or the buffers run out
+static inline void uring_prep_recv_multishot(struct io_uring_sqe *sqe, int fd, unsigned long long data)
+{
+    uring_prep_rw(sqe, IORING_OP_RECV, fd, NULL, 0, data);
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUF_GROUP;
+}
+
+static inline void uring_prep_send(struct io_uring_sqe *sqe, int fd, const void *buf, unsigned len, unsigned long long data)
+{
+    uring_prep_rw(sqe, IORING_OP_SEND, fd, buf, len, data);
+    sqe->msg_flags = MSG_NOSIGNAL;
+}
+
+static inline void uring_prep_shutdown(struct io_uring_sqe *sqe, int fd, int how, unsigned long long data)
+{
+    uring_prep_rw(sqe, IORING_OP_SHUTDOWN, fd, NULL, (unsigned)how, data);
+}
+
+static inline void uring_prep_close(struct io_uring_sqe *sqe, int fd, unsigned long long data)
+{
+    uring_prep_rw(sqe, IORING_OP_CLOSE, fd, NULL, 0, data);
+}
+
+#endif